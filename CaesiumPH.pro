@@ -19,12 +19,14 @@ macx {
     QMAKE_CXXFLAGS += -stdlib=libc++
     LIBS += -L/usr/local/lib -lexiv2.14 -L/opt/mozjpeg/lib -ljpeg.62 -stdlib=libc++
     INCLUDEPATH += /opt/mozjpeg/include /usr/local/include
+    DEFINES += CCLT_MOZJPEG
     ICON = icons/icons/icon.icns
 }
 
 win32 {
     LIBS += -LC:\\mozjpeg\\lib -ljpeg -LC:\\exiv2\\src\\.libs -lexiv2
     INCLUDEPATH += C:\\mozjpeg\\include C:\\exiv2\\include
+    DEFINES += CCLT_MOZJPEG
     RC_ICONS = icons/main/icon.ico
 }
 
@@ -39,24 +41,62 @@ SOURCES += src/main.cpp\
     src/aboutdialog.cpp \
     src/cimageinfo.cpp \
     src/lossless.cpp \
+    src/transform.cpp \
+    src/markers.cpp \
+    src/scans.cpp \
+    src/tiff.cpp \
+    src/inspect.cpp \
     src/utils.cpp \
     src/exif.cpp \
     src/preferencedialog.cpp \
     src/networkoperations.cpp \
     src/qdroptreewidget.cpp \
-    src/cphlist.cpp
+    src/cphlist.cpp \
+    src/ctrace.cpp \
+    src/cioscheduler.cpp \
+    src/ciouring.cpp \
+    src/cprefetcher.cpp \
+    src/ccompressionpool.cpp \
+    src/cresultqueue.cpp \
+    src/cworker.cpp \
+    src/cworkerpool.cpp \
+    src/cjobserver.cpp \
+    src/cremoteworker.cpp \
+    src/chttpserver.cpp \
+    src/cpipe.cpp \
+    src/carchive.cpp \
+    src/caudit.cpp
 
 HEADERS  += src/caesiumph.h \
     src/aboutdialog.h \
     src/cimageinfo.h \
     src/lossless.h \
+    src/transform.h \
+    src/markers.h \
+    src/scans.h \
+    src/tiff.h \
+    src/inspect.h \
     src/utils.h \
     src/exif.h \
     src/preferencedialog.h \
     src/networkoperations.h \
     src/qdroptreewidget.h \
     src/ctreewidgetitem.h \
-    src/cphlist.h
+    src/cphlist.h \
+    src/ctrace.h \
+    src/cioscheduler.h \
+    src/ciouring.h \
+    src/cprefetcher.h \
+    src/ccompressionpool.h \
+    src/cresultqueue.h \
+    src/cworker.h \
+    src/cworkerpool.h \
+    src/cjobserver.h \
+    src/cremoteworker.h \
+    src/chttpserver.h \
+    src/cpipe.h \
+    src/carchive.h \
+    src/caudit.h
 
 FORMS    += \
     src/aboutdialog.ui \
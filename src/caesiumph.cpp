@@ -26,6 +26,8 @@
 #include "aboutdialog.h"
 #include "utils.h"
 #include "lossless.h"
+#include "transform.h"
+#include "inspect.h"
 #include "cimageinfo.h"
 #include "exif.h"
 #include "preferencedialog.h"
@@ -33,6 +35,13 @@
 #include "qdroptreewidget.h"
 #include "ctreewidgetitem.h"
 #include "cphlist.h"
+#include "ctrace.h"
+#include "cioscheduler.h"
+#include "ciouring.h"
+#include "ccompressionpool.h"
+#include "cworker.h"
+#include "cworkerpool.h"
+#include "cjobserver.h"
 
 #include <QProgressDialog>
 #include <QFileDialog>
@@ -53,6 +62,8 @@
 #include <QMovie>
 
 #include <exiv2/exiv2.hpp>
+#include <string.h>
+#include <algorithm>
 
 #include <QDebug>
 
@@ -161,6 +172,16 @@ void CaesiumPH::initializeConnections() {
     connect(ui->listTreeWidget, SIGNAL(dropFinished(QStringList)), this, SLOT(showImportProgressDialog(QStringList)));
     //Context menu
     connect(ui->listTreeWidget, SIGNAL(customContextMenuRequested(QPoint)), this, SLOT(showListContextMenu(QPoint)));
+    //Results of the workers
+    connect(&resultTimer, SIGNAL(timeout()), this, SLOT(applyResults()));
+    //Items can be removed while a canceled batch is finishing
+    connect(ui->listTreeWidget->model(), SIGNAL(rowsAboutToBeRemoved(QModelIndex,int,int)), this, SLOT(forgetBatchItems(QModelIndex,int,int)));
+    connect(ui->listTreeWidget->model(), &QAbstractItemModel::modelAboutToBeReset, this, [this] () {
+        batchItems.clear();
+    });
+    //Connect two slots for handling compression start/finish
+    connect(&batchWatcher, SIGNAL(started()), this, SLOT(compressionStarted()));
+    connect(&batchWatcher, SIGNAL(finished()), this, SLOT(compressionFinished()));
 
     //Update button
     connect(updateButton, SIGNAL(released()), this, SLOT(on_updateButton_clicked()));
@@ -170,29 +191,9 @@ void CaesiumPH::initializeConnections() {
 }
 
 void CaesiumPH::readPreferences() {
-    //Read important parameters from settings
-    QSettings settings;
-
-    settings.beginGroup(KEY_PREF_GROUP_COMPRESSION);
-    params.exif = settings.value(KEY_PREF_COMPRESSION_EXIF).value<bool>();
-    params.progressive = settings.value(KEY_PREF_COMPRESSION_PROGRESSIVE).value<bool>();
-    params.importantExifs.clear();
-    if (settings.value(KEY_PREF_COMPRESSION_EXIF_COPYRIGHT).value<bool>()) {
-        params.importantExifs.append(EXIF_COPYRIGHT);
-    }
-    if (settings.value(KEY_PREF_COMPRESSION_EXIF_DATE).value<bool>()) {
-        params.importantExifs.append(EXIF_DATE);
-    }
-    if (settings.value(KEY_PREF_COMPRESSION_EXIF_COMMENT).value<bool>()) {
-        params.importantExifs.append(EXIF_COMMENTS);
-    }
-    settings.endGroup();
-
-    settings.beginGroup(KEY_PREF_GROUP_GENERAL);
-    params.overwrite = settings.value(KEY_PREF_GENERAL_OVERWRITE).value<bool>();
-    params.outMethodIndex = settings.value(KEY_PREF_GENERAL_OUTPUT_METHOD).value<int>();
-    params.outMethodString = settings.value(KEY_PREF_GENERAL_OUTPUT_STRING).value<QString>();
-    settings.endGroup();
+    readParams();
+    //Workers may connect any time, not only during a batch
+    CJobServer::instance()->configure(params.remotePort, params.remoteToken, params.remoteShared);
 }
 
 //Button hover functions
@@ -325,28 +326,29 @@ void CaesiumPH::showImportProgressDialog(QStringList list) {
         progress.setValue(i);
 
         //Validate extension
-        if (!isJPEG(QStringToChar(list.at(i)))) {
+        if (!isJPEG(list.at(i))) {
             continue;
         }
 
         //Generate new CImageInfo
-        CImageInfo* currentItemInfo = new CImageInfo(list.at(i));
+        CImageInfo currentItemInfo(list.at(i));
 
         //Check if it has a duplicate
-        if (hasADuplicateInList(currentItemInfo)) {
+        if (hasADuplicateInList(&currentItemInfo)) {
             duplicate_count++;
             continue;
         }
 
         //Populate list
-        QStringList itemContent = QStringList() << currentItemInfo->getBaseName()
-                                                << currentItemInfo->getFormattedSize()
+        QStringList itemContent = QStringList() << currentItemInfo.getBaseName()
+                                                << currentItemInfo.getFormattedSize()
                                                 << ""
                                                 << ""
-                                                << currentItemInfo->getFullPath();
+                                                << currentItemInfo.getFullPath();
 
-        ui->listTreeWidget->addTopLevelItem(new CTreeWidgetItem(ui->listTreeWidget,
-                                                                itemContent));
+        CTreeWidgetItem* treeItem = new CTreeWidgetItem(ui->listTreeWidget, itemContent);
+        treeItem->setData(COLUMN_ORIGINAL_SIZE, ROLE_SIZE, currentItemInfo.getSize());
+        ui->listTreeWidget->addTopLevelItem(treeItem);
 
         item_count++;
 
@@ -374,6 +376,18 @@ void CaesiumPH::on_actionAdd_folder_triggered() {
     }
 }
 
+void CaesiumPH::on_actionCompress_first_triggered() {
+    //Flags them for the next batch, bold until compressed
+    foreach (QTreeWidgetItem* item, ui->listTreeWidget->selectedItems()) {
+        item->setData(COLUMN_NAME, ROLE_PRIORITY, true);
+        QFont font = item->font(COLUMN_NAME);
+        font.setBold(true);
+        item->setFont(COLUMN_NAME, font);
+    }
+    ui->statusBar->showMessage(QString::number(ui->listTreeWidget->selectedItems().count()) +
+                               tr(" items will be compressed first"));
+}
+
 void CaesiumPH::on_actionRemove_items_triggered() {
     int count = ui->listTreeWidget->selectedItems().count();
     if (count == ui->listTreeWidget->topLevelItemCount()) {
@@ -391,119 +405,336 @@ void CaesiumPH::on_actionRemove_items_triggered() {
     ui->statusBar->showMessage(QString::number(count) + tr(" items removed"));
 }
 
-void CaesiumPH::compressRoutine(CTreeWidgetItem* item) {
+//Dropped bytes per class, like "EXIF 12.1 KB, XMP 4 KB"
+static QString markerStatsToString(const cclt_marker_stats& stats) {
+    QStringList classes;
+    for (int i = 0; i < CCLT_MARKER_CLASSES; i++) {
+        if (stats.dropped[i] > 0) {
+            classes.append(QString(cclt_marker_class_name(i)) + " " + toHumanSize(stats.dropped[i]));
+        }
+    }
+    return classes.join(", ");
+}
+
+//Prediction from the first bytes of the file, enough for the tables of most of them
+static cbatchfile batchEstimate(const cbatchfile& batchFile) {
+    cbatchfile estimate = batchFile;
+    estimate.gain = true;
+    //A stat and, the first time a disk is seen, a look at its kind
+    estimate.device = CIOScheduler::instance()->device(batchFile.path);
+    QFile file(batchFile.path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return estimate;
+    }
+    qint64 size = file.size();
+    QByteArray head = file.read(CCLT_INSPECT_PREFIX);
+    cclt_inspection inspection;
+    if (cclt_inspect_buffer((unsigned char*) head.constData(), head.size(), params.markers, &inspection) != CCLT_OK) {
+        estimate.cost = size * size;
+        return estimate;
+    }
+    estimate.gain = cclt_gain_expected(&inspection, params.progressive, params.orientation,
+                                       params.effort, params.arithmetic);
+    //Small files are read whole, the worker can go by this instead of walking them again
+    estimate.inspected = inspection.complete || head.size() == size;
+    //The SOF can be past the prefix behind a big EXIF block, a byte usually holds a few pixels
+    qint64 pixels = (qint64) inspection.width * inspection.height;
+    estimate.cost = size * (pixels > 0 ? pixels : size * 4);
+    return estimate;
+}
+
+void CaesiumPH::compressRoutine(const cbatchfile& file) {
     //Input file path
-    QString inputPath = item->text(COLUMN_PATH);
-    QFileInfo* originalInfo = new QFileInfo(item->text(COLUMN_PATH));
-    qint64 originalSize = originalInfo->size();
+    QString inputPath = file.path;
+    QFileInfo originalInfo(inputPath);
+    qint64 originalSize = originalInfo.size();
     QString outputPath = CaesiumPH::getOutputPath(originalInfo);
 
     if (!outputPath.isNull()) {
-        qDebug() << item->text(COLUMN_PATH) << "into" << outputPath << " -- START";
+        qDebug() << inputPath << "into" << outputPath << " -- START";
+
+        //Whole file span for the trace, stages are nested into it
+        CTraceScope fileTrace("file", "file");
+        fileTrace.setArg("path", inputPath);
+        fileTrace.setArg("input_size", originalSize);
+
+        //Everything the list shows about the file, applied by the GUI thread
+        citemresult* update = new citemresult;
+        update->id = file.id;
+        update->path = inputPath;
+
+        //Read the whole input, the output is decided in memory before any write
+        QByteArray input;
+        if (prefetcher == NULL || !prefetcher->take(inputPath, &input)) {
+            CIOScope io(inputPath);
+            CTraceScope trace("read");
+            QFile inputFile(inputPath);
+            if (inputFile.open(QIODevice::ReadOnly)) {
+                input = inputFile.readAll();
+            }
+        }
 
-        //Not really necessary if we copy the whole EXIF data
-        Exiv2::ExifData exifData = getExifFromPath(QStringToChar(inputPath));
+        //Judged from the markers alone, nothing is decoded
+        bool skipped = false;
+        if (params.alreadyOptimized == OPTIMIZED_SKIP && !input.isEmpty()) {
+            cclt_inspection inspection;
+            skipped = file.inspected ? !file.gain :
+                    cclt_inspect_buffer((unsigned char*) input.constData(), input.size(), params.markers, &inspection) == CCLT_OK &&
+                    !cclt_gain_expected(&inspection, params.progressive, params.orientation,
+                                        params.effort, params.arithmetic);
+        }
 
+        cjob job = makeJob(input, inputPath);
+        auto runLocally = [&] (const cjob& local) -> cjobresult {
+            if (!params.processes) {
+                return runJob(local);
+            }
+            cjobresult result;
+            if (CWorkerPool::instance()->isQuarantined(inputPath)) {
+                result.result = WORKER_CRASHED;
+            } else {
+                result = CWorkerPool::instance()->run(local);
+                if (result.result == WORKER_CRASHED) {
+                    CWorkerPool::instance()->quarantine(inputPath);
+                }
+            }
+            return result;
+        };
+        cjobresult compression;
         //BUG Sometimes files are empty. Check it out.
-        int result = cclt_optimize(QStringToChar(inputPath),
-                      QStringToChar(outputPath),
-                      params.exif,
-                      params.progressive,
-                      QStringToChar(inputPath));
-
-        if (result < 0) {
-            qCritical() << "An error as occurred while compressing" << item->text(COLUMN_PATH) << "into" << outputPath;
+        if (input.isEmpty()) {
+            compression.result = CCLT_ERROR;
+        } else if (skipped) {
+            compression.result = CCLT_BIGGER;
+        } else if (params.remotePort > 0) {
+            compression = CJobServer::instance()->run(job, runLocally);
         } else {
-            qInfo() << item->text(COLUMN_PATH) << "into" << outputPath << " -- OK";
+            compression = runLocally(job);
         }
-
-
-        //Write important metadata as user requested
-        if (params.exif != 2 && !params.importantExifs.isEmpty()) {
-            writeSpecificExifTags(exifData, outputPath, params.importantExifs);
+        int result = compression.result;
+        QByteArray output = compression.output;
+
+        //One bad file fails alone, the batch goes on
+        QString jpegMessage = compression.message;
+        if (input.isEmpty()) {
+            recordFailure(update, tr("Could not read the file"));
+        } else if (result == WORKER_CRASHED) {
+            recordFailure(update, tr("The file crashed the compression, quarantined"));
+        } else if (result == WORKER_TIMED_OUT) {
+            recordFailure(update, tr("The compression took too long, try again or lower the effort"));
+        } else if (result == CCLT_CORRUPT) {
+            recordFailure(update, tr("Damaged image data, ") + jpegMessage);
+        } else if (result < 0) {
+            recordFailure(update, tr("Not a valid JPEG, ") + jpegMessage);
+        } else if (!compression.verified) {
+            recordFailure(update, tr("Verification failed, original kept"));
+        } else if (skipped) {
+            qInfo() << inputPath << "is already optimized, skipped";
+            update->toolTip = tr("Already optimized, skipped");
+        } else {
+            if (!jpegMessage.isEmpty()) {
+                qWarning() << inputPath << ":" << jpegMessage;
+            }
+            qInfo() << inputPath << "into" << outputPath << " -- OK";
         }
 
-        //Gets new file info
-        QFileInfo* fileInfo = new QFileInfo(outputPath);
-        //Get the new size
-        qint64 outputSize = fileInfo->size();
+        bool optimized = (result == CCLT_OK || CCLT_MUST_REPLACE(result)) && compression.verified;
+        qint64 outputSize = output.size();
 
-        //Check if the output file is actually bigger than the original
-        if (outputSize > originalSize) {
+        //Check if the output file is actually bigger than the original, turned or recoded images are always written
+        if (!optimized || (result == CCLT_OK && outputSize >= originalSize)) {
             /*
-             * If we choose to overwrite the files, just leave the files in the temporary folder
-             * to be removed afterwards
-             * Instead, if we compressed in a custom folder, copy the original over the compressed one
-             * and set all the output results to point to the original file
+             * Nothing is written. If we choose to overwrite the files the original
+             * is simply left untouched.
+             * Instead, if we compressed in a custom folder, the original becomes the output
+             * and all the output results point to the original file
              */
-            qInfo() << "Output is bigger than input";
+            if (optimized) {
+                qInfo() << "Output is bigger than input";
+            }
+            bool copied = true;
             if (!params.overwrite) {
-                //Copy the original file over the compressed one
-                QFile* outputFile = new QFile(outputPath);
-                //Check if the file already exists (just a security check) and remove it
-                if (outputFile->exists()) {
-                    //WARNING No error check
-                    outputFile->remove();
-                }
-                //Rename the original file with the output path
-                //TODO Better error handling please
-                if (!QFile(item->text(COLUMN_PATH)).copy(outputPath)) {
-                    qCritical() << "Failed while moving " << item->text(COLUMN_PATH);
+                CIOScope io(outputPath);
+                CTraceScope trace("move/rename");
+                copied = cloneFile(inputPath, outputPath, params.hardlink);
+                if (!copied) {
+                    recordFailure(update, tr("Could not copy the original to ") + outputPath);
                 }
             }
             //Set the importat stats to point to the original file
             outputSize = originalSize;
+            if (result >= 0 && compression.verified && copied) {
+                update->status = STATUS_UNCHANGED;
+            }
         } else {
-            //The new file is smaller
-            //If overwrite is on, move the file from the temp folder into the original
-            if (params.overwrite) {
-                //Remove the original
-                QFile(item->text(COLUMN_PATH)).remove();
-                //Move the compressed
-                //TODO Better error handling please
-                if (!QFile(outputPath).rename(item->text(COLUMN_PATH))) {
-                    qCritical() << "Failed while moving " << item->text(COLUMN_PATH);
+            //The new file is smaller, this is its only write
+            CIOScope io(outputPath);
+            CTraceScope trace("move/rename");
+
+            /*
+             * The coefficients were checked in memory by the job, what reached
+             * the disk only has to match those bytes
+             */
+            bool verified = true;
+            std::function<bool(QString)> verify;
+            if (params.verify) {
+                verify = [&] (QString tempPath) {
+                    QFile written(tempPath);
+                    verified = written.open(QIODevice::ReadOnly) && written.readAll() == output;
+                    return verified;
+                };
+            }
+
+            if (writeFile(outputPath, output, params.fsync, verify)) {
+                update->status = STATUS_COMPRESSED;
+
+                //Only written files count towards the metadata saved
+                long dropped = 0;
+                for (int i = 0; i < CCLT_MARKER_CLASSES; i++) {
+                    dropped += compression.markers.dropped[i];
+                }
+                if (dropped > 0) {
+                    qInfo() << "Metadata dropped from" << inputPath << ":" << markerStatsToString(compression.markers);
+                }
+                fileTrace.setArg("metadata_dropped", (qint64) dropped);
+                fileTrace.setArg("progressive", compression.progressive);
+                fileTrace.setArg("arithmetic", compression.arithmetic);
+
+                if (params.progressive == CCLT_SCANS_AUTO) {
+                    update->toolTip = compression.progressive ? tr("Saved as progressive") : tr("Saved as baseline");
+                }
+                if (compression.inputArithmetic != compression.arithmetic) {
+                    update->toolTip = compression.arithmetic ? tr("Recoded to arithmetic coding") :
+                                                               tr("Recoded to Huffman coding for the web");
+                }
+
+                QMutexLocker locker(&statsMutex);
+                for (int i = 0; i < CCLT_MARKER_CLASSES; i++) {
+                    markerStats.kept[i] += compression.markers.kept[i];
+                    markerStats.dropped[i] += compression.markers.dropped[i];
+                }
+                if (compression.progressive) {
+                    progressiveWins++;
+                } else {
+                    baselineWins++;
+                }
+                if (compression.inputArithmetic != compression.arithmetic) {
+                    crecoding* recoding = compression.arithmetic ? &toArithmetic : &toHuffman;
+                    recoding->files++;
+                    recoding->before += originalSize;
+                    recoding->after += outputSize;
                 }
+            } else {
+                if (!verified) {
+                    recordFailure(update, tr("Verification failed, original kept"));
+                } else {
+                    recordFailure(update, tr("Could not write ") + outputPath);
+                }
+                outputSize = originalSize;
             }
         }
-        item->setText(2, toHumanSize(outputSize));
-        item->setText(3, getRatio(originalSize, outputSize));
+        fileTrace.setArg("output_size", outputSize);
+
+        update->originalSize = originalSize;
+        update->outputSize = outputSize;
+        resultQueue.push(update);
+    } else if (prefetcher != NULL) {
+        //Don't leave the read ahead data around
+        QByteArray unused;
+        prefetcher->take(inputPath, &unused);
+    }
+}
 
+void CaesiumPH::recordFailure(citemresult* update, QString reason) {
+    qCritical() << "Failed" << update->path << ":" << reason;
+    update->status = STATUS_FAILED;
+    update->toolTip = reason;
+
+    QMutexLocker locker(&statsMutex);
+    failures.append(update->path + ": " + reason);
+}
+
+void CaesiumPH::applyResults() {
+    citemresult* result = resultQueue.takeAll();
+    if (result == NULL) {
+        return;
+    }
+
+    //One re-sort and one repaint for the whole lot instead of one per cell
+    bool sorting = ui->listTreeWidget->isSortingEnabled();
+    ui->listTreeWidget->setSortingEnabled(false);
+    ui->listTreeWidget->setUpdatesEnabled(false);
+    while (result != NULL) {
         //Global compression counters for the entire compression process
-        originalsSize += originalSize;
-        compressedSize += outputSize;
+        originalsSize += result->originalSize;
+        compressedSize += result->outputSize;
         compressedFiles++;
+
+        //Removed from the list meanwhile
+        CTreeWidgetItem* item = batchItems.value(result->id, NULL);
+        if (item == NULL) {
+            citemresult* next = result->next;
+            delete result;
+            result = next;
+            continue;
+        }
+
+        if (result->status >= 0) {
+            item->setData(COLUMN_NAME, ROLE_STATUS, result->status);
+        }
+        item->setToolTip(COLUMN_NAME, result->toolTip);
+        item->setData(COLUMN_NEW_SIZE, ROLE_SIZE, result->outputSize);
+        item->setText(COLUMN_NEW_SIZE, toHumanSize(result->outputSize));
+        item->setText(COLUMN_SAVED, getRatio(result->originalSize, result->outputSize));
+
+        //Done, a later run treats it like the others
+        if (item->data(COLUMN_NAME, ROLE_PRIORITY).toBool()) {
+            item->setData(COLUMN_NAME, ROLE_PRIORITY, false);
+            QFont font = item->font(COLUMN_NAME);
+            font.setBold(false);
+            item->setFont(COLUMN_NAME, font);
+        }
+
+        citemresult* next = result->next;
+        delete result;
+        result = next;
+    }
+    ui->listTreeWidget->setUpdatesEnabled(true);
+    ui->listTreeWidget->setSortingEnabled(sorting);
+}
+
+void CaesiumPH::forgetBatchItems(const QModelIndex& parent, int first, int last) {
+    if (parent.isValid()) {
+        return;
+    }
+    for (int i = first; i <= last; i++) {
+        QTreeWidgetItem* item = ui->listTreeWidget->topLevelItem(i);
+        if (item != NULL) {
+            batchItems.remove(item->data(COLUMN_NAME, ROLE_BATCH_ID).toULongLong());
+        }
     }
 }
 
-QString CaesiumPH::getOutputPath(QFileInfo* originalInfo) {
+QString CaesiumPH::getOutputPath(const QFileInfo& originalInfo) {
     QString outputPath;
     if (params.overwrite) {
         /*
          * Overwrite
-         * Set the output path to a temporary directory
-         * so we can check if it is actually bigger than the original
-         * and eventually overwrite it
-         *
-        */
-        if (tempDir.isValid()) {
-            //Unique temporary directory
-            outputPath = tempDir.path() + QDir::separator() + originalInfo->fileName();
-        } else {
-            qFatal("Cannot create a temporary folder. Abort.");
-            exit(-1);
-        }
+         * The output goes to a temporary sibling first, see compressRoutine,
+         * and is renamed over the original only if it's smaller
+         */
+        outputPath = originalInfo.filePath();
     } else {
-        QDir dir(originalInfo->path() + QDir::separator() + params.outMethodString + QDir::separator());
+        QDir dir(originalInfo.path() + QDir::separator() + params.outMethodString + QDir::separator());
         switch (params.outMethodIndex) {
         case 0:
             //Add a suffix
-            outputPath = originalInfo->filePath().replace(originalInfo->completeBaseName(),
-                                                          originalInfo->baseName() + params.outMethodString);
+            outputPath = originalInfo.filePath().replace(originalInfo.completeBaseName(),
+                                                         originalInfo.baseName() + params.outMethodString);
             break;
         case 1:
             //Compress in a subfolder
-            outputPath = originalInfo->path() + QDir::separator() + params.outMethodString + QDir::separator() + originalInfo->fileName();
+            outputPath = originalInfo.path() + QDir::separator() + params.outMethodString + QDir::separator() + originalInfo.fileName();
             //Create it
             if (!dir.mkdir(dir.path()) && !dir.exists()) {
                 ui->statusBar->showMessage(tr("ERROR: could not create output folder. Check user permissions."));
@@ -513,7 +744,7 @@ QString CaesiumPH::getOutputPath(QFileInfo* originalInfo) {
             break;
         case 2:
             //Compress in a custom directory
-            outputPath = params.outMethodString + QDir::separator() + originalInfo->fileName();
+            outputPath = params.outMethodString + QDir::separator() + originalInfo.fileName();
             if (!QDir().mkdir(params.outMethodString) && !QDir(params.outMethodString).exists()) {
                 ui->statusBar->showMessage(tr("ERROR: could not create output folder. Check user permissions."));
                 qCritical() << "Cannot create output directory. Abort current operation";
@@ -529,46 +760,162 @@ QString CaesiumPH::getOutputPath(QFileInfo* originalInfo) {
 }
 
 void CaesiumPH::on_actionCompress_triggered() {
+    //A canceled batch is still finishing the files it had started
+    if (estimateWatcher.isRunning() || batchWatcher.isRunning()) {
+        ui->statusBar->showMessage(tr("Wait for the files still in progress to finish"));
+        return;
+    }
+
     //Read preferences again
     readPreferences();
     //Reset counters
     originalsSize = compressedSize = compressedFiles = 0;
+    memset(&markerStats, 0, sizeof(markerStats));
+    progressiveWins = baselineWins = 0;
+    memset(&toArithmetic, 0, sizeof(toArithmetic));
+    memset(&toHuffman, 0, sizeof(toHuffman));
+    failures.clear();
+    //Start recording a new trace if requested
+    if (params.trace) {
+        CTrace::instance()->start();
+    }
+    //Devices are looked up again along with the headers
+    CIOScheduler::instance()->reset(params.ioLimit);
     //Register metatype for emitting changes
     qRegisterMetaType<QVector<int> >("QVector<int>");
 
-    //Setting up a progress dialog
+    //Setting up a progress dialog, it goes away with the batch rather than with the headers
     QProgressDialog progressDialog;
     progressDialog.setWindowTitle(tr("CaesiumPH"));
-    progressDialog.setLabelText(tr("Compressing..."));
+    progressDialog.setLabelText(tr("Reading the headers..."));
+    progressDialog.setAutoReset(false);
+
+    //What the workers need from the list is taken here, they never touch the items
+    int count = ui->listTreeWidget->topLevelItemCount();
+    QList<cbatchfile> files;
+    batchItems.clear();
+    for (int i = 0; i < count; i++) {
+        CTreeWidgetItem* item = (CTreeWidgetItem*) ui->listTreeWidget->topLevelItem(i);
+        cbatchfile file = {++lastBatchId, item->text(COLUMN_PATH), item->data(COLUMN_NAME, ROLE_PRIORITY).toBool()};
+        item->setData(COLUMN_NAME, ROLE_BATCH_ID, file.id);
+        batchItems.insert(file.id, item);
+        files.append(file);
+    }
+
+    //Setting up connections, the ones to the dialog go away with it
+    //Progress dialog
+    connect(&estimateWatcher, SIGNAL(progressValueChanged(int)), &progressDialog, SLOT(setValue(int)));
+    connect(&estimateWatcher, SIGNAL(progressRangeChanged(int, int)), &progressDialog, SLOT(setRange(int,int)));
+    connect(&progressDialog, SIGNAL(canceled()), &estimateWatcher, SLOT(cancel()));
+    connect(&batchWatcher, SIGNAL(progressValueChanged(int)), &progressDialog, SLOT(setValue(int)));
+    connect(&batchWatcher, SIGNAL(progressRangeChanged(int, int)), &progressDialog, SLOT(setRange(int,int)));
+    connect(&batchWatcher, SIGNAL(finished()), &progressDialog, SLOT(reset()));
+    connect(&progressDialog, SIGNAL(canceled()), &batchWatcher, SLOT(cancel()));
+    //Nothing is read ahead for files that won't start anymore
+    connect(&progressDialog, &QProgressDialog::canceled, this, [this] () {
+        if (prefetcher != NULL) {
+            prefetcher->stop();
+        }
+    });
+
+    //The batch starts once every file has its estimate, the workers then go by it. Not if the dialog is gone.
+    connect(&estimateWatcher, &QFutureWatcher<cbatchfile>::finished, &progressDialog, [&] () {
+        if (estimateWatcher.isCanceled()) {
+            progressDialog.reset();
+            return;
+        }
+        progressDialog.setLabelText(tr("Compressing..."));
+        batchWatcher.setFuture(startBatch(estimateWatcher.future().results()));
+    });
+
+    //Cost and gain of every file from the headers, off the GUI thread
+    estimateWatcher.setFuture(QtConcurrent::mapped(files, batchEstimate));
+
+    //Show the dialog
+    progressDialog.exec();
+}
+
+QFuture<void> CaesiumPH::startBatch(QList<cbatchfile> files) {
+    //Longest first: the big files start early instead of leaving one core busy at the end
+    auto costlier = [] (const cbatchfile& a, const cbatchfile& b) {
+        return a.cost > b.cost;
+    };
 
     //Holds the list
-    QList<CTreeWidgetItem*> list;
+    QList<cbatchfile> list;
 
-    //Setup watcher
-    QFutureWatcher<void> watcher;
+    //Files asked first go ahead of everything else, still longest first among them
+    QList<cbatchfile> priority;
 
-    //Gets the list filled
-    for (int i = 0; i < ui->listTreeWidget->topLevelItemCount(); i++) {
-        list.append((CTreeWidgetItem*) ui->listTreeWidget->topLevelItem(i));
+    //Group the files by the disk they are on
+    QHash<quint64, QList<cbatchfile> > deviceItems;
+    QList<quint64> devices;
+    foreach (const cbatchfile& file, files) {
+        if (file.priority) {
+            priority.append(file);
+            continue;
+        }
+        if (!deviceItems.contains(file.device)) {
+            devices.append(file.device);
+        }
+        deviceItems[file.device].append(file);
+    }
+
+    //Gets the list filled, alternating disks so a slow one doesn't hold every worker
+    int ioThreads = 0;
+    foreach (quint64 device, devices) {
+        ioThreads = qMax(ioThreads, CIOScheduler::instance()->limit(device));
+        std::stable_sort(deviceItems[device].begin(), deviceItems[device].end(), costlier);
+    }
+    for (int round = 0; list.length() < files.length() - priority.length(); round++) {
+        foreach (quint64 device, devices) {
+            if (round < deviceItems[device].length()) {
+                list.append(deviceItems[device].at(round));
+            }
+        }
+    }
+
+    //Files that look optimized already go after the others, they most likely gain nothing
+    if (params.alreadyOptimized == OPTIMIZED_LAST) {
+        QList<cbatchfile> first, last;
+        foreach (const cbatchfile& file, list) {
+            (file.gain ? first : last).append(file);
+        }
+        qInfo() << last.length() << "files look already optimized, they go last";
+        list = first + last;
+    }
+    if (!priority.isEmpty()) {
+        std::stable_sort(priority.begin(), priority.end(), costlier);
+        qInfo() << priority.length() << "files asked first";
+        list = priority + list;
     }
 
-    QFuture<void> future = QtConcurrent::map(list, [this] (CTreeWidgetItem*& data) {compressRoutine(data);});
+    //Workers waiting on a busy disk don't use the CPU, keep enough around to saturate it
+    CCompressionPool::instance()->configure(params.threads, params.affinity, params.background);
+    //Threads beyond the local CPUs only wait for the remote workers
+    int remoteThreads = 0;
+    if (params.remotePort > 0) {
+        CJobServer::instance()->reset(CCompressionPool::instance()->threadCount());
+        remoteThreads = CJobServer::instance()->remoteCapacity();
+        qInfo() << "Remote workers take up to" << remoteThreads << "files at once";
+    }
+    CCompressionPool::instance()->setExtraThreads(ioThreads + remoteThreads);
 
-    //Setting up connections
-    //Progress dialog
-    connect(&watcher, SIGNAL(progressValueChanged(int)), &progressDialog, SLOT(setValue(int)));
-    connect(&watcher, SIGNAL(progressRangeChanged(int, int)), &progressDialog, SLOT(setRange(int,int)));
-    connect(&watcher, SIGNAL(finished()), &progressDialog, SLOT(reset()));
-    connect(&progressDialog, SIGNAL(canceled()), &watcher, SLOT(cancel()));
-    //Connect two slots for handling compression start/finish
-    connect(&watcher, SIGNAL(started()), this, SLOT(compressionStarted()));
-    connect(&watcher, SIGNAL(finished()), this, SLOT(compressionFinished()));
+    //Batched reads ahead of the workers, same order they pick the files in
+    if (params.ioUring && CIOUring::isSupported()) {
+        QStringList paths;
+        foreach (const cbatchfile& file, list) {
+            paths.append(file.path);
+        }
+        prefetcher = new CPrefetcher(paths);
+        prefetcher->start();
+    }
 
-    //And start
-    watcher.setFuture(future);
+    //Results reach the list at about 30 Hz, however fast the files go
+    resultTimer.start(RESULT_INTERVAL);
 
-    //Show the dialog
-    progressDialog.exec();
+    //Runs on its own pool, previews keep using the global one
+    return CCompressionPool::instance()->map(list, [this] (const cbatchfile& file) {compressRoutine(file);});
 }
 
 void CaesiumPH::compressionStarted() {
@@ -577,18 +924,76 @@ void CaesiumPH::compressionStarted() {
 }
 
 void CaesiumPH::compressionFinished() {
+    //Every worker is done, what they pushed last is still queued
+    resultTimer.stop();
+    applyResults();
+
     //Get elapsed time of the compression
     qInfo() << "Starting compression at " << QTime::currentTime();
 
+    //Metadata share of the savings
+    long metadataSaved = 0;
+    for (int i = 0; i < CCLT_MARKER_CLASSES; i++) {
+        metadataSaved += markerStats.dropped[i];
+    }
+    if (metadataSaved > 0) {
+        qInfo() << "Metadata dropped in total:" << markerStatsToString(markerStats);
+    }
+
+    if (params.progressive == CCLT_SCANS_AUTO) {
+        qInfo() << "Smaller as progressive:" << progressiveWins << "files, as baseline:" << baselineWins << "files";
+    }
+    if (toArithmetic.files > 0) {
+        qInfo() << "Recoded to arithmetic:" << toArithmetic.files << "files," << toHumanSize(toArithmetic.before)
+                << "to" << toHumanSize(toArithmetic.after) << getRatio(toArithmetic.before, toArithmetic.after);
+    }
+    if (toHuffman.files > 0) {
+        qInfo() << "Recoded to Huffman:" << toHuffman.files << "files," << toHumanSize(toHuffman.before)
+                << "to" << toHumanSize(toHuffman.after) << getRatio(toHuffman.before, toHuffman.after);
+    }
+
+    //Who did what, when sharing the work
+    if (params.remotePort > 0) {
+        foreach (QString line, CJobServer::instance()->stats()) {
+            qInfo() << line;
+        }
+    }
+
+    //Failures are listed once more, all together
+    if (!failures.isEmpty()) {
+        qCritical() << failures.length() << "files failed:";
+        foreach (QString failure, failures) {
+            qCritical() << failure;
+        }
+    }
+
     //Display statistics in the status bar
     ui->statusBar->showMessage(tr("Compression completed! ") +
                                QString::number(compressedFiles) + tr(" files compressed in ") +
                                msToFormattedString(timer.elapsed()) + ", " +
                                tr("from ") + toHumanSize(originalsSize) + tr(" to ") + toHumanSize(compressedSize) +
                                ". " + tr("Saved ") + toHumanSize(originalsSize - compressedSize) +
-                               " (" + getRatio(originalsSize, compressedSize) + ")"
+                               " (" + getRatio(originalsSize, compressedSize) + ")" +
+                               (metadataSaved > 0 ? ", " + toHumanSize(metadataSaved) + tr(" of metadata") : "") +
+                               (failures.isEmpty() ? "" : ". " + QString::number(failures.length()) + tr(" files failed, see the log"))
                                );
     timer.invalidate();
+
+    //Canceled runs leave files read ahead for nothing, the workers are done with it
+    if (prefetcher != NULL) {
+        prefetcher->stop();
+        prefetcher->wait();
+        delete prefetcher;
+        prefetcher = NULL;
+    }
+
+    //Dump the trace next to the log file
+    if (CTrace::instance()->isEnabled()) {
+        CTrace::instance()->stop();
+        CTrace::instance()->writeToFile(QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) +
+                                        "/" +
+                                        QDateTime::currentDateTime().toString("'caesiumph_trace_'yyyyMMdd_hhmmss'.json'"));
+    }
 }
 
 void CaesiumPH::on_sidePanelDockWidget_topLevelChanged(bool topLevel) {
@@ -634,7 +1039,8 @@ void CaesiumPH::on_listTreeWidget_itemSelectionChanged() {
 
         //Load EXIF info
         //TODO Should run in another thread too?
-        ui->exifTextEdit->setText(exifDataToString(getExifFromPath(QStringToChar(currentItem->text(COLUMN_PATH)))));
+        QByteArray exifPath = currentItem->text(COLUMN_PATH).toLocal8Bit();
+        ui->exifTextEdit->setText(exifDataToString(getExifFromPath(exifPath.data())));
 
     } else {
         imageWatcher.cancel();
@@ -782,7 +1188,7 @@ void CaesiumPH::on_actionShow_output_folder_triggered() {
     QDesktopServices::openUrl(QUrl("file:///" +
                                   QFileInfo(
                                        CaesiumPH::getOutputPath(
-                                           new QFileInfo(ui->listTreeWidget->selectedItems().at(0)->text(COLUMN_PATH)))).dir().absolutePath(),
+                                           QFileInfo(ui->listTreeWidget->selectedItems().at(0)->text(COLUMN_PATH)))).dir().absolutePath(),
                                                 QUrl::TolerantMode));
 }
 
@@ -792,6 +1198,11 @@ void CaesiumPH::createMenuActions() {
     listRemoveAction->setStatusTip(tr("Remove the item from the list"));
     connect(listRemoveAction, SIGNAL(triggered()), this, SLOT(on_actionRemove_items_triggered()));
 
+    //List compress first action
+    listCompressFirstAction = new QAction(tr("Compress first"), this);
+    listCompressFirstAction->setStatusTip(tr("Compress the item before the others in the next run"));
+    connect(listCompressFirstAction, SIGNAL(triggered()), this, SLOT(on_actionCompress_first_triggered()));
+
     //List source dir action
     listShowInputFolderAction = new QAction(tr("Show in folder"), this);
     listShowInputFolderAction->setStatusTip(tr("Opens the folder containing the file"));
@@ -813,6 +1224,7 @@ void CaesiumPH::createMenus() {
     //Creates the list context menu
     listMenu = new QMenu(this);
     listMenu->addAction(listRemoveAction);
+    listMenu->addAction(listCompressFirstAction);
     listMenu->addSeparator();
     listMenu->addAction(listShowInputFolderAction);
     listMenu->addAction(listShowOutputFolderAction);
@@ -861,8 +1273,8 @@ void CaesiumPH::saveCPHListToFile(QString path) {
             list.append(ui->listTreeWidget->topLevelItem(i));
         }
         //And generate the file
-        CPHList* clf = new CPHList();
-        clf->writeToFile(list, path);
+        CPHList clf;
+        clf.writeToFile(list, path);
         //Set the global path
         lastCPHListPath = path;
         //Deactivate the "save" action
@@ -882,9 +1294,9 @@ void CaesiumPH::on_actionOpen_list_triggered() {
         //Clear the list first
         ui->listTreeWidget->clear();
         //Create an instance of the reader
-        CPHList* clf = new CPHList();
+        CPHList clf;
         //Read the file
-        ui->listTreeWidget->addTopLevelItems(clf->readFile(filePath));
+        ui->listTreeWidget->addTopLevelItems(clf.readFile(filePath));
         //Set the global path
         lastCPHListPath = filePath;
         //Deactivate the "save" action
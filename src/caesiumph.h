@@ -27,6 +27,10 @@
 #include "cimageinfo.h"
 #include "cphlist.h"
 #include "ctreewidgetitem.h"
+#include "cprefetcher.h"
+#include "markers.h"
+#include "cresultqueue.h"
+#include "ccompressionpool.h"
 
 #include <QMainWindow>
 #include <QTreeWidgetItem>
@@ -35,11 +39,24 @@
 #include <QToolButton>
 #include <QLabel>
 #include <QFileInfo>
+#include <QMutex>
+#include <QTimer>
+#include <QHash>
 
 namespace Ui {
 class CaesiumPH;
 }
 
+//Milliseconds between two updates of the list while compressing
+#define RESULT_INTERVAL 33
+
+//Files whose entropy coding changed, with their sizes before and after
+typedef struct {
+    int files;
+    qint64 before;
+    qint64 after;
+} crecoding;
+
 class CaesiumPH : public QMainWindow
 {
     Q_OBJECT
@@ -54,10 +71,11 @@ public:
     }
 
     //Gets the right output folder
-    QString getOutputPath(QFileInfo *originalInfo);
+    QString getOutputPath(const QFileInfo& originalInfo);
 
     //Compress routine
-    void compressRoutine(CTreeWidgetItem* );
+    void compressRoutine(const cbatchfile& file);
+    void recordFailure(citemresult* update, QString reason);
 
 signals:
     void dropAccepted(QStringList);
@@ -67,6 +85,7 @@ private slots:
     void on_actionAdd_pictures_triggered();
     void on_actionAdd_folder_triggered();
     void on_actionRemove_items_triggered();
+    void on_actionCompress_first_triggered();
     void on_actionCompress_triggered();
     void compressionStarted();
     void compressionFinished();
@@ -95,11 +114,27 @@ private slots:
     void testSignal();
     void on_exifTextEdit_textChanged();
     void startPreviewLoading();
+    void applyResults();
+    void forgetBatchItems(const QModelIndex&, int, int);
 
 
 private:
     Ui::CaesiumPH *ui;
     QFutureWatcher<QImage> imageWatcher; //Image preview loader
+    CPrefetcher* prefetcher = NULL; //Reads inputs ahead of the workers, if enabled
+    cclt_marker_stats markerStats; //Metadata bytes of the written files, per class
+    int progressiveWins, baselineWins; //What the automatic scan mode chose for the written files
+    crecoding toArithmetic, toHuffman; //Written files whose entropy coding changed
+    QStringList failures; //"path: reason" of the files that failed
+    QMutex statsMutex;
+    CResultQueue resultQueue; //Item updates from the workers
+    QTimer resultTimer; //Drains resultQueue on the GUI thread
+    //Items of the running batch by id, removed ones leave so late results skip them
+    QHash<quint64, CTreeWidgetItem*> batchItems;
+    quint64 lastBatchId = 0; //Never reused, an id left on an item can't match a later one
+    //Outlive the progress dialog, a canceled batch still finishes the files it started
+    QFutureWatcher<cbatchfile> estimateWatcher;
+    QFutureWatcher<void> batchWatcher;
     //Status bar widgets
     QToolButton* updateButton = new QToolButton();
     QFrame* statusStatusBarLine = new QFrame();
@@ -112,6 +147,7 @@ private:
     QMenu* listMenu;
     //List menu actions
     QAction* listRemoveAction;
+    QAction* listCompressFirstAction;
     QAction* listShowInputFolderAction;
     QAction* listShowOutputFolderAction;
     QAction* listClearAction;
@@ -121,6 +157,9 @@ private:
     void initializeUI();
     void readPreferences();
 
+    //Orders the estimated files, longest first, and starts them on the compression pool
+    QFuture<void> startBatch(QList<cbatchfile> files);
+
     //Update
     void checkUpdates();
     //Menus
@@ -0,0 +1,646 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#include "carchive.h"
+#include "preferencedialog.h"
+#include "utils.h"
+
+#include <QtConcurrent>
+#include <QFile>
+#include <QFileInfo>
+#include <QMap>
+#include <QtEndian>
+#include <QThread>
+#include <QDebug>
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+//Tar layout, POSIX ustar with the GNU and pax extensions recognized
+#define TAR_BLOCK 512
+#define TAR_RECORD 10240
+#define TAR_SIZE_OFFSET 124
+#define TAR_CHECKSUM_OFFSET 148
+#define TAR_TYPE_OFFSET 156
+#define TAR_MAGIC_OFFSET 257
+#define TAR_PREFIX_OFFSET 345
+//Long names and pax records, anything bigger is not a real extension header
+#define TAR_META_LIMIT (1024 * 1024)
+
+//Zip signatures and fixed record sizes
+#define ZIP_LOCAL_SIGNATURE 0x04034b50
+#define ZIP_CENTRAL_SIGNATURE 0x02014b50
+#define ZIP_END_SIGNATURE 0x06054b50
+#define ZIP64_LOCATOR_SIGNATURE 0x07064b50
+#define ZIP_DESCRIPTOR_SIGNATURE 0x08074b50
+#define ZIP_LOCAL_SIZE 30
+#define ZIP_CENTRAL_SIZE 46
+#define ZIP_END_SIZE 22
+
+static bool isJPEGName(QString name) {
+    return name.endsWith(".jpg", Qt::CaseInsensitive) || name.endsWith(".jpeg", Qt::CaseInsensitive);
+}
+
+static bool readExactly(QIODevice* in, char* data, qint64 size) {
+    while (size > 0) {
+        qint64 read = in->read(data, size);
+        if (read <= 0 && !in->waitForReadyRead(-1)) {
+            return false;
+        }
+        if (read > 0) {
+            data += read;
+            size -= read;
+        }
+    }
+    return true;
+}
+
+static bool writeAll(QIODevice* out, const char* data, qint64 size) {
+    return out->write(data, size) == size;
+}
+
+//Copies size bytes through, for members that are not optimized
+static bool copyThrough(QIODevice* in, QIODevice* out, qint64 size) {
+    QByteArray chunk(ARCHIVE_COPY_CHUNK, Qt::Uninitialized);
+    while (size > 0) {
+        qint64 length = qMin<qint64>(size, chunk.size());
+        if (!readExactly(in, chunk.data(), length) || !writeAll(out, chunk.constData(), length)) {
+            return false;
+        }
+        size -= length;
+    }
+    return true;
+}
+
+//Zip wants the standard CRC-32, zlib is not a dependency
+static quint32 crc32(const QByteArray& data) {
+    static quint32 table[256];
+    static bool ready = false;
+    if (!ready) {
+        for (quint32 i = 0; i < 256; i++) {
+            quint32 c = i;
+            for (int k = 0; k < 8; k++) {
+                c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        ready = true;
+    }
+    quint32 crc = 0xFFFFFFFF;
+    const uchar* bytes = (const uchar*) data.constData();
+    for (int i = 0; i < data.size(); i++) {
+        crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+CArchivePipeline::CArchivePipeline(int threads, qint64 memory) :
+    optimized(0),
+    originalBytes(0),
+    optimizedBytes(0),
+    memory(memory),
+    pending(0) {
+    pool.setMaxThreadCount(threads);
+}
+
+CArchivePipeline::~CArchivePipeline() {
+    pool.waitForDone();
+}
+
+bool CArchivePipeline::add(QByteArray input, bool optimize, carchivewriter write) {
+    //The oldest members make room, in order
+    while (!queue.isEmpty() && pending + input.size() > memory) {
+        if (!writeFront()) {
+            return false;
+        }
+    }
+
+    carchiveentry entry;
+    entry.input = input;
+    entry.optimize = optimize;
+    entry.write = write;
+    if (optimize) {
+        entry.future = QtConcurrent::run(&pool, runJob, makeJob(input));
+    }
+    queue.enqueue(entry);
+    pending += input.size();
+
+    //Whatever is done already goes out
+    while (!queue.isEmpty() && (!queue.head().optimize || queue.head().future.isFinished())) {
+        if (!writeFront()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CArchivePipeline::drain() {
+    while (!queue.isEmpty()) {
+        if (!writeFront()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CArchivePipeline::writeFront() {
+    carchiveentry entry = queue.dequeue();
+    pending -= entry.input.size();
+    if (!entry.optimize) {
+        return entry.write(entry.input);
+    }
+
+    cjobresult result = entry.future.result();
+    //Same rule as files on disk: smaller, or turned upright or recoded, and verified
+    bool smaller = (CCLT_MUST_REPLACE(result.result) ||
+                    (result.result == CCLT_OK && result.output.size() < entry.input.size())) && result.verified;
+    if (result.result < 0) {
+        qWarning() << "JPEG member left as it is:" << result.message;
+    }
+    originalBytes += entry.input.size();
+    if (smaller) {
+        optimized++;
+        optimizedBytes += result.output.size();
+        return entry.write(result.output);
+    }
+    optimizedBytes += entry.input.size();
+    return entry.write(entry.input);
+}
+
+static qint64 tarNumber(const char* field, int length) {
+    //GNU base-256 for values that don't fit the octal digits
+    if ((uchar) field[0] & 0x80) {
+        qint64 value = (uchar) field[0] & 0x7F;
+        for (int i = 1; i < length; i++) {
+            value = (value << 8) | (uchar) field[i];
+        }
+        return value;
+    }
+    qint64 value = 0;
+    int i = 0;
+    while (i < length && (field[i] == ' ' || field[i] == '\0')) {
+        i++;
+    }
+    for (; i < length && field[i] >= '0' && field[i] <= '7'; i++) {
+        value = value * 8 + (field[i] - '0');
+    }
+    return value;
+}
+
+static unsigned int tarChecksum(const char* header) {
+    unsigned int sum = 0;
+    for (int i = 0; i < TAR_BLOCK; i++) {
+        bool field = i >= TAR_CHECKSUM_OFFSET && i < TAR_CHECKSUM_OFFSET + 8;
+        sum += field ? ' ' : (uchar) header[i];
+    }
+    return sum;
+}
+
+static qint64 tarPadding(qint64 size) {
+    return (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+}
+
+static bool optimizeTar(QIODevice* in, QIODevice* out, CArchivePipeline* pipeline, qint64 memory) {
+    char header[TAR_BLOCK];
+    QByteArray meta; //GNU long names and pax headers, they go out with their member
+    QString longName;
+    bool paxSize = false;
+    qint64 written = 0;
+
+    forever {
+        if (!readExactly(in, header, TAR_BLOCK)) {
+            qCritical() << "Unexpected end of the tar archive";
+            return false;
+        }
+        //End of archive, two zero blocks; the second may be missing in the wild
+        bool zero = true;
+        for (int i = 0; i < TAR_BLOCK && zero; i++) {
+            zero = header[i] == '\0';
+        }
+        if (zero) {
+            break;
+        }
+        if (tarNumber(header + TAR_CHECKSUM_OFFSET, 8) != tarChecksum(header)) {
+            qCritical() << "Damaged tar header";
+            return false;
+        }
+
+        qint64 size = tarNumber(header + TAR_SIZE_OFFSET, 12);
+        qint64 padding = tarPadding(size);
+        char type = header[TAR_TYPE_OFFSET];
+
+        //Extension headers describe the next member
+        if (type == 'L' || type == 'x' || type == 'g' || type == 'K') {
+            if (size > TAR_META_LIMIT) {
+                qCritical() << "Oversized tar extension header";
+                return false;
+            }
+            QByteArray data(size + padding, Qt::Uninitialized);
+            if (!readExactly(in, data.data(), data.size())) {
+                return false;
+            }
+            if (type == 'L') {
+                longName = QString::fromUtf8(data.left(size).constData());
+            } else if (type == 'x') {
+                //Records are "length key=value\n"
+                foreach (QByteArray record, data.left(size).split('\n')) {
+                    int space = record.indexOf(' ');
+                    QByteArray pair = record.mid(space + 1);
+                    if (pair.startsWith("path=")) {
+                        longName = QString::fromUtf8(pair.mid(5));
+                    } else if (pair.startsWith("size=")) {
+                        paxSize = true;
+                    }
+                }
+            }
+            meta.append(header, TAR_BLOCK);
+            meta.append(data);
+            continue;
+        }
+
+        QString name = longName;
+        if (name.isEmpty()) {
+            name = QString::fromUtf8(QByteArray(header, 100).constData());
+            QByteArray prefix(header + TAR_PREFIX_OFFSET, 155);
+            if (memcmp(header + TAR_MAGIC_OFFSET, "ustar", 5) == 0 && prefix.at(0) != '\0') {
+                name = QString::fromUtf8(prefix.constData()) + "/" + name;
+            }
+        }
+
+        //A pax size would have to be rewritten too, those members stay as they are
+        bool regular = type == '0' || type == '\0' || type == '7';
+        if (regular && !paxSize && isJPEGName(name) && size > 0 && size <= memory) {
+            QByteArray data(size, Qt::Uninitialized);
+            char skipped[TAR_BLOCK];
+            if (!readExactly(in, data.data(), size) || !readExactly(in, skipped, padding)) {
+                qCritical() << "Unexpected end of the tar archive";
+                return false;
+            }
+            QByteArray memberHeader(header, TAR_BLOCK);
+            QByteArray memberMeta = meta;
+            bool added = pipeline->add(data, true, [out, memberHeader, memberMeta, &written] (const QByteArray& bytes) {
+                //Same header, new size and checksum
+                QByteArray header = memberHeader;
+                char number[16];
+                snprintf(number, sizeof(number), "%011llo", (unsigned long long) bytes.size());
+                memcpy(header.data() + TAR_SIZE_OFFSET, number, 12);
+                snprintf(number, sizeof(number), "%06o", tarChecksum(header.constData()));
+                memcpy(header.data() + TAR_CHECKSUM_OFFSET, number, 7);
+                header[TAR_CHECKSUM_OFFSET + 7] = ' ';
+
+                QByteArray padding(tarPadding(bytes.size()), '\0');
+                written += memberMeta.size() + header.size() + bytes.size() + padding.size();
+                return writeAll(out, memberMeta.constData(), memberMeta.size()) &&
+                        writeAll(out, header.constData(), header.size()) &&
+                        writeAll(out, bytes.constData(), bytes.size()) &&
+                        writeAll(out, padding.constData(), padding.size());
+            });
+            if (!added) {
+                return false;
+            }
+        } else if (size + padding <= memory) {
+            //Other members wait in the queue too, the JPEGs before them keep going
+            QByteArray data(size + padding, Qt::Uninitialized);
+            if (!readExactly(in, data.data(), data.size())) {
+                qCritical() << "Unexpected end of the tar archive";
+                return false;
+            }
+            QByteArray memberHeader(header, TAR_BLOCK);
+            QByteArray memberMeta = meta;
+            bool added = pipeline->add(data, false, [out, memberHeader, memberMeta, &written] (const QByteArray& bytes) {
+                written += memberMeta.size() + memberHeader.size() + bytes.size();
+                return writeAll(out, memberMeta.constData(), memberMeta.size()) &&
+                        writeAll(out, memberHeader.constData(), memberHeader.size()) &&
+                        writeAll(out, bytes.constData(), bytes.size());
+            });
+            if (!added) {
+                return false;
+            }
+        } else {
+            //Too big to hold, it streams through after what's queued before it
+            if (!pipeline->drain() ||
+                    !writeAll(out, meta.constData(), meta.size()) ||
+                    !writeAll(out, header, TAR_BLOCK) ||
+                    !copyThrough(in, out, size + padding)) {
+                qCritical() << "Failed to copy" << name;
+                return false;
+            }
+            written += meta.size() + TAR_BLOCK + size + padding;
+        }
+        meta.clear();
+        longName.clear();
+        paxSize = false;
+    }
+
+    if (!pipeline->drain()) {
+        return false;
+    }
+    //End of archive, padded to whole records as tar does
+    written += 2 * TAR_BLOCK;
+    QByteArray end(2 * TAR_BLOCK + (TAR_RECORD - written % TAR_RECORD) % TAR_RECORD, '\0');
+    return writeAll(out, end.constData(), end.size());
+}
+
+static quint16 get16(const QByteArray& data, int offset) {
+    return qFromLittleEndian<quint16>((const uchar*) data.constData() + offset);
+}
+
+static quint32 get32(const QByteArray& data, int offset) {
+    return qFromLittleEndian<quint32>((const uchar*) data.constData() + offset);
+}
+
+static void put16(QByteArray* data, int offset, quint16 value) {
+    qToLittleEndian<quint16>(value, (uchar*) data->data() + offset);
+}
+
+static void put32(QByteArray* data, int offset, quint32 value) {
+    qToLittleEndian<quint32>(value, (uchar*) data->data() + offset);
+}
+
+static bool readAt(QFile* in, qint64 offset, QByteArray* data, qint64 size) {
+    data->resize(size);
+    return in->seek(offset) && readExactly(in, data->data(), size);
+}
+
+static bool optimizeZip(QFile* in, QIODevice* out, CArchivePipeline* pipeline, qint64 memory) {
+    //The end record is in the last 64 KiB, after the comment
+    qint64 fileSize = in->size();
+    qint64 tailSize = qMin<qint64>(fileSize, 0xFFFF + ZIP_END_SIZE);
+    QByteArray tail;
+    if (!readAt(in, fileSize - tailSize, &tail, tailSize)) {
+        return false;
+    }
+    int endOffset = -1;
+    for (int i = tail.size() - ZIP_END_SIZE; i >= 0; i--) {
+        if (get32(tail, i) == ZIP_END_SIGNATURE) {
+            endOffset = i;
+            break;
+        }
+    }
+    if (endOffset < 0) {
+        qCritical() << "Not a zip archive";
+        return false;
+    }
+    QByteArray end = tail.mid(endOffset);
+    quint16 count = get16(end, 10);
+    quint32 directorySize = get32(end, 12);
+    quint32 directoryOffset = get32(end, 16);
+    if ((endOffset >= 20 && get32(tail, endOffset - 20) == ZIP64_LOCATOR_SIGNATURE) ||
+            count == 0xFFFF || directoryOffset == 0xFFFFFFFF) {
+        qCritical() << "Zip64 archives are not supported";
+        return false;
+    }
+    if (get16(end, 4) != 0 || get16(end, 6) != 0) {
+        qCritical() << "Multi-volume zip archives are not supported";
+        return false;
+    }
+
+    QByteArray directory;
+    if (!readAt(in, directoryOffset, &directory, directorySize)) {
+        qCritical() << "Damaged zip central directory";
+        return false;
+    }
+
+    //Central records, in local header order so the output keeps the member order
+    QList<QByteArray> records;
+    QMap<quint32, int> byOffset;
+    int position = 0;
+    for (int i = 0; i < count; i++) {
+        if (position + ZIP_CENTRAL_SIZE > directory.size() || get32(directory, position) != ZIP_CENTRAL_SIGNATURE) {
+            qCritical() << "Damaged zip central directory";
+            return false;
+        }
+        int length = ZIP_CENTRAL_SIZE + get16(directory, position + 28) + get16(directory, position + 30) +
+                get16(directory, position + 32);
+        QByteArray record = directory.mid(position, length);
+        byOffset.insert(get32(record, 42), records.length());
+        records.append(record);
+        position += length;
+    }
+
+    //Anything before the first member, like a self-extractor stub, comes along
+    qint64 written = 0;
+    quint32 first = byOffset.isEmpty() ? directoryOffset : byOffset.firstKey();
+    if (!in->seek(0) || !copyThrough(in, out, first)) {
+        return false;
+    }
+    written = first;
+
+    foreach (int index, byOffset) {
+        QByteArray& record = records[index];
+        quint16 flags = get16(record, 8);
+        quint16 method = get16(record, 10);
+        quint32 compressedSize = get32(record, 20);
+        quint32 size = get32(record, 24);
+        quint32 offset = get32(record, 42);
+        QString name = QString::fromUtf8(record.mid(ZIP_CENTRAL_SIZE, get16(record, 28)));
+
+        QByteArray local;
+        if (!readAt(in, offset, &local, ZIP_LOCAL_SIZE) || get32(local, 0) != ZIP_LOCAL_SIGNATURE) {
+            qCritical() << "Damaged zip member" << name;
+            return false;
+        }
+        qint64 dataOffset = offset + ZIP_LOCAL_SIZE + get16(local, 26) + get16(local, 28);
+
+        //Stored and not encrypted; deflated JPEGs pass through, there's no inflater here
+        if (method == 0 && !(flags & 1) && compressedSize == size && isJPEGName(name) &&
+                size > 0 && size <= memory) {
+            QByteArray localHeader, data;
+            if (!readAt(in, offset, &localHeader, dataOffset - offset) || !readAt(in, dataOffset, &data, size)) {
+                return false;
+            }
+            bool added = pipeline->add(data, true, [out, localHeader, &record, &written] (const QByteArray& bytes) {
+                //Sizes and CRC go in the local header, no data descriptor needed anymore
+                QByteArray header = localHeader;
+                quint32 crc = crc32(bytes);
+                put16(&header, 6, get16(header, 6) & ~0x0008);
+                put32(&header, 14, crc);
+                put32(&header, 18, bytes.size());
+                put32(&header, 22, bytes.size());
+
+                put16(&record, 8, get16(record, 8) & ~0x0008);
+                put32(&record, 16, crc);
+                put32(&record, 20, bytes.size());
+                put32(&record, 24, bytes.size());
+                put32(&record, 42, written);
+                written += header.size() + bytes.size();
+                return writeAll(out, header.constData(), header.size()) &&
+                        writeAll(out, bytes.constData(), bytes.size());
+            });
+            if (!added) {
+                return false;
+            }
+            continue;
+        }
+
+        //The data descriptor, if any, may or may not have its signature
+        qint64 length = dataOffset - offset + compressedSize;
+        if (flags & 0x0008) {
+            QByteArray signature;
+            if (!readAt(in, offset + length, &signature, 4)) {
+                return false;
+            }
+            length += get32(signature, 0) == ZIP_DESCRIPTOR_SIGNATURE ? 16 : 12;
+        }
+        //Other members wait in the queue too, the JPEGs before them keep going
+        if (length <= memory) {
+            QByteArray data;
+            if (!readAt(in, offset, &data, length)) {
+                qCritical() << "Damaged zip member" << name;
+                return false;
+            }
+            bool added = pipeline->add(data, false, [out, &record, &written] (const QByteArray& bytes) {
+                put32(&record, 42, written);
+                written += bytes.size();
+                return writeAll(out, bytes.constData(), bytes.size());
+            });
+            if (!added) {
+                return false;
+            }
+            continue;
+        }
+        //Too big to hold, it streams through after what's queued before it
+        if (!pipeline->drain() || !in->seek(offset) || !copyThrough(in, out, length)) {
+            qCritical() << "Failed to copy" << name;
+            return false;
+        }
+        put32(&record, 42, written);
+        written += length;
+    }
+    if (!pipeline->drain()) {
+        return false;
+    }
+
+    if (written > 0xFFFFFFFFLL) {
+        qCritical() << "The output would need Zip64, which is not supported";
+        return false;
+    }
+    //Central directory in its original order, then the end record with the comment
+    quint32 newDirectoryOffset = written;
+    quint32 newDirectorySize = 0;
+    foreach (QByteArray record, records) {
+        if (!writeAll(out, record.constData(), record.size())) {
+            return false;
+        }
+        newDirectorySize += record.size();
+    }
+    put32(&end, 12, newDirectorySize);
+    put32(&end, 16, newDirectoryOffset);
+    end.truncate(ZIP_END_SIZE + get16(end, 20));
+    return writeAll(out, end.constData(), end.size());
+}
+
+int runArchive(QStringList arguments) {
+    int index = arguments.indexOf(ARCHIVE_ARGUMENT);
+    QString inputPath = arguments.value(index + 1);
+    QString outputPath = arguments.value(index + 2);
+    if (inputPath.isEmpty() || outputPath.isEmpty()) {
+        qCritical() << "Usage: caesiumph" << ARCHIVE_ARGUMENT << "INPUT OUTPUT [--threads N] [--memory MB]";
+        return 1;
+    }
+
+    int threads = QThread::idealThreadCount();
+    qint64 memory = ARCHIVE_MEMORY;
+    for (int i = index + 3; i < arguments.length() - 1; i++) {
+        if (arguments.at(i) == "--threads") {
+            threads = qMax(1, arguments.at(i + 1).toInt());
+        } else if (arguments.at(i) == "--memory") {
+            memory = qMax(1, arguments.at(i + 1).toInt()) * 1024LL * 1024LL;
+        }
+    }
+    //A member held in memory has to fit a QByteArray
+    memory = qMin<qint64>(memory, 1024LL * 1024LL * 1024LL);
+
+    readParams();
+
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    QFile in;
+    bool opened;
+    if (inputPath == "-") {
+        opened = in.open(stdin, QIODevice::ReadOnly);
+    } else {
+        in.setFileName(inputPath);
+        opened = in.open(QIODevice::ReadOnly);
+    }
+    if (!opened) {
+        qCritical() << "Cannot read" << inputPath;
+        return 1;
+    }
+
+    //Written next to the destination and renamed over it once complete
+    QFile out;
+    QString tempPath;
+    if (outputPath == "-") {
+        opened = out.open(stdout, QIODevice::WriteOnly);
+    } else {
+        tempPath = getTemporaryPath(QFileInfo(outputPath).absoluteFilePath());
+        out.setFileName(tempPath);
+        opened = out.open(QIODevice::WriteOnly);
+    }
+    if (!opened) {
+        qCritical() << "Cannot write" << outputPath;
+        return 1;
+    }
+
+    CArchivePipeline pipeline(threads, memory);
+    bool done;
+    QByteArray magic = in.peek(4);
+    if (magic.startsWith("PK")) {
+        if (in.isSequential()) {
+            qCritical() << "Zip archives need a seekable input, not a pipe";
+            done = false;
+        } else {
+            done = optimizeZip(&in, &out, &pipeline, memory);
+        }
+    } else {
+        done = optimizeTar(&in, &out, &pipeline, memory);
+    }
+    done = done && out.flush();
+    out.close();
+
+    if (!tempPath.isEmpty()) {
+        if (done && !replaceFile(tempPath, outputPath)) {
+            qCritical() << "Cannot write" << outputPath;
+            done = false;
+        }
+        if (!done) {
+            QFile::remove(tempPath);
+        }
+    }
+    if (!done) {
+        return 1;
+    }
+
+    qInfo() << pipeline.optimized << "JPEG members optimized, from" << toHumanSize(pipeline.originalBytes)
+            << "to" << toHumanSize(pipeline.optimizedBytes);
+    return 0;
+}
@@ -0,0 +1,94 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef CARCHIVE_H
+#define CARCHIVE_H
+
+#include <QQueue>
+#include <QFuture>
+#include <QThreadPool>
+#include <QIODevice>
+#include <QStringList>
+#include <functional>
+
+#include "cworker.h"
+
+//Command line switch of the archive mode, followed by input and output
+#define ARCHIVE_ARGUMENT "--archive"
+
+//Input bytes held by members waiting to be written, by default
+#define ARCHIVE_MEMORY (256 * 1024 * 1024)
+//Copy unit of members passed through
+#define ARCHIVE_COPY_CHUNK (1024 * 1024)
+
+//Writes a member once its final bytes are known, false on output errors
+typedef std::function<bool(const QByteArray&)> carchivewriter;
+
+typedef struct {
+    QByteArray input;
+    bool optimize;
+    QFuture<cjobresult> future;
+    carchivewriter write;
+} carchiveentry;
+
+/*
+ * Members go in one by one in archive order. JPEGs are optimized on the
+ * pool meanwhile, and members come out in the same order as soon as
+ * they are ready, the others as soon as everything before them is out. Input held in the queue never passes the memory
+ * limit; a new member first waits for the oldest ones to go out.
+ */
+class CArchivePipeline {
+public:
+    CArchivePipeline(int threads, qint64 memory);
+    ~CArchivePipeline();
+
+    bool add(QByteArray input, bool optimize, carchivewriter write);
+    //Writes everything queued, needed before a member too big for the queue is streamed through
+    bool drain();
+
+    int optimized;
+    qint64 originalBytes;
+    qint64 optimizedBytes;
+
+private:
+    QThreadPool pool;
+    qint64 memory;
+    qint64 pending;
+    QQueue<carchiveentry> queue;
+
+    bool writeFront();
+};
+
+/*
+ * Optimizes the JPEG members of a tar or zip archive in one pass:
+ *
+ *   caesiumph --archive INPUT OUTPUT [--threads N] [--memory MB]
+ *
+ * Other members, order and metadata are kept. Tar archives stream and
+ * either side can be "-"; zip archives need a seekable input for the
+ * central directory, the output still streams. Only stored zip members
+ * are optimized, deflated ones pass through.
+ */
+int runArchive(QStringList arguments);
+
+#endif // CARCHIVE_H
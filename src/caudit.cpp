@@ -0,0 +1,142 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#include "caudit.h"
+#include "inspect.h"
+#include "lossless.h"
+#include "preferencedialog.h"
+#include "utils.h"
+
+#include <QtConcurrent>
+#include <QFile>
+#include <QFileInfo>
+#include <QDirIterator>
+#include <QTextStream>
+#include <QDebug>
+
+typedef struct {
+    QString path;
+    qint64 size;
+    int valid;
+    cclt_inspection inspection;
+    int gain;
+} caudititem;
+
+static caudititem auditFile(const QString& path) {
+    caudititem item;
+    item.path = path;
+    item.size = 0;
+    item.valid = 0;
+    item.gain = 0;
+
+    //Mapped, only the marker bytes and the scan boundaries are looked at
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return item;
+    }
+    item.size = file.size();
+    uchar* data = item.size > 0 ? file.map(0, item.size) : NULL;
+    QByteArray buffer;
+    if (data == NULL) {
+        buffer = file.readAll();
+        data = (uchar*) buffer.data();
+    }
+    item.valid = cclt_inspect_buffer(data, item.size, params.markers, &item.inspection) == CCLT_OK;
+    item.gain = item.valid && cclt_gain_expected(&item.inspection, params.progressive, params.orientation,
+                                                 params.effort, params.arithmetic);
+    return item;
+}
+
+static QString csvField(QString value) {
+    if (value.contains(',') || value.contains('"') || value.contains('\n')) {
+        return "\"" + value.replace("\"", "\"\"") + "\"";
+    }
+    return value;
+}
+
+int runAudit(QStringList arguments) {
+    QStringList roots = arguments.mid(arguments.indexOf(AUDIT_ARGUMENT) + 1);
+    if (roots.isEmpty()) {
+        qCritical() << "Usage: caesiumph" << AUDIT_ARGUMENT << "PATH...";
+        return 1;
+    }
+
+    //The options decide what counts as a gain
+    readParams();
+
+    QStringList paths;
+    foreach (QString root, roots) {
+        if (QFileInfo(root).isDir()) {
+            QDirIterator it(root, inputFilterList, QDir::Files, QDirIterator::Subdirectories);
+            while (it.hasNext()) {
+                paths.append(it.next());
+            }
+        } else {
+            paths.append(root);
+        }
+    }
+
+    QList<caudititem> items = QtConcurrent::blockingMapped(paths, auditFile);
+
+    QFile out;
+    out.open(stdout, QIODevice::WriteOnly);
+    QTextStream report(&out);
+    report.setCodec("UTF-8");
+    report << "path,size,coding,scans,simple_script,huffman_tables,standard_tables,restart_interval,droppable_bytes,thumbnail_bytes,verdict\n";
+
+    int worth = 0, optimized = 0, invalid = 0;
+    qint64 worthBytes = 0, optimizedBytes = 0;
+    foreach (caudititem item, items) {
+        const cclt_inspection& i = item.inspection;
+        QString verdict;
+        if (!item.valid) {
+            verdict = "not a jpeg";
+            invalid++;
+        } else if (item.gain) {
+            //A change of entropy coding rewrites the file whatever the size
+            bool arithmetic = params.arithmetic && cclt_arithmetic_supported();
+            verdict = i.arithmetic == arithmetic ? "optimize" :
+                      arithmetic ? "recode to arithmetic" : "recode to huffman";
+            worth++;
+            worthBytes += item.size;
+        } else {
+            verdict = "already optimized";
+            optimized++;
+            optimizedBytes += item.size;
+        }
+        report << csvField(item.path) << "," << item.size << ",";
+        if (item.valid) {
+            report << cclt_coding_name(&i) << "," << i.scans << "," << i.simple_script << "," <<
+                      i.huffman_tables << "," << i.standard_tables << "," << i.restart_interval << "," <<
+                      (qint64) i.droppable << "," << (qint64) i.thumbnail << ",";
+        } else {
+            report << ",,,,,,,,";
+        }
+        report << verdict << "\n";
+    }
+    report.flush();
+
+    qInfo() << paths.length() << "files:" << worth << "worth optimizing (" + toHumanSize(worthBytes) + ")," <<
+               optimized << "already optimized (" + toHumanSize(optimizedBytes) + ")," << invalid << "not JPEG";
+    return 0;
+}
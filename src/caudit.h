@@ -0,0 +1,42 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef CAUDIT_H
+#define CAUDIT_H
+
+#include <QStringList>
+
+//Command line switch of the audit report, followed by files and folders
+#define AUDIT_ARGUMENT "--audit"
+
+/*
+ * Reports, without decoding anything, which JPEGs under the given paths
+ * are worth optimizing with the saved preferences:
+ *
+ *   caesiumph --audit PATH... > report.csv
+ *
+ * One CSV line per file on stdout, totals on stderr.
+ */
+int runAudit(QStringList arguments);
+
+#endif // CAUDIT_H
@@ -0,0 +1,239 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#include "ccompressionpool.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
+
+#ifdef __linux__
+#include <sys/syscall.h>
+//From linux/ioprio.h, which not every system installs
+#ifndef IOPRIO_CLASS_SHIFT
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+#endif
+#endif
+
+#ifdef __APPLE__
+#include <pthread/qos.h>
+#endif
+
+#include <QThread>
+#include <QRunnable>
+#include <QFutureInterface>
+#include <QSharedPointer>
+#include <QAtomicInt>
+#include <QStringList>
+#include <QMutexLocker>
+#include <QDebug>
+
+//State shared by the workers of a single map() call
+typedef struct {
+    QFutureInterface<void> future;
+    QList<cbatchfile> files;
+    std::function<void(const cbatchfile&)> routine;
+    QAtomicInt next;
+    QAtomicInt done;
+    QAtomicInt running;
+} cpool_job;
+
+class CCompressionRunnable : public QRunnable {
+public:
+    CCompressionRunnable(QSharedPointer<cpool_job> job) :
+        job(job) {
+
+    }
+
+    void run() {
+        CCompressionPool::instance()->setupCurrentThread();
+
+        //Files are handed out in list order, one at a time
+        int i;
+        while (!job->future.isCanceled() && (i = job->next.fetchAndAddRelaxed(1)) < job->files.length()) {
+            job->routine(job->files.at(i));
+            job->future.setProgressValue(job->done.fetchAndAddRelaxed(1) + 1);
+        }
+
+        //Last worker out closes the future
+        if (job->running.fetchAndAddOrdered(-1) == 1) {
+            job->future.reportFinished();
+        }
+    }
+
+private:
+    QSharedPointer<cpool_job> job;
+};
+
+CCompressionPool::CCompressionPool() :
+    pool(new QThreadPool()),
+    threads(QThread::idealThreadCount()),
+    extraThreads(0),
+    background(false) {
+    pool->setMaxThreadCount(threads);
+}
+
+CCompressionPool::~CCompressionPool() {
+    pool->waitForDone();
+    delete pool;
+}
+
+CCompressionPool* CCompressionPool::instance() {
+    static CCompressionPool compressionPool;
+    return &compressionPool;
+}
+
+void CCompressionPool::configure(int threads, QString affinity, bool background) {
+    QList<int> cpus = parseCpuList(affinity);
+    QThreadPool* old = NULL;
+    {
+        QMutexLocker locker(&mutex);
+        //Threads keep their affinity and priority, so changes need fresh ones
+        if (cpus != this->cpus || background != this->background) {
+            old = pool;
+            pool = new QThreadPool();
+        }
+        if (threads > 0) {
+            this->threads = threads;
+        } else {
+            this->threads = cpus.isEmpty() ? QThread::idealThreadCount() : cpus.length();
+        }
+        this->cpus = cpus;
+        this->background = background;
+        pool->setMaxThreadCount(this->threads + extraThreads);
+    }
+    if (old != NULL) {
+        old->waitForDone();
+        delete old;
+    }
+}
+
+int CCompressionPool::threadCount() const {
+    return threads;
+}
+
+void CCompressionPool::setExtraThreads(int extra) {
+    QMutexLocker locker(&mutex);
+    extraThreads = extra;
+    pool->setMaxThreadCount(threads + extraThreads);
+}
+
+QFuture<void> CCompressionPool::map(QList<cbatchfile> files, std::function<void(const cbatchfile&)> routine) {
+    QSharedPointer<cpool_job> job(new cpool_job);
+    job->files = files;
+    job->routine = routine;
+    job->future.reportStarted();
+    job->future.setProgressRange(0, files.length());
+    QFuture<void> future = job->future.future();
+
+    QMutexLocker locker(&mutex);
+    int workers = qMax(1, qMin(pool->maxThreadCount(), files.length()));
+    job->running.store(workers);
+    for (int i = 0; i < workers; i++) {
+        pool->start(new CCompressionRunnable(job));
+    }
+    return future;
+}
+
+void CCompressionPool::setupCurrentThread() {
+    QList<int> cpus;
+    bool background;
+    {
+        QMutexLocker locker(&mutex);
+        cpus = this->cpus;
+        background = this->background;
+    }
+
+#if defined(__linux__)
+    if (!cpus.isEmpty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        foreach (int cpu, cpus) {
+            if (cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+            qWarning() << "Failed to set the CPU affinity to" << cpus;
+        }
+    }
+    if (background) {
+        //Only runs when nothing else wants the CPU or the disk
+        pid_t tid = (pid_t) syscall(SYS_gettid);
+        struct sched_param param;
+        param.sched_priority = 0;
+        if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0) {
+            setpriority(PRIO_PROCESS, tid, 19);
+        }
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+    }
+#elif defined(_WIN32)
+    if (!cpus.isEmpty()) {
+        DWORD_PTR mask = 0;
+        foreach (int cpu, cpus) {
+            if (cpu < (int) sizeof(DWORD_PTR) * 8) {
+                mask |= (DWORD_PTR) 1 << cpu;
+            }
+        }
+        if (SetThreadAffinityMask(GetCurrentThread(), mask) == 0) {
+            qWarning() << "Failed to set the CPU affinity to" << cpus;
+        }
+    }
+    if (background) {
+        //Lowers both CPU and I/O priority, fails harmlessly if already set
+        SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+    }
+#elif defined(__APPLE__)
+    //No affinity on macOS, the background QoS class throttles CPU and I/O
+    if (background) {
+        pthread_set_qos_class_self_np(QOS_CLASS_BACKGROUND, 0);
+    }
+#endif
+}
+
+QList<int> CCompressionPool::parseCpuList(QString list) {
+    QList<int> cpus;
+    foreach (QString part, list.split(',', QString::SkipEmptyParts)) {
+        QStringList range = part.trimmed().split('-');
+        bool firstOk, lastOk = true;
+        int first = range.at(0).toInt(&firstOk);
+        int last = range.length() > 1 ? range.at(1).toInt(&lastOk) : first;
+        if (!firstOk || !lastOk || range.length() > 2 || first < 0 || last < first || last > 4095) {
+            qWarning() << "Ignoring invalid CPU range" << part;
+            continue;
+        }
+        for (int cpu = first; cpu <= last; cpu++) {
+            if (!cpus.contains(cpu)) {
+                cpus.append(cpu);
+            }
+        }
+    }
+    return cpus;
+}
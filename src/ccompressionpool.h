@@ -0,0 +1,82 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef CCOMPRESSIONPOOL_H
+#define CCOMPRESSIONPOOL_H
+
+#include <QThreadPool>
+#include <QFuture>
+#include <QList>
+#include <QString>
+#include <QMutex>
+#include <functional>
+
+//A file of the batch, taken from its list item by the GUI thread when the batch starts
+typedef struct {
+    quint64 id; //Only handed back with the result, the GUI thread finds the item by it
+    QString path;
+    bool priority; //Asked first with "Compress first"
+    //What the headers tell, see CaesiumPH::on_actionCompress_triggered
+    qint64 cost; //Bytes times pixels, the decode and the encodes grow with both
+    bool gain;
+    bool inspected; //gain comes from the whole file, not a guess from its first bytes
+    quint64 device; //Backing device, see CIOScheduler::device
+} cbatchfile;
+
+/*
+ * Thread pool reserved to batch compression, so previews and anything
+ * else on the global pool never wait behind it. Its threads can be
+ * pinned to a set of CPUs and run in background mode, idle CPU and
+ * I/O priority, to live next to latency sensitive services.
+ */
+class CCompressionPool {
+public:
+    static CCompressionPool* instance();
+
+    //threads 0 means one per core; a new setup recreates the threads
+    void configure(int threads, QString affinity, bool background);
+    int threadCount() const;
+    void setExtraThreads(int extra);
+
+    //Runs routine on every file, the future reports progress and accepts cancel
+    QFuture<void> map(QList<cbatchfile> files, std::function<void(const cbatchfile&)> routine);
+
+    //Affinity and priority for the calling thread, for helpers outside the pool
+    void setupCurrentThread();
+
+    //"0-3,6" style list of CPU indexes
+    static QList<int> parseCpuList(QString list);
+
+private:
+    CCompressionPool();
+    ~CCompressionPool();
+
+    QMutex mutex;
+    QThreadPool* pool;
+    int threads;
+    int extraThreads;
+    QList<int> cpus;
+    bool background;
+};
+
+#endif // CCOMPRESSIONPOOL_H
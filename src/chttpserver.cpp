@@ -0,0 +1,356 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#include "chttpserver.h"
+#include "cworkerpool.h"
+#include "preferencedialog.h"
+#include "utils.h"
+
+#include <QtConcurrent>
+#include <QCoreApplication>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QHostAddress>
+#include <QThread>
+#include <QDebug>
+
+//Time spent by a job, from its request being complete
+static chttpjob optimizeRequest(cjob job, qint64 received, QElapsedTimer clock) {
+    chttpjob http;
+    http.input = job.input;
+    qint64 start = clock.elapsed();
+    http.queued = start - received;
+    http.result = params.processes ? CWorkerPool::instance()->run(job) : runJob(job);
+    http.busy = clock.elapsed() - start;
+    return http;
+}
+
+CHttpServer::CHttpServer(int threads, int queue, QObject* parent) :
+    QObject(parent),
+    capacity(threads + queue),
+    active(0),
+    served(0),
+    rejected(0),
+    buffered(0) {
+    clock.start();
+    pool.setMaxThreadCount(threads);
+    connect(&server, SIGNAL(newConnection()), this, SLOT(newConnection()));
+    connect(&idleTimer, SIGNAL(timeout()), this, SLOT(closeIdle()));
+    idleTimer.start(HTTP_IDLE_TIMEOUT / 3);
+}
+
+bool CHttpServer::listen(QHostAddress address, quint16 port) {
+    if (!server.listen(address, port)) {
+        qCritical() << "Cannot listen on" << address.toString() << port << ":" << server.errorString();
+        return false;
+    }
+    qInfo() << "Serving on" << address.toString() + ":" + QString::number(port) << "with"
+            << pool.maxThreadCount() << "threads and" << capacity - pool.maxThreadCount() << "queued requests";
+    return true;
+}
+
+void CHttpServer::newConnection() {
+    while (server.hasPendingConnections()) {
+        QTcpSocket* socket = server.nextPendingConnection();
+        if (connections.size() >= HTTP_MAX_CONNECTIONS) {
+            socket->abort();
+            socket->deleteLater();
+            continue;
+        }
+        //Qt stops reading from the network past this, the client is held back until the data is taken
+        socket->setReadBufferSize(HTTP_MAX_HEADER);
+        connect(socket, SIGNAL(readyRead()), this, SLOT(readClient()));
+        connect(socket, SIGNAL(disconnected()), this, SLOT(clientDisconnected()));
+
+        chttpconnection connection;
+        connection.busy = false;
+        connection.continued = false;
+        connection.keepAlive = true;
+        connection.lastActivity = clock.elapsed();
+        connections.insert(socket, connection);
+    }
+}
+
+void CHttpServer::readClient() {
+    QTcpSocket* socket = qobject_cast<QTcpSocket*>(sender());
+    if (socket != NULL) {
+        readRequests(socket);
+    }
+}
+
+void CHttpServer::readRequests(QTcpSocket* socket) {
+    //Pipelined requests stay in the socket while a job runs, see jobFinished
+    if (!connections.contains(socket) || connections[socket].busy) {
+        return;
+    }
+    chttpconnection& connection = connections[socket];
+    QByteArray data = socket->readAll();
+    if (buffered + data.size() > HTTP_MAX_BUFFERED) {
+        connection.keepAlive = false;
+        rejected++;
+        respond(socket, 503, "Service Unavailable", "Too many uploads at once\n", "text/plain",
+                QList<QByteArray>() << "Retry-After: 1");
+        return;
+    }
+    connection.buffer.append(data);
+    buffered += data.size();
+    connection.lastActivity = clock.elapsed();
+    processRequests(socket);
+}
+
+void CHttpServer::processRequests(QTcpSocket* socket) {
+    //One request at a time per connection, pipelined ones wait their turn
+    while (connections.contains(socket) && !connections[socket].busy) {
+        chttpconnection& connection = connections[socket];
+        int headerEnd = connection.buffer.indexOf("\r\n\r\n");
+        if (headerEnd < 0) {
+            if (connection.buffer.size() > HTTP_MAX_HEADER) {
+                connection.keepAlive = false;
+                respond(socket, 431, "Request Header Fields Too Large", "Headers too large\n");
+            }
+            return;
+        }
+
+        QList<QByteArray> lines = connection.buffer.left(headerEnd).split('\n');
+        QList<QByteArray> requestLine = lines.takeFirst().trimmed().split(' ');
+        QHash<QByteArray, QByteArray> headers;
+        foreach (QByteArray line, lines) {
+            int colon = line.indexOf(':');
+            if (colon > 0) {
+                headers.insert(line.left(colon).trimmed().toLower(), line.mid(colon + 1).trimmed());
+            }
+        }
+        if (requestLine.length() != 3) {
+            connection.keepAlive = false;
+            respond(socket, 400, "Bad Request", "Malformed request line\n");
+            return;
+        }
+        QByteArray method = requestLine.at(0);
+        QByteArray path = requestLine.at(1).split('?').first();
+        QByteArray version = requestLine.at(2);
+
+        //1.1 keeps the connection by default, 1.0 only when asked
+        QByteArray connectionHeader = headers.value("connection").toLower();
+        connection.keepAlive = version == "HTTP/1.1" ? connectionHeader != "close" : connectionHeader == "keep-alive";
+
+        if (headers.contains("transfer-encoding")) {
+            connection.keepAlive = false;
+            respond(socket, 411, "Length Required", "Send the image with a Content-Length\n");
+            return;
+        }
+        bool validLength = true;
+        qint64 length = headers.contains("content-length") ? headers.value("content-length").toLongLong(&validLength) : 0;
+        if (!validLength || length < 0 || length > HTTP_MAX_BODY) {
+            connection.keepAlive = false;
+            respond(socket, 413, "Payload Too Large", "Images up to " + toHumanSize(HTTP_MAX_BODY).toUtf8() + "\n");
+            return;
+        }
+
+        //curl waits for this before sending big bodies; a full queue answers without reading it
+        if (headers.value("expect").toLower() == "100-continue" && !connection.continued &&
+                connection.buffer.size() - headerEnd - 4 < length) {
+            if (method == "POST" && active >= capacity) {
+                connection.keepAlive = false;
+                rejected++;
+                respond(socket, 503, "Service Unavailable", "Queue full\n", "text/plain",
+                        QList<QByteArray>() << "Retry-After: 1");
+                return;
+            }
+            connection.continued = true;
+            socket->write("HTTP/1.1 100 Continue\r\n\r\n");
+        }
+        if (connection.buffer.size() - headerEnd - 4 < length) {
+            return;
+        }
+
+        QByteArray body = connection.buffer.mid(headerEnd + 4, length);
+        connection.buffer.remove(0, headerEnd + 4 + length);
+        buffered -= headerEnd + 4 + length;
+        connection.continued = false;
+
+        if (path == "/health") {
+            if (method != "GET") {
+                respond(socket, 405, "Method Not Allowed", "Use GET\n", "text/plain", QList<QByteArray>() << "Allow: GET");
+                continue;
+            }
+            QJsonObject health;
+            health["status"] = "ok";
+            health["active"] = active;
+            health["capacity"] = capacity;
+            health["threads"] = pool.maxThreadCount();
+            health["served"] = (double) served;
+            health["rejected"] = (double) rejected;
+            respond(socket, 200, "OK", QJsonDocument(health).toJson(QJsonDocument::Compact) + "\n", "application/json");
+        } else if (path == "/optimize" || path == "/") {
+            if (method != "POST") {
+                respond(socket, 405, "Method Not Allowed", "POST a JPEG\n", "text/plain", QList<QByteArray>() << "Allow: POST");
+                continue;
+            }
+            if (body.isEmpty()) {
+                respond(socket, 400, "Bad Request", "Empty body\n");
+                continue;
+            }
+            //Back-pressure: the caller retries later instead of queueing without bounds
+            if (active >= capacity) {
+                rejected++;
+                respond(socket, 503, "Service Unavailable", "Queue full\n", "text/plain", QList<QByteArray>() << "Retry-After: 1");
+                continue;
+            }
+
+            QFutureWatcher<chttpjob>* watcher = new QFutureWatcher<chttpjob>(this);
+            connect(watcher, SIGNAL(finished()), this, SLOT(jobFinished()));
+            jobs.insert(watcher, socket);
+            connection.busy = true;
+            active++;
+            watcher->setFuture(QtConcurrent::run(&pool, optimizeRequest, makeJob(body), clock.elapsed(), clock));
+        } else {
+            respond(socket, 404, "Not Found", "Try POST /optimize or GET /health\n");
+        }
+    }
+}
+
+void CHttpServer::jobFinished() {
+    QFutureWatcher<chttpjob>* watcher = static_cast<QFutureWatcher<chttpjob>*>(sender());
+    QPointer<QTcpSocket> socket = jobs.take(watcher);
+    chttpjob http = watcher->result();
+    watcher->deleteLater();
+    active--;
+    served++;
+
+    //The client went away meanwhile
+    if (socket.isNull() || !connections.contains(socket)) {
+        return;
+    }
+    connections[socket].busy = false;
+    connections[socket].lastActivity = clock.elapsed();
+
+    const cjobresult& result = http.result;
+    QList<QByteArray> headers;
+    headers << "Server-Timing: queue;dur=" + QByteArray::number(http.queued) +
+               ", optimize;dur=" + QByteArray::number(http.busy);
+
+    if (result.result < 0) {
+        QByteArray reason = result.result == CCLT_CORRUPT ? "Damaged image data" :
+                            result.result == WORKER_CRASHED ? "The image crashed the optimizer" :
+                            result.result == WORKER_TIMED_OUT ? "The optimizer timed out" : "Not a valid JPEG";
+        if (!result.message.isEmpty()) {
+            reason += ", " + result.message.toUtf8();
+        }
+        respond(socket, 422, "Unprocessable Entity", reason + "\n", "text/plain", headers);
+    } else {
+        //Nothing gained or not provably lossless, the caller gets its own bytes back
+        bool optimized = (CCLT_MUST_REPLACE(result.result) ||
+                          (result.result == CCLT_OK && result.output.size() < http.input.size())) && result.verified;
+        QByteArray body = optimized ? result.output : http.input;
+        headers << "X-Original-Size: " + QByteArray::number(http.input.size())
+                << "X-Optimized-Size: " + QByteArray::number(body.size())
+                << "X-Caesium-Result: " + QByteArray(optimized ? "optimized" : result.verified ? "unchanged" : "unverified");
+        if (optimized) {
+            headers << "X-Caesium-Scans: " + QByteArray(result.progressive ? "progressive" : "baseline")
+                    << "X-Caesium-Coding: " + QByteArray(result.arithmetic ? "arithmetic" : "huffman") +
+                       (result.inputArithmetic != result.arithmetic ? "; recoded" : "");
+        }
+        if (!result.message.isEmpty()) {
+            headers << "X-Caesium-Warning: " + result.message.simplified().toUtf8();
+        }
+        respond(socket, 200, "OK", body, "image/jpeg", headers);
+    }
+
+    readRequests(socket);
+}
+
+void CHttpServer::respond(QTcpSocket* socket, int status, QByteArray reason, QByteArray body,
+                          QByteArray contentType, QList<QByteArray> headers) {
+    bool keepAlive = connections.contains(socket) && connections[socket].keepAlive;
+    QByteArray response = "HTTP/1.1 " + QByteArray::number(status) + " " + reason + "\r\n" +
+            "Content-Type: " + contentType + "\r\n" +
+            "Content-Length: " + QByteArray::number(body.size()) + "\r\n" +
+            "Connection: " + (keepAlive ? "keep-alive" : "close") + "\r\n";
+    foreach (QByteArray header, headers) {
+        response += header + "\r\n";
+    }
+    response += "\r\n";
+    socket->write(response);
+    socket->write(body);
+
+    if (!keepAlive) {
+        //Sends what's pending, then closes
+        forgetConnection(socket);
+        socket->disconnectFromHost();
+    }
+}
+
+void CHttpServer::clientDisconnected() {
+    QTcpSocket* socket = qobject_cast<QTcpSocket*>(sender());
+    if (socket == NULL) {
+        return;
+    }
+    forgetConnection(socket);
+    socket->deleteLater();
+}
+
+void CHttpServer::forgetConnection(QTcpSocket* socket) {
+    if (connections.contains(socket)) {
+        buffered -= connections.take(socket).buffer.size();
+    }
+}
+
+void CHttpServer::closeIdle() {
+    qint64 now = clock.elapsed();
+    foreach (QTcpSocket* socket, connections.keys()) {
+        const chttpconnection& connection = connections[socket];
+        if (!connection.busy && now - connection.lastActivity > HTTP_IDLE_TIMEOUT) {
+            forgetConnection(socket);
+            socket->disconnectFromHost();
+        }
+    }
+}
+
+int runHttpServer(QStringList arguments) {
+    quint16 port = arguments.value(arguments.indexOf(HTTP_ARGUMENT) + 1).toUShort();
+    if (port == 0) {
+        qCritical() << "Usage: caesiumph" << HTTP_ARGUMENT << "port [--bind ADDRESS] [--threads N] [--queue N]";
+        return 1;
+    }
+
+    QHostAddress address(QHostAddress::LocalHost);
+    int threads = QThread::idealThreadCount();
+    int queue = 64;
+    for (int i = 0; i < arguments.length() - 1; i++) {
+        if (arguments.at(i) == "--bind") {
+            address = QHostAddress(arguments.at(i + 1));
+        } else if (arguments.at(i) == "--threads") {
+            threads = qMax(1, arguments.at(i + 1).toInt());
+        } else if (arguments.at(i) == "--queue") {
+            queue = qMax(0, arguments.at(i + 1).toInt());
+        }
+    }
+
+    readParams();
+
+    CHttpServer server(threads, queue);
+    if (!server.listen(address, port)) {
+        return 1;
+    }
+    return QCoreApplication::exec();
+}
@@ -0,0 +1,120 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef CHTTPSERVER_H
+#define CHTTPSERVER_H
+
+#include <QObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QThreadPool>
+#include <QFutureWatcher>
+#include <QPointer>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QHash>
+
+#include "cworker.h"
+
+//Command line switch starting the HTTP service, followed by the port
+#define HTTP_ARGUMENT "--serve"
+
+#define HTTP_MAX_HEADER (64 * 1024)
+#define HTTP_MAX_BODY (256 * 1024 * 1024)
+//Bytes of requests held for all the connections together, uploads past it get a 503
+#define HTTP_MAX_BUFFERED (1024 * 1024 * 1024)
+//Connections past this are closed as soon as they are accepted
+#define HTTP_MAX_CONNECTIONS 1024
+//Keep-alive connections with nothing to do are closed after this
+#define HTTP_IDLE_TIMEOUT 30000
+
+//Outcome of a request, with where its time went
+typedef struct {
+    QByteArray input;
+    cjobresult result;
+    qint64 queued; //ms waiting for a thread
+    qint64 busy; //ms optimizing
+} chttpjob;
+
+//Per connection state
+typedef struct {
+    QByteArray buffer;
+    bool busy; //A job runs for it, further requests wait in the socket
+    bool continued; //100 Continue already sent for the request being read
+    bool keepAlive;
+    qint64 lastActivity;
+} chttpconnection;
+
+/*
+ * Optimization over HTTP, for upload paths:
+ *
+ *   POST /optimize   JPEG in the body, optimized JPEG back, or the original if
+ *                    it can't be made smaller, with X-Original-Size,
+ *                    X-Optimized-Size, X-Caesium-Scans, X-Caesium-Coding and
+ *                    Server-Timing headers. Arithmetic coded uploads come back
+ *                    as Huffman unless arithmetic output is set
+ *   GET /health      JSON with the load of the service
+ *
+ * Options are the saved preferences. Requests beyond the threads plus the
+ * queue get a 503 right away instead of piling up, so do uploads past
+ * HTTP_MAX_BUFFERED. A connection holds one request at a time in memory.
+ */
+class CHttpServer : public QObject {
+    Q_OBJECT
+
+public:
+    CHttpServer(int threads, int queue, QObject* parent = 0);
+    bool listen(QHostAddress address, quint16 port);
+
+private slots:
+    void newConnection();
+    void readClient();
+    void clientDisconnected();
+    void jobFinished();
+    void closeIdle();
+
+private:
+    QTcpServer server;
+    QThreadPool pool;
+    QTimer idleTimer;
+    QElapsedTimer clock;
+    int capacity;
+    int active;
+    qint64 served;
+    qint64 rejected;
+    qint64 buffered; //Bytes in the buffers of connections
+
+    QHash<QTcpSocket*, chttpconnection> connections;
+    QHash<QFutureWatcher<chttpjob>*, QPointer<QTcpSocket> > jobs;
+
+    void readRequests(QTcpSocket* socket);
+    void processRequests(QTcpSocket* socket);
+    void forgetConnection(QTcpSocket* socket);
+    void respond(QTcpSocket* socket, int status, QByteArray reason, QByteArray body,
+                 QByteArray contentType = "text/plain", QList<QByteArray> headers = QList<QByteArray>());
+};
+
+//Runs the service until killed, see CHttpServer
+int runHttpServer(QStringList arguments);
+
+#endif // CHTTPSERVER_H
@@ -27,10 +27,10 @@
 #include <QFileInfo>
 
 CImageInfo::CImageInfo(QString path) {
-    QFileInfo* fi = new QFileInfo(path);
+    QFileInfo fi(path);
     fullPath = path;
-    baseName = fi->completeBaseName();
-    size = fi->size();
+    baseName = fi.completeBaseName();
+    size = fi.size();
     formattedSize = toHumanSize(size);
 }
 
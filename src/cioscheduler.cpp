@@ -0,0 +1,163 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#include "cioscheduler.h"
+#include "ctrace.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#ifdef __linux__
+#include <sys/sysmacros.h>
+#endif
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QStorageInfo>
+#include <QThread>
+#include <QMutexLocker>
+#include <QDebug>
+
+CIOScheduler::CIOScheduler() :
+    override(0) {
+
+}
+
+CIOScheduler::~CIOScheduler() {
+    qDeleteAll(semaphores);
+}
+
+CIOScheduler* CIOScheduler::instance() {
+    static CIOScheduler scheduler;
+    return &scheduler;
+}
+
+void CIOScheduler::reset(int limit) {
+    //Only called between compressions, when no slot is held
+    QMutexLocker locker(&mutex);
+    override = limit;
+    limits.clear();
+    qDeleteAll(semaphores);
+    semaphores.clear();
+}
+
+quint64 CIOScheduler::device(QString path) {
+    //Outputs may not exist yet, their folder tells the device as well
+    QFileInfo info(path);
+    while (!info.exists() && !info.isRoot() && info.path() != info.filePath()) {
+        info.setFile(info.path());
+    }
+    QString existing = info.absoluteFilePath();
+#ifdef _WIN32
+    quint64 id = qHash(QStorageInfo(existing).rootPath().toLower());
+#else
+    struct stat s;
+    quint64 id = stat(QFile::encodeName(existing).constData(), &s) == 0 ? (quint64) s.st_dev : 0;
+#endif
+
+    //First time we see this device, find out what it is
+    QMutexLocker locker(&mutex);
+    if (!limits.contains(id)) {
+        int detected = detectLimit(id, existing);
+        limits.insert(id, detected);
+        qInfo() << "I/O limit for" << QStorageInfo(existing).rootPath() << "is" << detected;
+    }
+    return id;
+}
+
+int CIOScheduler::limit(quint64 device) {
+    QMutexLocker locker(&mutex);
+    return limits.value(device, override > 0 ? override : QThread::idealThreadCount());
+}
+
+int CIOScheduler::detectLimit(quint64 device, QString path) {
+    if (override > 0) {
+        return override;
+    }
+
+    //Network shares are slow to seek no matter what is behind them
+    QStorageInfo storage(path);
+#ifdef _WIN32
+    if (GetDriveTypeW((LPCWSTR) storage.rootPath().utf16()) == DRIVE_REMOTE) {
+        return IO_LIMIT_NETWORK;
+    }
+#else
+    QByteArray type = storage.fileSystemType();
+    if (type.startsWith("nfs") || type == "cifs" || type == "smbfs" || type == "smb3" ||
+            type == "afpfs" || type == "9p" || type == "fuse.sshfs") {
+        return IO_LIMIT_NETWORK;
+    }
+#endif
+
+#ifdef __linux__
+    //Partitions have no queue of their own, it's on the parent disk
+    QString block = QString("/sys/dev/block/%1:%2").arg(major(device)).arg(minor(device));
+    QFile rotational(block + "/queue/rotational");
+    if (!rotational.exists()) {
+        rotational.setFileName(QFileInfo(block).canonicalFilePath() + "/../queue/rotational");
+    }
+    if (rotational.open(QIODevice::ReadOnly)) {
+        bool spinning = rotational.readAll().trimmed() == "1";
+        rotational.close();
+        return spinning ? IO_LIMIT_ROTATIONAL : qMax(IO_LIMIT_SOLID, QThread::idealThreadCount());
+    }
+#endif
+
+    //Unknown storage, don't get in the way
+    return QThread::idealThreadCount();
+}
+
+void CIOScheduler::acquire(quint64 device) {
+    QSemaphore* semaphore;
+    {
+        QMutexLocker locker(&mutex);
+        semaphore = semaphores.value(device, NULL);
+        if (semaphore == NULL) {
+            semaphore = new QSemaphore(limits.value(device, QThread::idealThreadCount()));
+            semaphores.insert(device, semaphore);
+        }
+    }
+    semaphore->acquire();
+}
+
+void CIOScheduler::release(quint64 device) {
+    QMutexLocker locker(&mutex);
+    QSemaphore* semaphore = semaphores.value(device, NULL);
+    if (semaphore != NULL) {
+        semaphore->release();
+    }
+}
+
+CIOScope::CIOScope(QString path) :
+    device(CIOScheduler::instance()->device(path)) {
+    CTraceScope trace("io wait");
+    CIOScheduler::instance()->acquire(device);
+}
+
+CIOScope::~CIOScope() {
+    CIOScheduler::instance()->release(device);
+}
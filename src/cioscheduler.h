@@ -0,0 +1,78 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef CIOSCHEDULER_H
+#define CIOSCHEDULER_H
+
+#include <QString>
+#include <QHash>
+#include <QMutex>
+#include <QSemaphore>
+
+//Concurrent I/O jobs on a single device, by kind of storage
+#define IO_LIMIT_ROTATIONAL 2
+#define IO_LIMIT_NETWORK 2
+#define IO_LIMIT_SOLID 8
+
+/*
+ * Bounds how many workers hit the same backing device at once.
+ * A spinning disk or a NAS share serves a couple of sequential
+ * readers far better than one per core, while decoding and
+ * encoding keep running at full parallelism.
+ */
+class CIOScheduler {
+public:
+    static CIOScheduler* instance();
+
+    //Limit used for every device, 0 detects it per device
+    void reset(int limit);
+
+    //Backing device of path, its limit is detected the first time it's seen
+    quint64 device(QString path);
+    int limit(quint64 device);
+    void acquire(quint64 device);
+    void release(quint64 device);
+
+private:
+    CIOScheduler();
+    ~CIOScheduler();
+
+    int detectLimit(quint64 device, QString path);
+
+    QMutex mutex;
+    int override;
+    QHash<quint64, int> limits;
+    QHash<quint64, QSemaphore*> semaphores;
+};
+
+//Holds an I/O slot on the device of path for the lifetime of the object
+class CIOScope {
+public:
+    CIOScope(QString path);
+    ~CIOScope();
+
+private:
+    quint64 device;
+};
+
+#endif // CIOSCHEDULER_H
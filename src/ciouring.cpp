@@ -0,0 +1,339 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#include "ciouring.h"
+
+#ifdef HAVE_IO_URING
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <linux/io_uring.h>
+#endif
+
+#include <QFile>
+#include <QVector>
+#include <QDebug>
+
+#ifdef HAVE_IO_URING
+
+static int ioUringSetup(unsigned entries, struct io_uring_params* p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+CIOUring::CIOUring() :
+    ringFd(-1),
+    entries(0),
+    sqRing(MAP_FAILED),
+    cqRing(MAP_FAILED),
+    sqes(MAP_FAILED),
+    sqRingSize(0),
+    cqRingSize(0),
+    sqesSize(0) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ringFd = ioUringSetup(IO_URING_BATCH * 2, &p);
+    if (ringFd < 0) {
+        return;
+    }
+    entries = p.sq_entries;
+
+    sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    //Newer kernels map both rings at once
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        sqRingSize = cqRingSize = qMax(sqRingSize, cqRingSize);
+    }
+
+    sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+        close(ringFd);
+        ringFd = -1;
+        return;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        cqRing = sqRing;
+    } else {
+        cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+    }
+    sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+        qWarning() << "Failed to map the io_uring rings";
+        close(ringFd);
+        ringFd = -1;
+        return;
+    }
+
+    sqTail = (unsigned*) ((char*) sqRing + p.sq_off.tail);
+    sqMask = (unsigned*) ((char*) sqRing + p.sq_off.ring_mask);
+    sqArray = (unsigned*) ((char*) sqRing + p.sq_off.array);
+    cqHead = (unsigned*) ((char*) cqRing + p.cq_off.head);
+    cqTail = (unsigned*) ((char*) cqRing + p.cq_off.tail);
+    cqMask = (unsigned*) ((char*) cqRing + p.cq_off.ring_mask);
+    cqes = (char*) cqRing + p.cq_off.cqes;
+}
+
+CIOUring::~CIOUring() {
+    teardown();
+}
+
+void CIOUring::teardown() {
+    if (sqes != MAP_FAILED) {
+        munmap(sqes, sqesSize);
+    }
+    if (cqRing != MAP_FAILED && cqRing != sqRing) {
+        munmap(cqRing, cqRingSize);
+    }
+    if (sqRing != MAP_FAILED) {
+        munmap(sqRing, sqRingSize);
+    }
+    if (ringFd >= 0) {
+        close(ringFd);
+    }
+    sqes = cqRing = sqRing = MAP_FAILED;
+    ringFd = -1;
+}
+
+bool CIOUring::isSupported() {
+    static int supported = -1;
+    if (supported < 0) {
+        CIOUring ring;
+        supported = ring.isValid() ? 1 : 0;
+        if (!supported) {
+            qInfo() << "io_uring is not available, using regular reads";
+        }
+    }
+    return supported == 1;
+}
+
+bool CIOUring::isValid() const {
+    return ringFd >= 0;
+}
+
+void* CIOUring::nextEntry() {
+    //Only this thread touches the submission tail
+    unsigned tail = *sqTail;
+    unsigned index = tail & *sqMask;
+    struct io_uring_sqe* sqe = (struct io_uring_sqe*) sqes + index;
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[index] = index;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+unsigned CIOUring::reap(QList<int>* results) {
+    //Results are matched through user_data, completions come in any order
+    unsigned reaped = 0;
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe* cqe = (struct io_uring_cqe*) cqes + (head & *cqMask);
+        (*results)[(int) cqe->user_data] = cqe->res;
+        head++;
+        reaped++;
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    return reaped;
+}
+
+bool CIOUring::submitAndWait(unsigned count, QList<int>* results) {
+    if (count == 0) {
+        return true;
+    }
+    unsigned submitted = 0;
+    unsigned completed = 0;
+    while (completed < count) {
+        int ret = ioUringEnter(ringFd, count - submitted, count - completed, IORING_ENTER_GETEVENTS);
+        if (ret < 0 && errno != EINTR) {
+            int error = errno;
+            //What the kernel already took still writes into the caller's buffers, wait for it
+            while (completed < submitted) {
+                completed += reap(results);
+                if (completed < submitted &&
+                        ioUringEnter(ringFd, 0, submitted - completed, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+                    break;
+                }
+            }
+            //Entries left in the ring point at buffers about to be freed, the next batch must not submit them
+            qWarning() << "io_uring failed, using regular reads:" << strerror(error);
+            teardown();
+            return false;
+        }
+        if (ret > 0) {
+            submitted += ret;
+        }
+        completed += reap(results);
+    }
+    return true;
+}
+
+void CIOUring::closeAll(const QList<int>& fds) {
+    foreach (int fd, fds) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+QList<QByteArray> CIOUring::readFiles(const QStringList& paths) {
+    QList<QByteArray> contents;
+    for (int i = 0; i < paths.length(); i++) {
+        contents.append(QByteArray());
+    }
+    //Anything past a batch is left to the caller
+    int count = qMin(paths.length(), (int) entries / 2);
+    if (!isValid() || count == 0) {
+        return contents;
+    }
+
+    QList<QByteArray> names;
+    QVector<struct statx> stats(count);
+    QList<int> results;
+    for (int i = 0; i < count; i++) {
+        names.append(QFile::encodeName(paths.at(i)));
+        results << -1 << -1;
+    }
+
+    //First round: open and size every file
+    for (int i = 0; i < count; i++) {
+        struct io_uring_sqe* sqe = (struct io_uring_sqe*) nextEntry();
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (unsigned long) names.at(i).constData();
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        sqe->user_data = i;
+
+        sqe = (struct io_uring_sqe*) nextEntry();
+        sqe->opcode = IORING_OP_STATX;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (unsigned long) names.at(i).constData();
+        sqe->len = STATX_SIZE;
+        sqe->off = (unsigned long) &stats[i];
+        sqe->user_data = count + i;
+    }
+    bool ok = submitAndWait(count * 2, &results);
+    QList<int> fds = results.mid(0, count);
+    QList<int> statResults = results.mid(count, count);
+    if (!ok) {
+        //The ring is gone, the caller reads every file itself
+        closeAll(fds);
+        return contents;
+    }
+
+    //Second round: read each file whole into its own buffer
+    QList<int> reads;
+    unsigned queued = 0;
+    for (int i = 0; i < count; i++) {
+        reads << -1;
+        if (fds.at(i) < 0 || statResults.at(i) < 0) {
+            continue;
+        }
+        contents[i] = QByteArray((int) stats[i].stx_size, Qt::Uninitialized);
+        if (contents[i].isEmpty()) {
+            continue;
+        }
+        struct io_uring_sqe* sqe = (struct io_uring_sqe*) nextEntry();
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = fds.at(i);
+        sqe->addr = (unsigned long) contents[i].data();
+        sqe->len = contents[i].size();
+        sqe->off = 0;
+        sqe->user_data = i;
+        queued++;
+    }
+    if (!submitAndWait(queued, &reads)) {
+        closeAll(fds);
+        for (int i = 0; i < count; i++) {
+            contents[i] = QByteArray();
+        }
+        return contents;
+    }
+
+    //Last round: close whatever got opened
+    QList<int> closes;
+    queued = 0;
+    for (int i = 0; i < count; i++) {
+        //Anything still at 1 never ran and is closed here instead
+        closes << 1;
+        if (fds.at(i) < 0) {
+            continue;
+        }
+        struct io_uring_sqe* sqe = (struct io_uring_sqe*) nextEntry();
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = fds.at(i);
+        sqe->user_data = i;
+        queued++;
+    }
+    submitAndWait(queued, &closes);
+    for (int i = 0; i < count; i++) {
+        //Old kernels have no IORING_OP_CLOSE
+        if (fds.at(i) >= 0 && (closes.at(i) == 1 || closes.at(i) == -EINVAL)) {
+            close(fds.at(i));
+        }
+    }
+
+    //Short or failed reads are handed back as null, the caller reads those itself
+    for (int i = 0; i < count; i++) {
+        if (!contents.at(i).isEmpty() && reads.at(i) != contents.at(i).size()) {
+            contents[i] = QByteArray();
+        }
+    }
+    return contents;
+}
+
+#else
+
+CIOUring::CIOUring() :
+    ringFd(-1) {
+
+}
+
+CIOUring::~CIOUring() {
+
+}
+
+bool CIOUring::isSupported() {
+    return false;
+}
+
+bool CIOUring::isValid() const {
+    return false;
+}
+
+QList<QByteArray> CIOUring::readFiles(const QStringList& paths) {
+    QList<QByteArray> contents;
+    for (int i = 0; i < paths.length(); i++) {
+        contents.append(QByteArray());
+    }
+    return contents;
+}
+
+#endif
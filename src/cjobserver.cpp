@@ -0,0 +1,434 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#include "cjobserver.h"
+#include "utils.h"
+
+#include <QDataStream>
+#include <QFile>
+#include <QMutexLocker>
+#include <QtEndian>
+#include <QDebug>
+
+//Takes as long whatever the first difference, the time of a refusal tells nothing about the token
+static bool sameToken(const QString& a, const QString& b) {
+    QByteArray x = a.toUtf8();
+    QByteArray y = b.toUtf8();
+    uchar difference = x.size() != y.size();
+    for (int i = 0; i < x.size(); i++) {
+        difference |= (uchar) x.at(i) ^ (uchar) (y.isEmpty() ? 0 : y.at(i % y.size()));
+    }
+    return difference == 0;
+}
+
+//Remote workers are not trusted with the original: the coefficients are checked here
+static void verifyRemote(const cjob& job, cjobresult* result) {
+    if (result->result != CCLT_OK && !CCLT_MUST_REPLACE(result->result)) {
+        result->output.clear();
+        return;
+    }
+    QByteArray input = job.input;
+    if (input.isEmpty()) {
+        QFile file(job.path);
+        if (file.open(QIODevice::ReadOnly)) {
+            input = file.readAll();
+        }
+    }
+    result->verified = !input.isEmpty() && !result->output.isEmpty() &&
+            cclt_verify_buffer((unsigned char*) input.constData(), input.size(),
+                               (unsigned char*) result->output.constData(), result->output.size(),
+                               job.orientation) == CCLT_OK;
+    if (!result->verified) {
+        qWarning() << "Output of a remote worker does not match" << job.path;
+    }
+}
+
+CJobServer::CJobServer() :
+    server(NULL),
+    heartbeatTimer(NULL),
+    localThreads(0),
+    sharedStorage(false),
+    port(0),
+    address(QHostAddress::LocalHost),
+    nextId(1) {
+    clock.start();
+    moveToThread(&thread);
+    connect(this, SIGNAL(jobQueued()), this, SLOT(serveRequests()), Qt::QueuedConnection);
+    thread.start();
+}
+
+CJobServer::~CJobServer() {
+    thread.quit();
+    thread.wait();
+}
+
+CJobServer* CJobServer::instance() {
+    static CJobServer jobServer;
+    return &jobServer;
+}
+
+void CJobServer::configure(int port, QString token, bool sharedStorage) {
+    {
+        QMutexLocker locker(&mutex);
+        this->token = token;
+        this->sharedStorage = sharedStorage;
+    }
+    //Sockets belong to the server thread
+    QMetaObject::invokeMethod(this, "startListening", Qt::QueuedConnection, Q_ARG(int, port));
+}
+
+bool CJobServer::isServing() {
+    QMutexLocker locker(&mutex);
+    return port > 0;
+}
+
+void CJobServer::startListening(int port) {
+    QMutexLocker locker(&mutex);
+    //Without a token anybody could send jobs and results, only this computer is let in
+    QHostAddress address = token.isEmpty() ? QHostAddress::LocalHost : QHostAddress::Any;
+    if (port == this->port && address == this->address) {
+        return;
+    }
+    this->port = port;
+    this->address = address;
+
+    //Connected workers keep going, only new ones are refused
+    if (server != NULL) {
+        server->close();
+        server->deleteLater();
+        server = NULL;
+    }
+    if (heartbeatTimer == NULL) {
+        heartbeatTimer = new QTimer(this);
+        connect(heartbeatTimer, SIGNAL(timeout()), this, SLOT(checkHeartbeats()));
+        heartbeatTimer->start(REMOTE_HEARTBEAT_INTERVAL);
+    }
+    if (port <= 0) {
+        return;
+    }
+
+    server = new QTcpServer(this);
+    connect(server, SIGNAL(newConnection()), this, SLOT(newConnection()));
+    if (server->listen(address, port)) {
+        if (token.isEmpty()) {
+            qWarning() << "No remote worker token set, serving workers on this computer only, port" << port;
+        } else {
+            qInfo() << "Serving remote workers on port" << port;
+        }
+    } else {
+        qCritical() << "Cannot serve remote workers on port" << port << ":" << server->errorString();
+        this->port = 0;
+    }
+}
+
+void CJobServer::newConnection() {
+    while (server != NULL && server->hasPendingConnections()) {
+        QTcpSocket* socket = server->nextPendingConnection();
+        connect(socket, SIGNAL(readyRead()), this, SLOT(readWorker()));
+        connect(socket, SIGNAL(disconnected()), this, SLOT(workerDisconnected()));
+
+        QMutexLocker locker(&mutex);
+        //Known from now on, but no work until it says hello
+        buffers.insert(socket, QByteArray());
+        lastSeen.insert(socket, clock.elapsed());
+    }
+}
+
+void CJobServer::readWorker() {
+    QTcpSocket* socket = qobject_cast<QTcpSocket*>(sender());
+    if (socket == NULL) {
+        return;
+    }
+
+    QMutexLocker locker(&mutex);
+    if (!buffers.contains(socket)) {
+        return;
+    }
+    buffers[socket].append(socket->readAll());
+    lastSeen.insert(socket, clock.elapsed());
+
+    //Strangers get a few KB to say hello, not the frame size of a job
+    const QByteArray& buffer = buffers[socket];
+    if (!threads.contains(socket) && buffer.size() >= 4 &&
+            qFromBigEndian<quint32>((const uchar*) buffer.constData()) > REMOTE_MAX_HELLO) {
+        qWarning() << "Refused remote worker" << socket->peerAddress().toString();
+        releaseWorker(socket);
+        return;
+    }
+
+    QByteArray frame;
+    int taken;
+    while ((taken = takeFrame(&buffers[socket], &frame)) == 1) {
+        handleFrame(socket, frame);
+        if (!buffers.contains(socket)) {
+            return;
+        }
+    }
+    if (taken < 0) {
+        qWarning() << "Malformed message from remote worker" << socket->peerAddress().toString();
+        releaseWorker(socket);
+    }
+}
+
+void CJobServer::handleFrame(QTcpSocket* socket, const QByteArray& frame) {
+    QDataStream in(frame);
+    quint8 type;
+    in >> type;
+
+    //Nothing but the hello before the worker is accepted
+    if (type != REMOTE_HELLO && !threads.contains(socket)) {
+        releaseWorker(socket);
+        return;
+    }
+
+    switch (type) {
+    case REMOTE_HELLO: {
+        QString workerToken, host;
+        qint32 workerThreads;
+        in >> workerToken >> host >> workerThreads;
+        if (in.status() != QDataStream::Ok || !sameToken(workerToken, token) || workerThreads <= 0) {
+            qWarning() << "Refused remote worker" << socket->peerAddress().toString();
+            releaseWorker(socket);
+            return;
+        }
+        QString name = host + " (" + socket->peerAddress().toString() + ":" + QString::number(socket->peerPort()) + ")";
+        threads.insert(socket, workerThreads);
+        names.insert(socket, name);
+        qInfo() << "Remote worker" << name << "connected with" << workerThreads << "threads";
+        break;
+    }
+    case REMOTE_REQUEST: {
+        qint64 budget;
+        in >> budget;
+        requests.insert(socket, qMax<qint64>(budget, 1));
+        emit jobQueued();
+        break;
+    }
+    case REMOTE_RESULT: {
+        quint64 id;
+        cjobresult result;
+        qint64 busy;
+        in >> id >> result >> busy;
+        if (in.status() != QDataStream::Ok) {
+            releaseWorker(socket);
+            return;
+        }
+        //Results of jobs given to somebody else meanwhile are dropped
+        QList<cremotejob*>& jobs = assigned[socket];
+        for (int i = 0; i < jobs.length(); i++) {
+            if (jobs.at(i)->id == id) {
+                cremotejob* job = jobs.takeAt(i);
+                job->result = result;
+                job->state = JOB_DONE;
+                addStats(names.value(socket), job->job, result, busy);
+                changed.wakeAll();
+                break;
+            }
+        }
+        break;
+    }
+    case REMOTE_HEARTBEAT:
+        break;
+    default:
+        qWarning() << "Unknown message from remote worker" << names.value(socket);
+        releaseWorker(socket);
+        break;
+    }
+}
+
+void CJobServer::serveRequests() {
+    QMutexLocker locker(&mutex);
+    foreach (QTcpSocket* socket, requests.keys()) {
+        if (queue.isEmpty()) {
+            return;
+        }
+
+        //Whole jobs in queue order until the budget runs out, at least one
+        qint64 budget = requests.take(socket);
+        QList<cremotejob*> chunk;
+        while (!queue.isEmpty() && (chunk.isEmpty() || budget >= queue.first()->job.input.size())) {
+            cremotejob* job = queue.takeFirst();
+            budget -= job->job.input.size();
+            job->state = JOB_REMOTE;
+            job->worker = socket;
+            chunk.append(job);
+        }
+        assigned[socket].append(chunk);
+
+        QByteArray payload;
+        QDataStream out(&payload, QIODevice::WriteOnly);
+        out << (quint8) REMOTE_CHUNK << (qint32) chunk.length();
+        foreach (cremotejob* job, chunk) {
+            if (sharedStorage) {
+                //The worker reads the file on its own, only the path travels
+                cjob light = job->job;
+                light.input.clear();
+                out << job->id << light;
+            } else {
+                out << job->id << job->job;
+            }
+        }
+        socket->write(makeFrame(payload));
+    }
+}
+
+void CJobServer::workerDisconnected() {
+    QTcpSocket* socket = qobject_cast<QTcpSocket*>(sender());
+    if (socket == NULL) {
+        return;
+    }
+    QMutexLocker locker(&mutex);
+    releaseWorker(socket);
+}
+
+void CJobServer::checkHeartbeats() {
+    QMutexLocker locker(&mutex);
+    qint64 now = clock.elapsed();
+    foreach (QTcpSocket* socket, lastSeen.keys()) {
+        if (now - lastSeen.value(socket) > REMOTE_TIMEOUT) {
+            qWarning() << "Remote worker" << names.value(socket) << "went silent, its jobs go to the others";
+            releaseWorker(socket);
+        }
+    }
+}
+
+void CJobServer::releaseWorker(QTcpSocket* socket) {
+    if (!buffers.contains(socket)) {
+        return;
+    }
+
+    //Unfinished jobs go back to the front, in the order they were handed out
+    QList<cremotejob*> jobs = assigned.take(socket);
+    for (int i = jobs.length() - 1; i >= 0; i--) {
+        jobs.at(i)->state = JOB_QUEUED;
+        jobs.at(i)->worker = NULL;
+        queue.prepend(jobs.at(i));
+    }
+    if (!jobs.isEmpty()) {
+        QString name = names.value(socket);
+        workerStats[name].name = name;
+        workerStats[name].reassigned += jobs.length();
+        qWarning() << jobs.length() << "jobs of" << name << "reassigned";
+    }
+    if (threads.contains(socket)) {
+        qInfo() << "Remote worker" << names.value(socket) << "disconnected";
+    }
+
+    buffers.remove(socket);
+    lastSeen.remove(socket);
+    requests.remove(socket);
+    threads.remove(socket);
+    names.remove(socket);
+
+    socket->disconnect(this);
+    socket->abort();
+    socket->deleteLater();
+
+    //Local threads can take the jobs back, and other workers be waiting
+    changed.wakeAll();
+    emit jobQueued();
+}
+
+int CJobServer::remoteCapacity() {
+    QMutexLocker locker(&mutex);
+    //Twice the threads, so a worker has the next chunk by the time it's done
+    int capacity = 0;
+    foreach (int count, threads) {
+        capacity += count * 2;
+    }
+    return capacity;
+}
+
+void CJobServer::reset(int localThreads) {
+    QMutexLocker locker(&mutex);
+    //Called between batches, no local job holds a slot
+    localSlots.acquire(localSlots.available());
+    localSlots.release(qMax(1, localThreads));
+    this->localThreads = localThreads;
+    workerStats.clear();
+}
+
+cjobresult CJobServer::run(const cjob& job, std::function<cjobresult(const cjob&)> local) {
+    QMutexLocker locker(&mutex);
+
+    //Lives on this stack, the server only keeps a pointer while it's queued or assigned
+    cremotejob remote;
+    remote.id = nextId++;
+    remote.job = job;
+    remote.worker = NULL;
+    //Without workers it waits for a local CPU like any other
+    remote.state = JOB_QUEUED;
+    queue.append(&remote);
+    if (!threads.isEmpty()) {
+        emit jobQueued();
+    }
+
+    forever {
+        if (remote.state == JOB_DONE) {
+            locker.unlock();
+            cjobresult result = remote.result;
+            verifyRemote(job, &result);
+            return result;
+        }
+        if (remote.state == JOB_QUEUED && localSlots.tryAcquire()) {
+            queue.removeOne(&remote);
+            remote.state = JOB_LOCAL;
+            locker.unlock();
+
+            QElapsedTimer timer;
+            timer.start();
+            cjobresult result = local(job);
+
+            locker.relock();
+            localSlots.release();
+            addStats(tr("this computer"), job, result, timer.elapsed());
+            changed.wakeAll();
+            return result;
+        }
+        changed.wait(&mutex);
+    }
+}
+
+void CJobServer::addStats(QString name, const cjob& job, const cjobresult& result, qint64 busy) {
+    cworkerstats& stats = workerStats[name];
+    stats.name = name;
+    stats.files++;
+    stats.input += job.input.size();
+    stats.output += result.output.isEmpty() ? job.input.size() : result.output.size();
+    stats.busy += busy;
+}
+
+QStringList CJobServer::stats() {
+    QMutexLocker locker(&mutex);
+    QStringList lines;
+    foreach (cworkerstats stats, workerStats) {
+        QString line = stats.name + ": " + QString::number(stats.files) + " files, " +
+                toHumanSize(stats.input) + " to " + toHumanSize(stats.output) + " in " +
+                msToFormattedString(stats.busy) + " of work";
+        if (stats.reassigned > 0) {
+            line += ", " + QString::number(stats.reassigned) + " reassigned";
+        }
+        lines.append(line);
+    }
+    return lines;
+}
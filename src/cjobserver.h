@@ -0,0 +1,170 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef CJOBSERVER_H
+#define CJOBSERVER_H
+
+#include <QObject>
+#include <QThread>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHostAddress>
+#include <QTimer>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QSemaphore>
+#include <QHash>
+#include <QList>
+#include <QStringList>
+#include <QElapsedTimer>
+#include <functional>
+
+#include "cworker.h"
+
+//Command line switch starting a remote worker, followed by host:port
+#define REMOTE_ARGUMENT "--connect"
+
+/*
+ * Coordinator protocol, over TCP. Every message is a frame like the
+ * worker pipe ones: a big endian 32 bit length and a QDataStream
+ * payload starting with the quint8 message type.
+ *
+ * HELLO      worker -> coordinator  QString token, QString host, qint32 threads
+ * REQUEST    worker -> coordinator  qint64 byte budget
+ * CHUNK      coordinator -> worker  qint32 count, count times (quint64 id, cjob)
+ * RESULT     worker -> coordinator  quint64 id, cjobresult, qint64 busy ms
+ * HEARTBEAT  worker -> coordinator  nothing, at least every REMOTE_HEARTBEAT ms
+ *
+ * A REQUEST waits on the coordinator until there's work, so idle
+ * workers don't poll.
+ */
+#define REMOTE_HELLO 1
+#define REMOTE_REQUEST 2
+#define REMOTE_CHUNK 3
+#define REMOTE_RESULT 4
+#define REMOTE_HEARTBEAT 5
+
+#define JOB_QUEUED 0
+#define JOB_LOCAL 1
+#define JOB_REMOTE 2
+#define JOB_DONE 3
+
+#define REMOTE_HEARTBEAT_INTERVAL 5000
+//Silence after which the jobs of a worker go to somebody else
+#define REMOTE_TIMEOUT 30000
+//Input bytes a worker asks for per thread, a chunk has at least one job anyway
+#define REMOTE_CHUNK_BYTES (16 * 1024 * 1024)
+//Largest frame taken before the hello, a token and a host name fit in it
+#define REMOTE_MAX_HELLO 4096
+
+//Work done by one worker, the local threads included
+typedef struct {
+    QString name;
+    int files;
+    qint64 input;
+    qint64 output;
+    qint64 busy; //ms
+    int reassigned; //Jobs taken back after the worker died or went silent
+} cworkerstats;
+
+//A job on its way, owned by the compression thread waiting for it
+typedef struct {
+    quint64 id;
+    cjob job;
+    int state;
+    QTcpSocket* worker;
+    cjobresult result;
+} cremotejob;
+
+/*
+ * Serves the jobs of a batch to caesiumph processes on other machines,
+ * started with "--connect host:port". Compression threads hand their
+ * job over and wait: whoever is first, a remote worker or a free local
+ * CPU, runs it. The server lives in a thread of its own, so big
+ * transfers never stall the interface.
+ */
+class CJobServer : public QObject {
+    Q_OBJECT
+
+public:
+    static CJobServer* instance();
+
+    //port 0 stops serving; without a token only workers on this computer can connect
+    void configure(int port, QString token, bool sharedStorage);
+    bool isServing();
+
+    //Jobs the pool should keep in flight for the connected workers
+    int remoteCapacity();
+    //Starts a batch, local jobs never take more than localThreads CPUs
+    void reset(int localThreads);
+    //Runs the job on a worker or with local, whichever is free first; blocks until done
+    cjobresult run(const cjob& job, std::function<cjobresult(const cjob&)> local);
+    //One line per worker with what it did in this batch
+    QStringList stats();
+
+signals:
+    void jobQueued();
+
+private slots:
+    void startListening(int port);
+    void newConnection();
+    void readWorker();
+    void workerDisconnected();
+    void checkHeartbeats();
+    void serveRequests();
+
+private:
+    CJobServer();
+    ~CJobServer();
+
+    QThread thread;
+    QTcpServer* server;
+    QTimer* heartbeatTimer;
+
+    QMutex mutex;
+    QWaitCondition changed;
+    QSemaphore localSlots;
+    int localThreads;
+    QString token;
+    bool sharedStorage;
+    int port;
+    QHostAddress address; //LocalHost until a token is set
+    quint64 nextId;
+
+    QList<cremotejob*> queue;
+    //Per connection: bytes not parsed yet, last sign of life, budget asked, jobs held
+    QHash<QTcpSocket*, QByteArray> buffers;
+    QHash<QTcpSocket*, qint64> lastSeen;
+    QHash<QTcpSocket*, qint64> requests;
+    QHash<QTcpSocket*, QList<cremotejob*> > assigned;
+    QHash<QTcpSocket*, int> threads;
+    QHash<QTcpSocket*, QString> names;
+    QHash<QString, cworkerstats> workerStats;
+    QElapsedTimer clock;
+
+    void handleFrame(QTcpSocket* socket, const QByteArray& frame);
+    void releaseWorker(QTcpSocket* socket);
+    void addStats(QString name, const cjob& job, const cjobresult& result, qint64 busy);
+};
+
+#endif // CJOBSERVER_H
@@ -22,16 +22,157 @@
  */
 
 #include "cphlist.h"
+#include "ctreewidgetitem.h"
 #include "utils.h"
 
-#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QVector>
+#include <QtEndian>
 #include <QDebug>
 
-CPHList::CPHList() {
+#include <string.h>
 
+CPHList::CPHList() :
+    map(NULL),
+    mapSize(0),
+    itemCount(0),
+    stringCount(0),
+    stringIndex(NULL),
+    stringData(NULL),
+    stringDataSize(0),
+    records(NULL) {
+
+}
+
+CPHList::~CPHList() {
+    close();
 }
 
 QList<QTreeWidgetItem*> CPHList::readFile(QString path) {
+    QList<QTreeWidgetItem*> items;
+
+    //Version 1 files are plain text and start with the version number
+    if (!open(path)) {
+        return readLegacyFile(path);
+    }
+
+    items.reserve(itemCount);
+    for (quint32 i = 0; i < itemCount; i++) {
+        items.append(item(records + (quint64) i * CLF_RECORD_SIZE));
+    }
+    close();
+    return items;
+}
+
+bool CPHList::open(QString path) {
+    close();
+    file.setFileName(path);
+
+    if (!file.open(QIODevice::ReadOnly)) {
+        qCritical() << "Failed to open CPHLF at path: " << path;
+        return false;
+    }
+
+    mapSize = file.size();
+    if (mapSize < CLF_HEADER_SIZE) {
+        close();
+        return false;
+    }
+
+    map = file.map(0, mapSize);
+    if (map == NULL || memcmp(map, CLF_MAGIC, CLF_MAGIC_LENGTH) != 0) {
+        close();
+        return false;
+    }
+
+    quint16 version = qFromLittleEndian<quint16>(map + 6);
+    if (version > CLF_VERSION) {
+        qCritical() << "CPHLF version" << version << "is newer than the supported one";
+        close();
+        return false;
+    }
+
+    itemCount = qFromLittleEndian<quint32>(map + 8);
+    stringCount = qFromLittleEndian<quint32>(map + 12);
+    quint64 indexOffset = qFromLittleEndian<quint64>(map + 16);
+    quint64 dataOffset = qFromLittleEndian<quint64>(map + 24);
+    quint64 recordsOffset = qFromLittleEndian<quint64>(map + 32);
+
+    //Check every section lies inside the file before trusting the offsets
+    quint64 size = (quint64) mapSize;
+    if (indexOffset > size || (size - indexOffset) / 4 < (quint64) stringCount + 1 ||
+            dataOffset > size ||
+            recordsOffset > size || (size - recordsOffset) / CLF_RECORD_SIZE < itemCount) {
+        qCritical() << "Malformed CPHLF at path: " << path;
+        close();
+        return false;
+    }
+
+    stringIndex = map + indexOffset;
+    stringData = map + dataOffset;
+    stringDataSize = qFromLittleEndian<quint32>(stringIndex + stringCount * 4);
+    records = map + recordsOffset;
+
+    if (stringDataSize > size - dataOffset) {
+        qCritical() << "Malformed CPHLF at path: " << path;
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void CPHList::close() {
+    if (map != NULL) {
+        file.unmap(map);
+    }
+    if (file.isOpen()) {
+        file.close();
+    }
+    map = NULL;
+    mapSize = 0;
+    itemCount = stringCount = 0;
+    stringIndex = stringData = records = NULL;
+    stringDataSize = 0;
+}
+
+QString CPHList::string(quint32 index) const {
+    if (index >= stringCount) {
+        return QString();
+    }
+    quint32 start = qFromLittleEndian<quint32>(stringIndex + index * 4);
+    quint32 end = qFromLittleEndian<quint32>(stringIndex + (index + 1) * 4);
+    if (start > end || end > stringDataSize) {
+        return QString();
+    }
+    return QString::fromUtf8((const char*) stringData + start, end - start);
+}
+
+QTreeWidgetItem* CPHList::item(const uchar* record) const {
+    //Folders are stored with their trailing '/'
+    QString folder = string(qFromLittleEndian<quint32>(record));
+    QString fileName = string(qFromLittleEndian<quint32>(record + 4));
+    qint64 original = qFromLittleEndian<qint64>(record + 8);
+    qint64 compressed = qFromLittleEndian<qint64>(record + 16);
+
+    //Same columns the import fills, plus the results if any
+    QStringList columns = QStringList() << fileName.left(fileName.lastIndexOf('.'))
+                                        << toHumanSize(original)
+                                        << (compressed < 0 ? "" : toHumanSize(compressed))
+                                        << (compressed < 0 ? "" : getRatio(original, compressed))
+                                        << folder + fileName;
+
+    QTreeWidgetItem* treeItem = new CTreeWidgetItem(NULL, columns);
+    treeItem->setData(COLUMN_NAME, ROLE_STATUS, (int) qFromLittleEndian<quint32>(record + 24));
+    treeItem->setData(COLUMN_ORIGINAL_SIZE, ROLE_SIZE, original);
+    if (compressed >= 0) {
+        treeItem->setData(COLUMN_NEW_SIZE, ROLE_SIZE, compressed);
+    }
+    return treeItem;
+}
+
+QList<QTreeWidgetItem*> CPHList::readLegacyFile(QString path) {
     //Create a QFile to perform some checks
     QFile in(path);
     //And the container list
@@ -41,9 +182,9 @@ QList<QTreeWidgetItem*> CPHList::readFile(QString path) {
         //TODO it does not check if the file is poorly written
         //First line is the file version number
         int version = QString(in.readLine()).split("\n").at(0).toInt();
-        //If version is lesser than the current, perform version update
-        if (version < CLF_VERSION) {
-            //TODO Implement version update according to the future <3
+        if (version != 1) {
+            qCritical() << "Unknown CPHLF version at path: " << path;
+            return items;
         }
 
         //Second line is the column count
@@ -62,7 +203,7 @@ QList<QTreeWidgetItem*> CPHList::readFile(QString path) {
                 buffer.append(QString(in.readLine()).split("\n").at(0));
             }
             //Add the compiled specs to the Items list
-            items.append(new QTreeWidgetItem(buffer));
+            items.append(new CTreeWidgetItem(NULL, buffer));
         }
         //CLose the file
         in.close();
@@ -72,30 +213,88 @@ QList<QTreeWidgetItem*> CPHList::readFile(QString path) {
     return items;
 }
 
+static void appendLE32(QByteArray* buffer, quint32 value) {
+    uchar bytes[4];
+    qToLittleEndian<quint32>(value, bytes);
+    buffer->append((const char*) bytes, 4);
+}
+
+static void appendLE64(QByteArray* buffer, quint64 value) {
+    uchar bytes[8];
+    qToLittleEndian<quint64>(value, bytes);
+    buffer->append((const char*) bytes, 8);
+}
+
 void CPHList::writeToFile(QList<QTreeWidgetItem *> list, QString path) {
     //Create a QFile to perform some checks
     QFile out(path);
 
-    if (out.open(QIODevice::WriteOnly)) {
-        //Fisrt line is the version number
-        out.write(QByteArray::number(CLF_VERSION) + "\n");
+    if (!out.open(QIODevice::WriteOnly)) {
+        qCritical() << "Failed to write CPHLF at path: " << path;
+        return;
+    }
 
-        //Second is the columns number
-        out.write(QByteArray::number(MAX_COLUMNS) + "\n");
+    //Folders are stored once and shared by every file inside them
+    QHash<QString, quint32> folders;
+    QByteArray stringData;
+    QVector<quint32> stringOffsets;
+    QByteArray records;
+    records.reserve(list.length() * CLF_RECORD_SIZE);
 
-        //Third is the item count
-        out.write(QByteArray::number(list.length()) + "\n");
+    for (int i = 0; i < list.length(); i++) {
+        QTreeWidgetItem* item = list.at(i);
+        QString fullPath = item->text(COLUMN_PATH);
+        //Bare names have no folder, -1 + 1 keeps the whole of them as the name
+        int separator = fullPath.lastIndexOf('/');
+        QString folder = fullPath.left(separator + 1);
 
-        //Then we can write the lines
-        for (int i = 0; i < list.length(); i++) {
-            for (int j = 0; j < MAX_COLUMNS; j++) {
-                out.write(list.at(i)->text(j).toUtf8() + "\n");
-            }
+        if (!folders.contains(folder)) {
+            folders.insert(folder, stringOffsets.size());
+            stringOffsets.append(stringData.size());
+            stringData.append(folder.toUtf8());
         }
-        //CLose the file
-        out.close();
-    } else {
-        qCritical() << "Failed to write CPHLF at path: " << path;
-        return;
+        quint32 nameIndex = stringOffsets.size();
+        stringOffsets.append(stringData.size());
+        stringData.append(fullPath.mid(separator + 1).toUtf8());
+
+        //Lists loaded from version 1 files carry text only
+        QVariant original = item->data(COLUMN_ORIGINAL_SIZE, ROLE_SIZE);
+        QVariant compressed = item->data(COLUMN_NEW_SIZE, ROLE_SIZE);
+
+        appendLE32(&records, folders.value(folder));
+        appendLE32(&records, nameIndex);
+        appendLE64(&records, original.isValid() ? original.toLongLong() : QFileInfo(fullPath).size());
+        appendLE64(&records, compressed.isValid() ? compressed.toLongLong() : -1);
+        appendLE32(&records, item->data(COLUMN_NAME, ROLE_STATUS).toInt());
+        appendLE32(&records, 0);
     }
+    stringOffsets.append(stringData.size());
+
+    //Sections follow the header in order: index, strings, records
+    quint64 indexOffset = CLF_HEADER_SIZE;
+    quint64 dataOffset = indexOffset + stringOffsets.size() * 4;
+    quint64 recordsOffset = dataOffset + stringData.size();
+
+    QByteArray header(CLF_MAGIC, CLF_MAGIC_LENGTH);
+    uchar version[2];
+    qToLittleEndian<quint16>(CLF_VERSION, version);
+    header.append((const char*) version, 2);
+    appendLE32(&header, list.length());
+    appendLE32(&header, stringOffsets.size() - 1);
+    appendLE64(&header, indexOffset);
+    appendLE64(&header, dataOffset);
+    appendLE64(&header, recordsOffset);
+
+    QByteArray index;
+    index.reserve(stringOffsets.size() * 4);
+    foreach (quint32 offset, stringOffsets) {
+        appendLE32(&index, offset);
+    }
+
+    out.write(header);
+    out.write(index);
+    out.write(stringData);
+    out.write(records);
+    //CLose the file
+    out.close();
 }
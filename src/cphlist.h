@@ -27,15 +27,53 @@
 #include <QString>
 #include <QStringList>
 #include <QByteArray>
+#include <QFile>
 #include <QTreeWidgetItem>
 
-#define CLF_VERSION 1
+#define CLF_VERSION 2
+
+/*
+ * Version 2 layout, all integers little endian:
+ *
+ * header       magic "CPHLF\0", u16 version, u32 item count, u32 string count,
+ *              u64 offsets of the string index, string data and records
+ * string index (string count + 1) u32 offsets into the string data
+ * string data  UTF-8 folders and file names, folders are shared
+ * records      per item u32 folder string, u32 name string,
+ *              i64 original size, i64 compressed size (-1 if none),
+ *              u32 status, u32 reserved
+ *
+ * Folders end with '/' and are empty for bare file names. The file is
+ * memory mapped and the records are decoded in one pass, no text parsing.
+ */
+#define CLF_MAGIC "CPHLF\0"
+#define CLF_MAGIC_LENGTH 6
+#define CLF_HEADER_SIZE 40
+#define CLF_RECORD_SIZE 32
 
 class CPHList {
 public:
     CPHList();
+    ~CPHList();
     QList<QTreeWidgetItem *> readFile(QString path);
     void writeToFile(QList<QTreeWidgetItem *> list, QString path);
+
+private:
+    QFile file;
+    uchar* map;
+    qint64 mapSize;
+    quint32 itemCount;
+    quint32 stringCount;
+    const uchar* stringIndex;
+    const uchar* stringData;
+    quint64 stringDataSize;
+    const uchar* records;
+
+    bool open(QString path);
+    void close();
+    QString string(quint32 index) const;
+    QTreeWidgetItem* item(const uchar* record) const;
+    QList<QTreeWidgetItem *> readLegacyFile(QString path);
 };
 
 #endif // CLIST_H
@@ -0,0 +1,151 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#include "cpipe.h"
+#include "cworker.h"
+#include "preferencedialog.h"
+#include "utils.h"
+
+#include <QFile>
+#include <QDebug>
+
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+static void usage() {
+    qCritical() << "Usage: caesiumph" << PIPE_ARGUMENT << "[--progressive | --baseline | --auto] [--effort fast|default|max]"
+                << "[--arithmetic | --huffman]"
+                << "[--exif none|all|copyright,date,comment] [--thumbnail keep|optimize|drop]";
+}
+
+int runPipe(QStringList arguments) {
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    readParams();
+
+    //The command line goes over the preferences
+    unsigned int thumbnail = params.markers & (CCLT_THUMBNAIL_OPTIMIZE | CCLT_THUMBNAIL_DROP);
+    for (int i = arguments.indexOf(PIPE_ARGUMENT) + 1; i < arguments.length(); i++) {
+        QString argument = arguments.at(i);
+        QString value = arguments.value(i + 1);
+        if (argument == "--progressive") {
+            params.progressive = CCLT_SCANS_PROGRESSIVE;
+        } else if (argument == "--baseline") {
+            params.progressive = CCLT_SCANS_BASELINE;
+        } else if (argument == "--auto") {
+            params.progressive = CCLT_SCANS_AUTO;
+        } else if (argument == "--arithmetic" || argument == "--huffman") {
+            if (argument == "--arithmetic" && !cclt_arithmetic_supported()) {
+                qCritical() << "This build can't write arithmetic coding";
+                return 1;
+            }
+            params.arithmetic = argument == "--arithmetic";
+        } else if (argument == "--effort" && !value.isEmpty()) {
+            QStringList efforts = QStringList() << "fast" << "default" << "max";
+            if (!efforts.contains(value)) {
+                usage();
+                return 1;
+            }
+            params.effort = efforts.indexOf(value);
+            i++;
+        } else if (argument == "--exif" && !value.isEmpty()) {
+            params.importantExifs.clear();
+            if (value == "all") {
+                params.exif = 2;
+            } else {
+                //Same as the preferences: nothing, or only the listed tags
+                params.exif = value == "none" ? 0 : 1;
+                foreach (QString tag, value.split(',', QString::SkipEmptyParts)) {
+                    if (tag == "copyright") {
+                        params.importantExifs.append(EXIF_COPYRIGHT);
+                    } else if (tag == "date") {
+                        params.importantExifs.append(EXIF_DATE);
+                    } else if (tag == "comment") {
+                        params.importantExifs.append(EXIF_COMMENTS);
+                    } else if (tag != "none") {
+                        usage();
+                        return 1;
+                    }
+                }
+            }
+            i++;
+        } else if (argument == "--thumbnail" && !value.isEmpty()) {
+            if (value == "keep") {
+                thumbnail = 0;
+            } else if (value == "optimize") {
+                thumbnail = CCLT_THUMBNAIL_OPTIMIZE;
+            } else if (value == "drop") {
+                thumbnail = CCLT_THUMBNAIL_DROP;
+            } else {
+                usage();
+                return 1;
+            }
+            i++;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    params.markers &= ~(CCLT_KEEP(CCLT_MARKER_EXIF) | CCLT_THUMBNAIL_OPTIMIZE | CCLT_THUMBNAIL_DROP);
+    if (params.exif == 2) {
+        params.markers |= CCLT_KEEP(CCLT_MARKER_EXIF) | thumbnail;
+    }
+
+    QFile in;
+    QByteArray input;
+    if (in.open(stdin, QIODevice::ReadOnly)) {
+        input = in.readAll();
+    }
+    if (input.isEmpty()) {
+        qCritical() << "Nothing to read on stdin";
+        return 1;
+    }
+
+    cjobresult result = runJob(makeJob(input));
+    if (result.result < 0) {
+        qCritical() << (result.result == CCLT_CORRUPT ? "Damaged image data:" : "Not a valid JPEG:") << result.message;
+        return 1;
+    }
+    if (!result.message.isEmpty()) {
+        qWarning() << result.message;
+    }
+
+    //Pipelines always get an image, the original if there's no safe gain
+    bool optimized = (CCLT_MUST_REPLACE(result.result) ||
+                      (result.result == CCLT_OK && result.output.size() < input.size())) && result.verified;
+    const QByteArray& output = optimized ? result.output : input;
+
+    QFile out;
+    if (!out.open(stdout, QIODevice::WriteOnly) || out.write(output) != output.size() || !out.flush()) {
+        qCritical() << "Cannot write to stdout";
+        return 1;
+    }
+    return 0;
+}
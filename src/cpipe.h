@@ -0,0 +1,45 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef CPIPE_H
+#define CPIPE_H
+
+#include <QStringList>
+
+//Command line argument for the pipe mode, in place of a file
+#define PIPE_ARGUMENT "-"
+
+/*
+ * Filter for shell pipelines:
+ *
+ *   caesiumph - [--progressive | --baseline | --auto] [--effort fast|default|max] [--arithmetic | --huffman]
+ *               [--exif none|all|copyright,date,comment] [--thumbnail keep|optimize|drop] < in.jpg > out.jpg
+ *
+ * Options default to the saved preferences. The optimized image goes to
+ * stdout, or the input unchanged if it can't be made smaller; nothing is
+ * written and the exit code is 1 if the input is not a usable JPEG.
+ * Arithmetic coded inputs always come out as Huffman unless --arithmetic.
+ */
+int runPipe(QStringList arguments);
+
+#endif // CPIPE_H
@@ -0,0 +1,130 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#include "cprefetcher.h"
+#include "ciouring.h"
+#include "cioscheduler.h"
+#include "ctrace.h"
+#include "ccompressionpool.h"
+
+#include <QMutexLocker>
+#include <QDebug>
+
+#include <algorithm>
+
+CPrefetcher::CPrefetcher(QStringList paths, qint64 budget) :
+    paths(paths),
+    budget(budget),
+    bytes(0),
+    stopped(false) {
+    pending = paths.toSet();
+}
+
+CPrefetcher::~CPrefetcher() {
+    stop();
+    wait();
+}
+
+void CPrefetcher::run() {
+    //Same CPUs and priority as the workers it feeds
+    CCompressionPool::instance()->setupCurrentThread();
+    CIOUring ring;
+
+    for (int i = 0; i < paths.length() && ring.isValid(); i += IO_URING_BATCH) {
+        QStringList batch = paths.mid(i, IO_URING_BATCH);
+
+        //Wait for the workers to catch up, one batch always fits
+        {
+            QMutexLocker locker(&mutex);
+            while (!stopped && bytes >= budget && !loaded.isEmpty()) {
+                spaceCondition.wait(&mutex);
+            }
+            if (stopped) {
+                return;
+            }
+        }
+
+        //A batch counts as a single I/O job on every device it touches
+        QList<quint64> devices;
+        foreach (QString path, batch) {
+            quint64 device = CIOScheduler::instance()->device(path);
+            if (!devices.contains(device)) {
+                devices.append(device);
+            }
+        }
+        std::sort(devices.begin(), devices.end());
+        foreach (quint64 device, devices) {
+            CIOScheduler::instance()->acquire(device);
+        }
+        QList<QByteArray> contents;
+        {
+            CTraceScope trace("prefetch");
+            trace.setArg("files", batch.length());
+            contents = ring.readFiles(batch);
+        }
+        foreach (quint64 device, devices) {
+            CIOScheduler::instance()->release(device);
+        }
+
+        QMutexLocker locker(&mutex);
+        if (stopped) {
+            return;
+        }
+        for (int j = 0; j < batch.length(); j++) {
+            //Failed reads stay null, the worker retries them on its own
+            loaded.insert(batch.at(j), contents.at(j));
+            pending.remove(batch.at(j));
+            bytes += contents.at(j).size();
+        }
+        loadedCondition.wakeAll();
+    }
+
+    //Whatever is left gets read by the workers
+    QMutexLocker locker(&mutex);
+    pending.clear();
+    loadedCondition.wakeAll();
+}
+
+bool CPrefetcher::take(QString path, QByteArray* data) {
+    QMutexLocker locker(&mutex);
+    while (!stopped && !loaded.contains(path) && pending.contains(path)) {
+        loadedCondition.wait(&mutex);
+    }
+    if (!loaded.contains(path)) {
+        return false;
+    }
+    *data = loaded.take(path);
+    bytes -= data->size();
+    spaceCondition.wakeAll();
+    return !data->isNull();
+}
+
+void CPrefetcher::stop() {
+    QMutexLocker locker(&mutex);
+    stopped = true;
+    pending.clear();
+    loaded.clear();
+    bytes = 0;
+    loadedCondition.wakeAll();
+    spaceCondition.wakeAll();
+}
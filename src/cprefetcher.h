@@ -0,0 +1,68 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef CPREFETCHER_H
+#define CPREFETCHER_H
+
+#include <QThread>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+#include <QMutex>
+#include <QWaitCondition>
+
+//Bytes read ahead of the workers at most
+#define PREFETCH_BUDGET (64 * 1024 * 1024)
+
+/*
+ * Reads the inputs ahead of the workers, in list order, with
+ * batched io_uring submissions. Workers pick their file up with
+ * take() and read it themselves when it isn't available.
+ */
+class CPrefetcher : public QThread {
+public:
+    CPrefetcher(QStringList paths, qint64 budget = PREFETCH_BUDGET);
+    ~CPrefetcher();
+
+    //Waits for path if it's still to be read, false if the caller has to read it
+    bool take(QString path, QByteArray* data);
+    void stop();
+
+protected:
+    void run();
+
+private:
+    QStringList paths;
+    qint64 budget;
+    qint64 bytes;
+    bool stopped;
+    QHash<QString, QByteArray> loaded;
+    QSet<QString> pending;
+    QMutex mutex;
+    QWaitCondition loadedCondition;
+    QWaitCondition spaceCondition;
+};
+
+#endif // CPREFETCHER_H
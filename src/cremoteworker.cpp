@@ -0,0 +1,208 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#include "cremoteworker.h"
+#include "cjobserver.h"
+#include "cworker.h"
+
+#include <QTcpSocket>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QHostInfo>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QDataStream>
+#include <QPair>
+#include <QThread>
+#include <QDebug>
+
+//Results waiting to be sent, filled by the job threads
+typedef struct {
+    QMutex mutex;
+    QList<QByteArray> frames;
+} cremoteresults;
+
+class CRemoteJobRunnable : public QRunnable {
+public:
+    CRemoteJobRunnable(quint64 id, cjob job, cremoteresults* results) :
+        id(id),
+        job(job),
+        results(results) {
+
+    }
+
+    void run() {
+        QElapsedTimer timer;
+        timer.start();
+        cjobresult result = runJob(job);
+
+        QByteArray payload;
+        QDataStream out(&payload, QIODevice::WriteOnly);
+        out << (quint8) REMOTE_RESULT << id << result << (qint64) timer.elapsed();
+
+        QMutexLocker locker(&results->mutex);
+        results->frames.append(makeFrame(payload));
+    }
+
+private:
+    quint64 id;
+    cjob job;
+    cremoteresults* results;
+};
+
+static bool sendMessage(QTcpSocket* socket, const QByteArray& payload) {
+    if (socket->write(makeFrame(payload)) < 0) {
+        return false;
+    }
+    socket->flush();
+    return true;
+}
+
+//One connection, until it drops
+static void serveCoordinator(QTcpSocket* socket, QString token, int threads, QPair<QString, QString> map) {
+    QThreadPool pool;
+    pool.setMaxThreadCount(threads);
+    cremoteresults results;
+    QByteArray buffer;
+    int running = 0;
+    bool requested = false;
+
+    QByteArray hello;
+    QDataStream helloStream(&hello, QIODevice::WriteOnly);
+    helloStream << (quint8) REMOTE_HELLO << token << QHostInfo::localHostName() << (qint32) threads;
+    sendMessage(socket, hello);
+
+    QElapsedTimer heartbeat;
+    heartbeat.start();
+
+    while (socket->state() == QAbstractSocket::ConnectedState) {
+        //Ask for more as soon as a thread could go idle, the request waits there for work
+        if (!requested && running < threads) {
+            QByteArray request;
+            QDataStream out(&request, QIODevice::WriteOnly);
+            out << (quint8) REMOTE_REQUEST << (qint64) (threads - running) * REMOTE_CHUNK_BYTES;
+            sendMessage(socket, request);
+            requested = true;
+            heartbeat.restart();
+        }
+
+        QList<QByteArray> frames;
+        {
+            QMutexLocker locker(&results.mutex);
+            frames.swap(results.frames);
+        }
+        foreach (QByteArray frame, frames) {
+            socket->write(frame);
+            running--;
+            heartbeat.restart();
+        }
+        if (!frames.isEmpty()) {
+            socket->flush();
+        }
+
+        //Busy threads don't talk, the coordinator still has to know we're alive
+        if (heartbeat.elapsed() > REMOTE_HEARTBEAT_INTERVAL / 2) {
+            QByteArray ping;
+            QDataStream out(&ping, QIODevice::WriteOnly);
+            out << (quint8) REMOTE_HEARTBEAT;
+            sendMessage(socket, ping);
+            heartbeat.restart();
+        }
+
+        if (!socket->waitForReadyRead(50) && socket->state() != QAbstractSocket::ConnectedState) {
+            break;
+        }
+        buffer.append(socket->readAll());
+
+        QByteArray frame;
+        int taken;
+        while ((taken = takeFrame(&buffer, &frame)) == 1) {
+            QDataStream in(frame);
+            quint8 type;
+            qint32 count;
+            in >> type >> count;
+            if (type != REMOTE_CHUNK) {
+                continue;
+            }
+            for (int i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+                quint64 id;
+                cjob job;
+                in >> id >> job;
+                if (!map.first.isEmpty() && job.path.startsWith(map.first)) {
+                    job.path = map.second + job.path.mid(map.first.length());
+                }
+                pool.start(new CRemoteJobRunnable(id, job, &results));
+                running++;
+            }
+            requested = false;
+        }
+        if (taken < 0) {
+            qCritical() << "Malformed message from the coordinator";
+            socket->abort();
+        }
+    }
+
+    //The coordinator gives these jobs to somebody else
+    pool.waitForDone();
+}
+
+int runRemoteWorker(QStringList arguments) {
+    QString address = arguments.value(arguments.indexOf(REMOTE_ARGUMENT) + 1);
+    int separator = address.lastIndexOf(':');
+    QString host = address.left(separator);
+    quint16 port = address.mid(separator + 1).toUShort();
+    if (separator <= 0 || port == 0) {
+        qCritical() << "Usage: caesiumph" << REMOTE_ARGUMENT << "host:port [--threads N] [--token T] [--map FROM=TO]";
+        return 1;
+    }
+
+    int threads = QThread::idealThreadCount();
+    QString token;
+    QPair<QString, QString> map;
+    for (int i = 0; i < arguments.length() - 1; i++) {
+        if (arguments.at(i) == "--threads") {
+            threads = qMax(1, arguments.at(i + 1).toInt());
+        } else if (arguments.at(i) == "--token") {
+            token = arguments.at(i + 1);
+        } else if (arguments.at(i) == "--map") {
+            QString rule = arguments.at(i + 1);
+            map.first = rule.section('=', 0, 0);
+            map.second = rule.section('=', 1);
+        }
+    }
+
+    forever {
+        QTcpSocket socket;
+        socket.connectToHost(host, port);
+        if (socket.waitForConnected(10000)) {
+            qInfo() << "Connected to" << address << "with" << threads << "threads";
+            serveCoordinator(&socket, token, threads, map);
+            qInfo() << "Disconnected from" << address;
+        } else {
+            qWarning() << "Cannot reach" << address << ":" << socket.errorString();
+        }
+        QThread::sleep(5);
+    }
+    return 0;
+}
@@ -0,0 +1,40 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef CREMOTEWORKER_H
+#define CREMOTEWORKER_H
+
+#include <QStringList>
+
+/*
+ * Headless worker serving a coordinator on another machine:
+ *
+ *   caesiumph --connect host:port [--threads N] [--token T] [--map FROM=TO]
+ *
+ * --map rewrites the start of the paths of shared storage jobs, for
+ * volumes mounted elsewhere than on the coordinator. The worker
+ * reconnects on its own and only stops when killed.
+ */
+int runRemoteWorker(QStringList arguments);
+
+#endif // CREMOTEWORKER_H
@@ -0,0 +1,61 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#include "cresultqueue.h"
+
+CResultQueue::CResultQueue() :
+    head(NULL) {
+
+}
+
+CResultQueue::~CResultQueue() {
+    citemresult* result = takeAll();
+    while (result != NULL) {
+        citemresult* next = result->next;
+        delete result;
+        result = next;
+    }
+}
+
+void CResultQueue::push(citemresult* result) {
+    //Treiber stack: only the head changes hands, the consumer never pops single nodes so there's no ABA
+    citemresult* first;
+    do {
+        first = head.loadAcquire();
+        result->next = first;
+    } while (!head.testAndSetRelease(first, result));
+}
+
+citemresult* CResultQueue::takeAll() {
+    citemresult* taken = head.fetchAndStoreAcquire(NULL);
+
+    //Turned around into push order, a later result for the same item wins
+    citemresult* ordered = NULL;
+    while (taken != NULL) {
+        citemresult* next = taken->next;
+        taken->next = ordered;
+        ordered = taken;
+        taken = next;
+    }
+    return ordered;
+}
@@ -0,0 +1,60 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef CRESULTQUEUE_H
+#define CRESULTQUEUE_H
+
+#include <QAtomicPointer>
+#include <QString>
+
+//What a worker found out about one file, applied to its list item on the GUI thread
+typedef struct citemresult {
+    quint64 id; //Of the batch file, the item may be gone by the time it's applied
+    QString path;
+    int status = -1; //item_status, -1 leaves it as it is
+    QString toolTip; //Replaces the reason of an earlier failure, if any
+    qint64 originalSize = 0;
+    qint64 outputSize = 0;
+    citemresult* next = NULL;
+} citemresult;
+
+/*
+ * Workers hand their results to the GUI thread through here. Any number
+ * of threads push without ever blocking, a single consumer takes
+ * everything pushed so far at once, so it can be applied in one go.
+ */
+class CResultQueue {
+public:
+    CResultQueue();
+    ~CResultQueue();
+
+    //Any thread, takes ownership of result
+    void push(citemresult* result);
+    //Consumer thread only: the results in push order, linked by next, the caller deletes them
+    citemresult* takeAll();
+
+private:
+    QAtomicPointer<citemresult> head; //Newest first
+};
+
+#endif // CRESULTQUEUE_H
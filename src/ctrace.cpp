@@ -0,0 +1,157 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#include "ctrace.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QMutexLocker>
+#include <QDebug>
+
+//Small sequential ids read better than thread handles in the viewer
+static QAtomicInt threadCounter;
+static thread_local int threadIndex = 0;
+
+static int currentThreadIndex() {
+    if (threadIndex == 0) {
+        threadIndex = threadCounter.fetchAndAddRelaxed(1) + 1;
+    }
+    return threadIndex;
+}
+
+CTrace::CTrace() :
+    epoch(0) {
+    clock.start();
+}
+
+CTrace* CTrace::instance() {
+    static CTrace trace;
+    return &trace;
+}
+
+void CTrace::start() {
+    QMutexLocker locker(&mutex);
+    spans.clear();
+    epoch.storeRelease(clock.nsecsElapsed());
+    enabled.storeRelease(1);
+}
+
+void CTrace::stop() {
+    enabled.storeRelease(0);
+}
+
+bool CTrace::isEnabled() const {
+    return enabled.loadAcquire() != 0;
+}
+
+qint64 CTrace::now() const {
+    return (clock.nsecsElapsed() - epoch.loadAcquire()) / 1000;
+}
+
+void CTrace::addSpan(const char* name, const char* category, qint64 start, qint64 duration, const QVariantMap& args) {
+    span s;
+    s.name = name;
+    s.category = category;
+    s.tid = currentThreadIndex();
+    s.start = start;
+    s.duration = duration;
+    s.args = args;
+
+    QMutexLocker locker(&mutex);
+    spans.append(s);
+}
+
+bool CTrace::writeToFile(QString path) {
+    QMutexLocker locker(&mutex);
+    QJsonArray events;
+    QList<int> namedThreads;
+
+    foreach (span s, spans) {
+        //Metadata event naming the thread, once per thread
+        if (!namedThreads.contains(s.tid)) {
+            QJsonObject meta;
+            meta["name"] = "thread_name";
+            meta["ph"] = "M";
+            meta["pid"] = 1;
+            meta["tid"] = s.tid;
+            meta["args"] = QJsonObject {{"name", "thread " + QString::number(s.tid)}};
+            events.append(meta);
+            namedThreads.append(s.tid);
+        }
+
+        QJsonObject event;
+        event["name"] = s.name;
+        event["cat"] = s.category;
+        event["ph"] = "X";
+        event["pid"] = 1;
+        event["tid"] = s.tid;
+        event["ts"] = s.start;
+        event["dur"] = s.duration;
+        if (!s.args.isEmpty()) {
+            event["args"] = QJsonObject::fromVariantMap(s.args);
+        }
+        events.append(event);
+    }
+
+    QJsonObject root;
+    root["traceEvents"] = events;
+    root["displayTimeUnit"] = "ms";
+
+    QDir().mkpath(QFileInfo(path).path());
+    QFile out(path);
+    if (!out.open(QIODevice::WriteOnly)) {
+        qCritical() << "Failed to write trace at path: " << path;
+        return false;
+    }
+    out.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+    out.close();
+    qInfo() << "Trace of" << spans.length() << "spans written to" << path;
+    return true;
+}
+
+CTraceScope::CTraceScope(const char* name, const char* category) :
+    name(name),
+    category(category),
+    start(-1) {
+    if (CTrace::instance()->isEnabled()) {
+        start = CTrace::instance()->now();
+    }
+}
+
+CTraceScope::~CTraceScope() {
+    //Tracing was off when the scope opened
+    if (start < 0 || !CTrace::instance()->isEnabled()) {
+        return;
+    }
+    CTrace::instance()->addSpan(name, category, start, CTrace::instance()->now() - start, args);
+}
+
+void CTraceScope::setArg(const char* key, const QVariant& value) {
+    if (start >= 0) {
+        args.insert(key, value);
+    }
+}
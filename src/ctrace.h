@@ -0,0 +1,85 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef CTRACE_H
+#define CTRACE_H
+
+#include <QString>
+#include <QList>
+#include <QVariantMap>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <QAtomicInt>
+
+/*
+ * Records per-thread spans of a compression run and dumps them
+ * as Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev)
+ */
+class CTrace {
+public:
+    static CTrace* instance();
+
+    void start();
+    void stop();
+    bool isEnabled() const;
+
+    //Microseconds since start()
+    qint64 now() const;
+    void addSpan(const char* name, const char* category, qint64 start, qint64 duration, const QVariantMap& args);
+    bool writeToFile(QString path);
+
+private:
+    CTrace();
+
+    typedef struct {
+        const char* name;
+        const char* category;
+        int tid;
+        qint64 start;
+        qint64 duration;
+        QVariantMap args;
+    } span;
+
+    QMutex mutex;
+    QList<span> spans;
+    QElapsedTimer clock; //Started once and never restarted, workers read it without locking
+    QAtomicInteger<qint64> epoch; //Nanoseconds of clock at start()
+    QAtomicInt enabled;
+};
+
+//Adds a span to the trace covering the lifetime of the object
+class CTraceScope {
+public:
+    CTraceScope(const char* name, const char* category = "stage");
+    ~CTraceScope();
+
+    void setArg(const char* key, const QVariant& value);
+
+private:
+    const char* name;
+    const char* category;
+    qint64 start;
+    QVariantMap args;
+};
+
+#endif // CTRACE_H
@@ -0,0 +1,251 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#include "cworker.h"
+#include "inspect.h"
+#include "exif.h"
+#include "transform.h"
+#include "ctrace.h"
+
+#include <QFile>
+#include <QtEndian>
+#include <QVector>
+#include <QDebug>
+
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+QDataStream& operator<<(QDataStream& out, const cjob& job) {
+    QList<qint32> exifs;
+    foreach (cexifs exif, job.importantExifs) {
+        exifs.append(exif);
+    }
+    return out << job.input << (quint32) job.markers << (qint32) job.progressive << (qint32) job.orientation
+               << job.writeExifs << exifs << job.verify << job.path
+               << (qint32) job.effort << (qint32) job.scanBudget << job.scanScripts << job.arithmetic;
+}
+
+QDataStream& operator>>(QDataStream& in, cjob& job) {
+    quint32 markers;
+    qint32 progressive, orientation, effort, scanBudget;
+    QList<qint32> exifs;
+    in >> job.input >> markers >> progressive >> orientation >> job.writeExifs >> exifs >> job.verify >> job.path
+       >> effort >> scanBudget >> job.scanScripts >> job.arithmetic;
+    job.effort = effort;
+    job.scanBudget = scanBudget;
+    job.markers = markers;
+    job.progressive = progressive;
+    job.orientation = orientation;
+    job.importantExifs.clear();
+    foreach (qint32 exif, exifs) {
+        job.importantExifs.append((cexifs) exif);
+    }
+    return in;
+}
+
+QDataStream& operator<<(QDataStream& out, const cjobresult& result) {
+    out << (qint32) result.result << result.output << result.message << result.verified << (qint32) result.progressive
+        << result.inputArithmetic << result.arithmetic;
+    for (int i = 0; i < CCLT_MARKER_CLASSES; i++) {
+        out << (quint64) result.markers.kept[i] << (quint64) result.markers.dropped[i];
+    }
+    return out;
+}
+
+QDataStream& operator>>(QDataStream& in, cjobresult& result) {
+    qint32 code, progressive;
+    in >> code >> result.output >> result.message >> result.verified >> progressive
+       >> result.inputArithmetic >> result.arithmetic;
+    result.result = code;
+    result.progressive = progressive;
+    for (int i = 0; i < CCLT_MARKER_CLASSES; i++) {
+        quint64 kept, dropped;
+        in >> kept >> dropped;
+        result.markers.kept[i] = kept;
+        result.markers.dropped[i] = dropped;
+    }
+    return in;
+}
+
+QByteArray makeFrame(const QByteArray& payload) {
+    uchar header[4];
+    qToBigEndian<quint32>(payload.size(), header);
+    return QByteArray((const char*) header, 4) + payload;
+}
+
+int takeFrame(QByteArray* buffer, QByteArray* frame) {
+    if (buffer->size() < 4) {
+        return 0;
+    }
+    quint32 length = qFromBigEndian<quint32>((const uchar*) buffer->constData());
+    if (length > WORKER_MAX_FRAME) {
+        return -1;
+    }
+    if ((quint32) buffer->size() - 4 < length) {
+        return 0;
+    }
+    *frame = buffer->mid(4, length);
+    buffer->remove(0, 4 + length);
+    return 1;
+}
+
+cjob makeJob(const QByteArray& input, const QString& path) {
+    cjob job = {input, params.markers, params.progressive, params.orientation,
+                params.exif != 2, params.importantExifs, params.verify, path,
+                params.effort, params.scanBudget, params.scanScripts, params.arithmetic};
+    return job;
+}
+
+//Encoder output of each thread, kept from file to file so big buffers aren't mapped and faulted in every time
+static thread_local QByteArray scratch;
+
+cjobresult runJob(const cjob& source) {
+    cjobresult result;
+
+    //Jobs from a coordinator on shared storage only carry the path
+    cjob job = source;
+    if (job.input.isEmpty() && !job.path.isEmpty()) {
+        CTraceScope trace("read");
+        QFile file(job.path);
+        if (file.open(QIODevice::ReadOnly)) {
+            job.input = file.readAll();
+        }
+        if (job.input.isEmpty()) {
+            result.message = "Could not read " + job.path;
+            return result;
+        }
+    }
+
+    //Not really necessary if we copy the whole EXIF data
+    Exiv2::ExifData exifData;
+    {
+        CTraceScope trace("exiv2 read");
+        exifData = getExifFromBuffer(job.input);
+    }
+
+    cclt_inspection inspection;
+    result.inputArithmetic = cclt_inspect_buffer((const unsigned char*) job.input.constData(), job.input.size(),
+                                                 job.markers, &inspection) == CCLT_OK && inspection.arithmetic;
+    result.arithmetic = job.arithmetic && cclt_arithmetic_supported();
+
+    /*
+     * No gain is possible past the input size, so that's all the room the output gets.
+     * Turned or recoded images are kept even if slightly bigger, they get some slack.
+     */
+    int capacity = job.input.size();
+    if (job.orientation != CCLT_ORIENTATION_KEEP || (result.inputArithmetic && !result.arithmetic)) {
+        capacity += CCLT_REPLACE_SLACK(job.input.size());
+    }
+    //The encoder writes into the scratch buffer of the thread, only the final bytes get their own allocation
+    QByteArray oneOff;
+    QByteArray* buffer = capacity <= WORKER_SCRATCH_LIMIT ? &scratch : &oneOff;
+    if (buffer->size() < capacity) {
+        *buffer = QByteArray(capacity, Qt::Uninitialized);
+    }
+    unsigned long outputLength = capacity;
+
+    //Script texts stay owned by the job, QByteArray keeps them NUL terminated
+    QVector<const char*> scripts;
+    foreach (const QByteArray& script, job.scanScripts) {
+        scripts.append(script.constData());
+    }
+    cclt_scan_options scanOptions = {job.effort, job.scanBudget, scripts.constData(), scripts.size(), job.arithmetic};
+
+    result.result = cclt_optimize_buffer((unsigned char*) job.input.constData(),
+                                         job.input.size(),
+                                         (unsigned char*) buffer->data(),
+                                         &outputLength,
+                                         job.markers,
+                                         job.progressive,
+                                         job.orientation,
+                                         &scanOptions,
+                                         &result.markers,
+                                         &result.progressive);
+    result.message = QString::fromLatin1(cclt_last_error());
+
+    if (result.result != CCLT_OK && !CCLT_MUST_REPLACE(result.result)) {
+        return result;
+    }
+    result.output = QByteArray(buffer->constData(), outputLength);
+
+    //The coefficients are checked before any metadata is written back
+    if (job.verify) {
+        result.verified = cclt_verify_buffer((unsigned char*) job.input.constData(), job.input.size(),
+                                             (unsigned char*) result.output.data(), result.output.size(),
+                                             job.orientation) == CCLT_OK;
+    }
+
+    //Write important metadata as user requested
+    if (job.writeExifs && !job.importantExifs.isEmpty()) {
+        CTraceScope trace("exiv2 write");
+        result.output = writeSpecificExifTags(exifData, result.output, job.importantExifs);
+    }
+    return result;
+}
+
+static bool readFrame(FILE* in, QByteArray* frame) {
+    uchar header[4];
+    if (fread(header, 1, 4, in) != 4) {
+        return false;
+    }
+    quint32 length = qFromBigEndian<quint32>(header);
+    if (length > WORKER_MAX_FRAME) {
+        return false;
+    }
+    frame->resize(length);
+    return fread(frame->data(), 1, length, in) == length;
+}
+
+static bool writeFrame(FILE* out, const QByteArray& frame) {
+    uchar header[4];
+    qToBigEndian<quint32>(frame.size(), header);
+    return fwrite(header, 1, 4, out) == 4 &&
+            fwrite(frame.constData(), 1, frame.size(), out) == (size_t) frame.size() &&
+            fflush(out) == 0;
+}
+
+int runWorker() {
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    QByteArray request;
+    while (readFrame(stdin, &request)) {
+        cjob job;
+        QDataStream in(request);
+        in >> job;
+
+        QByteArray response;
+        QDataStream out(&response, QIODevice::WriteOnly);
+        out << runJob(job);
+        if (!writeFrame(stdout, response)) {
+            break;
+        }
+    }
+    return 0;
+}
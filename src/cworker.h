@@ -0,0 +1,103 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef CWORKER_H
+#define CWORKER_H
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QDataStream>
+
+#include "lossless.h"
+#include "utils.h"
+
+//Command line switch starting a worker process instead of the GUI
+#define WORKER_ARGUMENT "--worker"
+
+//The worker process died on the job, twice
+#define WORKER_CRASHED -3
+//The worker process was still busy past the time the job allows, nothing is kept about the file
+#define WORKER_TIMED_OUT -4
+
+//Largest frame accepted on the pipe
+#define WORKER_MAX_FRAME (512 * 1024 * 1024)
+
+/*
+ * Largest output buffer a thread keeps for the next file, bigger ones are
+ * freed right away. Every compression thread may hold one for good, so
+ * this stays at the size of a typical photo rather than of the largest.
+ */
+#define WORKER_SCRATCH_LIMIT (8 * 1024 * 1024)
+
+//Everything needed to optimize one file, in memory
+typedef struct {
+    QByteArray input;
+    unsigned int markers;
+    int progressive; //CCLT_SCANS_*
+    int orientation;
+    bool writeExifs; //Write importantExifs back, the EXIF block is not kept whole
+    QList<cexifs> importantExifs;
+    bool verify; //Compare the output coefficients with the input ones
+    QString path; //Read from here instead when input is empty, for shared storage
+    int effort; //CCLT_EFFORT_*
+    int scanBudget; //Milliseconds, 0 for no limit
+    QList<QByteArray> scanScripts;
+    bool arithmetic; //Arithmetic coded output, Huffman otherwise
+} cjob;
+
+typedef struct {
+    int result = CCLT_ERROR; //CCLT_* code, WORKER_CRASHED or WORKER_TIMED_OUT
+    QByteArray output;
+    cclt_marker_stats markers = {};
+    QString message; //libjpeg error or warning, if any
+    bool verified = true;
+    int progressive = 0; //Scans the output got, what CCLT_SCANS_AUTO chose
+    bool inputArithmetic = false;
+    bool arithmetic = false; //Entropy coding of the output
+} cjobresult;
+
+QDataStream& operator<<(QDataStream& out, const cjob& job);
+QDataStream& operator>>(QDataStream& in, cjob& job);
+QDataStream& operator<<(QDataStream& out, const cjobresult& result);
+QDataStream& operator>>(QDataStream& in, cjobresult& result);
+
+//Length prefixed frame around payload
+QByteArray makeFrame(const QByteArray& payload);
+//Moves the first complete frame out of buffer: 1 if one was there, 0 if incomplete, -1 if malformed
+int takeFrame(QByteArray* buffer, QByteArray* frame);
+
+//Job for input, or for the file at path when input is empty, with the options in params
+cjob makeJob(const QByteArray& input, const QString& path = QString());
+
+//Optimization and metadata handling of a file, in the calling thread
+cjobresult runJob(const cjob& job);
+
+/*
+ * Main loop of a worker process: jobs come in on stdin and results go
+ * out on stdout, as frames of a big endian 32 bit length and a
+ * QDataStream payload. Returns when stdin closes.
+ */
+int runWorker();
+
+#endif // CWORKER_H
@@ -0,0 +1,218 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#include "cworkerpool.h"
+#include "ctrace.h"
+
+#include <QCoreApplication>
+#include <QStandardPaths>
+#include <QFile>
+#include <QDir>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QMutexLocker>
+#include <QtEndian>
+#include <QDebug>
+
+CWorkerProcess::CWorkerProcess() {
+    process.setProgram(QCoreApplication::applicationFilePath());
+    process.setArguments(QStringList() << WORKER_ARGUMENT);
+    //stdout carries the frames, stderr goes wherever ours goes
+    process.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+}
+
+CWorkerProcess::~CWorkerProcess() {
+    stop();
+}
+
+bool CWorkerProcess::start() {
+    process.start();
+    if (!process.waitForStarted(WORKER_START_TIMEOUT)) {
+        qCritical() << "Failed to start a worker process:" << process.errorString();
+        return false;
+    }
+    return true;
+}
+
+void CWorkerProcess::stop() {
+    if (process.state() == QProcess::NotRunning) {
+        return;
+    }
+    //A closed stdin ends the worker loop
+    process.closeWriteChannel();
+    if (!process.waitForFinished(1000)) {
+        process.kill();
+        process.waitForFinished(1000);
+    }
+}
+
+bool CWorkerProcess::isRunning() const {
+    return process.state() == QProcess::Running;
+}
+
+bool CWorkerProcess::hasCrashed() const {
+    return process.state() == QProcess::NotRunning && process.exitStatus() == QProcess::CrashExit;
+}
+
+bool CWorkerProcess::readExactly(char* data, qint64 size, int timeout) {
+    while (size > 0) {
+        if (process.bytesAvailable() == 0 && !process.waitForReadyRead(timeout)) {
+            return false;
+        }
+        qint64 read = process.read(data, size);
+        if (read < 0) {
+            return false;
+        }
+        data += read;
+        size -= read;
+    }
+    return true;
+}
+
+bool CWorkerProcess::call(const QByteArray& request, QByteArray* response, int timeout) {
+    uchar header[4];
+    qToBigEndian<quint32>(request.size(), header);
+    if (process.write((const char*) header, 4) != 4 || process.write(request) != request.size()) {
+        return false;
+    }
+    while (process.bytesToWrite() > 0) {
+        if (!process.waitForBytesWritten(timeout)) {
+            return false;
+        }
+    }
+
+    if (!readExactly((char*) header, 4, timeout)) {
+        return false;
+    }
+    quint32 length = qFromBigEndian<quint32>(header);
+    if (length > WORKER_MAX_FRAME) {
+        return false;
+    }
+    response->resize(length);
+    return readExactly(response->data(), length, timeout);
+}
+
+CWorkerPool::CWorkerPool() :
+    quarantineLoaded(false) {
+
+}
+
+CWorkerPool* CWorkerPool::instance() {
+    static CWorkerPool pool;
+    return &pool;
+}
+
+cjobresult CWorkerPool::run(const cjob& job) {
+    CTraceScope trace("worker");
+
+    //Workers live as long as the thread, QThreadStorage deletes them
+    if (!workers.hasLocalData()) {
+        workers.setLocalData(new CWorkerProcess());
+    }
+    CWorkerProcess* worker = workers.localData();
+
+    QByteArray request;
+    QDataStream out(&request, QIODevice::WriteOnly);
+    out << job;
+
+    //Big files and long scan searches take their time
+    qint64 size = job.input.isEmpty() ? QFileInfo(job.path).size() : job.input.size();
+    int timeout = WORKER_TIMEOUT + job.scanBudget + (int) qMin<qint64>(size / (1024 * 1024) * WORKER_TIMEOUT_PER_MB,
+                                                                       WORKER_TIMEOUT * 4);
+
+    cjobresult result;
+    bool crashed = false;
+    //A crash could be bad luck, like the OOM killer; a second one on a fresh worker isn't
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (!worker->isRunning() && !worker->start()) {
+            result.result = CCLT_ERROR;
+            result.message = "Could not start a worker process";
+            return result;
+        }
+        QByteArray response;
+        if (worker->call(request, &response, timeout)) {
+            QDataStream in(response);
+            in >> result;
+            return result;
+        }
+        if (worker->isRunning()) {
+            //Slow is not dangerous, the file is not held against next time
+            qCritical() << "Worker process hung for" << timeout << "ms, restarting it";
+            worker->stop();
+            result.result = WORKER_TIMED_OUT;
+            return result;
+        }
+        crashed = worker->hasCrashed();
+        qCritical() << "Worker process died, restarting it";
+        worker->stop();
+    }
+    if (crashed) {
+        result.result = WORKER_CRASHED;
+    } else {
+        result.message = "The worker process quit";
+    }
+    return result;
+}
+
+QString CWorkerPool::quarantinePath() const {
+    return QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/quarantine.txt";
+}
+
+bool CWorkerPool::isQuarantined(QString path) {
+    QMutexLocker locker(&mutex);
+    //One path per line, kept across sessions
+    if (!quarantineLoaded) {
+        QFile file(quarantinePath());
+        if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            QTextStream in(&file);
+            in.setCodec("UTF-8");
+            while (!in.atEnd()) {
+                QString line = in.readLine();
+                if (!line.isEmpty()) {
+                    quarantined.insert(line);
+                }
+            }
+        }
+        quarantineLoaded = true;
+    }
+    return quarantined.contains(path);
+}
+
+void CWorkerPool::quarantine(QString path) {
+    isQuarantined(path);
+
+    QMutexLocker locker(&mutex);
+    if (quarantined.contains(path)) {
+        return;
+    }
+    quarantined.insert(path);
+    qCritical() << "Quarantined" << path << "- remove it from" << quarantinePath() << "to try it again";
+
+    QDir().mkpath(QFileInfo(quarantinePath()).path());
+    QFile file(quarantinePath());
+    if (file.open(QIODevice::Append | QIODevice::Text)) {
+        QTextStream out(&file);
+        out.setCodec("UTF-8");
+        out << path << "\n";
+    }
+}
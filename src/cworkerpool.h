@@ -0,0 +1,88 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef CWORKERPOOL_H
+#define CWORKERPOOL_H
+
+#include <QProcess>
+#include <QThreadStorage>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+
+#include "cworker.h"
+
+//A worker that stays silent this long on a job is taken as hung, plus the scan budget and per MB of input
+#define WORKER_TIMEOUT 120000
+#define WORKER_TIMEOUT_PER_MB 5000
+#define WORKER_START_TIMEOUT 10000
+
+//One worker process, driven with blocking calls from the thread owning it
+class CWorkerProcess {
+public:
+    CWorkerProcess();
+    ~CWorkerProcess();
+
+    bool start();
+    void stop();
+    bool isRunning() const;
+    //Died of a signal, as opposed to hung or gone on its own
+    bool hasCrashed() const;
+    //Sends a frame and waits for the answer up to timeout ms at a time, false if the worker died or hung
+    bool call(const QByteArray& request, QByteArray* response, int timeout);
+
+private:
+    QProcess process;
+
+    bool readExactly(char* data, qint64 size, int timeout);
+};
+
+/*
+ * Optimization in separate processes: a crash on a hostile file takes
+ * down a worker instead of the application. Each compression thread
+ * drives a worker of its own, restarted as soon as it dies. A file
+ * that kills a fresh worker too is quarantined and skipped from then on;
+ * one that is only slow times out and is tried again the next time.
+ */
+class CWorkerPool {
+public:
+    static CWorkerPool* instance();
+
+    //Runs the job on the worker of the calling thread
+    cjobresult run(const cjob& job);
+
+    bool isQuarantined(QString path);
+    void quarantine(QString path);
+
+private:
+    CWorkerPool();
+
+    QThreadStorage<CWorkerProcess*> workers;
+    QMutex mutex;
+    QSet<QString> quarantined;
+    bool quarantineLoaded;
+
+    QString quarantinePath() const;
+};
+
+#endif // CWORKERPOOL_H
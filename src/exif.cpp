@@ -60,6 +60,20 @@ Exiv2::ExifData getExifFromPath(char* filename) {
 
 }
 
+Exiv2::ExifData getExifFromBuffer(const QByteArray& image) {
+    //Same as above, from a file already in memory
+    try {
+        Exiv2::Image::AutoPtr exivImage = Exiv2::ImageFactory::open((const Exiv2::byte*) image.constData(), image.size());
+        assert(exivImage.get() != 0);
+        exivImage->readMetadata();
+        return exivImage->exifData();
+    } catch (Exiv2::Error& e) {
+        Exiv2::ExifData exifData;
+        qCritical() << "Caught Exiv2 exception '" << e.what();
+        return exifData;
+    }
+}
+
 QString exifDataToString(Exiv2::ExifData exifData) {
     if (exifData.empty()) {
         //TODO Translate
@@ -95,13 +109,11 @@ QString exifDataToString(Exiv2::ExifData exifData) {
     }
 }
 
-void writeSpecificExifTags(Exiv2::ExifData exifData, QString imagePath, QList<cexifs> exifs) {
+QByteArray writeSpecificExifTags(Exiv2::ExifData exifData, QByteArray image, QList<cexifs> exifs) {
     //If tags are empty, jus return back
     if (exifData.empty()) {
-        return;
+        return image;
     }
-    //Get output file path
-    std::string path = imagePath.toStdString();
 
     Exiv2::ExifData newExifData;
 
@@ -124,11 +136,22 @@ void writeSpecificExifTags(Exiv2::ExifData exifData, QString imagePath, QList<ce
         }
     }
 
-    Exiv2::Image::AutoPtr image = Exiv2::ImageFactory::open(path);
-    assert(image.get() != 0);
+    //Edit the JPEG in memory and hand back the new bytes
+    try {
+        Exiv2::Image::AutoPtr memImage = Exiv2::ImageFactory::open((const Exiv2::byte*) image.constData(), image.size());
+        assert(memImage.get() != 0);
+
+        memImage->setExifData(newExifData);
+        memImage->writeMetadata();
 
-    image->setExifData(newExifData);
-    image->writeMetadata();
+        Exiv2::BasicIo& io = memImage->io();
+        io.seek(0, Exiv2::BasicIo::beg);
+        Exiv2::DataBuf buffer = io.read(io.size());
+        return QByteArray((const char*) buffer.pData_, buffer.size_);
+    } catch (Exiv2::AnyError& e) {
+        qWarning() << "Caught Exiv2 exception: " + QString(e.what()) + "\n";
+        return image;
+    }
 }
 
 void writeExif(Exiv2::ExifData exifData, Exiv2::ExifData* newExifData, std::string key_name) {
@@ -28,11 +28,13 @@
 
 #include <stdlib.h>
 #include <QString>
+#include <QByteArray>
 #include <exiv2/exiv2.hpp>
 
 Exiv2::ExifData getExifFromPath(char* filename);
+Exiv2::ExifData getExifFromBuffer(const QByteArray& image);
 QString exifDataToString(Exiv2::ExifData exifData);
-void writeSpecificExifTags(Exiv2::ExifData exifData, QString imagePath, QList<cexifs> exifs);
+QByteArray writeSpecificExifTags(Exiv2::ExifData exifData, QByteArray image, QList<cexifs> exifs);
 void writeExif(Exiv2::ExifData exifData, Exiv2::ExifData* newExifData, std::string key_name);
 
 #endif // EXIF_H
@@ -0,0 +1,251 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <jpeglib.h>
+
+#include "inspect.h"
+#include "lossless.h"
+#include "transform.h"
+#include "tiff.h"
+
+//Annex K.3 tables, what libjpeg writes without optimize_coding
+static const UINT8 cclt_dc_luminance_bits[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+static const UINT8 cclt_dc_luminance_values[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static const UINT8 cclt_dc_chrominance_bits[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+static const UINT8 cclt_dc_chrominance_values[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static const UINT8 cclt_ac_luminance_bits[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+static const UINT8 cclt_ac_luminance_values[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+static const UINT8 cclt_ac_chrominance_bits[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+static const UINT8 cclt_ac_chrominance_values[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+static int cclt_same_table(const unsigned char* bits, const unsigned char* values, int count,
+                           const UINT8* std_bits, const UINT8* std_values, int std_count) {
+    return count == std_count && memcmp(bits, std_bits, 16) == 0 && memcmp(values, std_values, count) == 0;
+}
+
+//Standard tables of the right class, whatever slot they are in
+static int cclt_standard_table(int table_class, const unsigned char* bits, const unsigned char* values, int count) {
+    if (table_class == 0) {
+        return cclt_same_table(bits, values, count, cclt_dc_luminance_bits, cclt_dc_luminance_values, 12) ||
+                cclt_same_table(bits, values, count, cclt_dc_chrominance_bits, cclt_dc_chrominance_values, 12);
+    }
+    return cclt_same_table(bits, values, count, cclt_ac_luminance_bits, cclt_ac_luminance_values, 162) ||
+            cclt_same_table(bits, values, count, cclt_ac_chrominance_bits, cclt_ac_chrominance_values, 162);
+}
+
+static void cclt_inspect_dht(const unsigned char* data, unsigned long length, cclt_inspection* info) {
+    unsigned long position = 0;
+    while (position + 17 <= length) {
+        int table_class = data[position] >> 4;
+        const unsigned char* bits = data + position + 1;
+        int count = 0;
+        for (int i = 0; i < 16; i++) {
+            count += bits[i];
+        }
+        if (position + 17 + count > length) {
+            return;
+        }
+        info->huffman_tables++;
+        if (cclt_standard_table(table_class, bits, data + position + 17, count)) {
+            info->standard_tables++;
+        }
+        position += 17 + count;
+    }
+}
+
+static void cclt_inspect_app(int code, const unsigned char* data, unsigned long length,
+                             unsigned int marker_policy, cclt_inspection* info) {
+    //Same classification as the copy, over a marker made up for it
+    struct jpeg_marker_struct marker;
+    memset(&marker, 0, sizeof(marker));
+    marker.marker = (UINT8) code;
+    marker.original_length = length;
+    marker.data_length = length;
+    marker.data = (JOCTET*) data;
+
+    int marker_class = cclt_marker_class(&marker);
+    if (marker_class == CCLT_MARKER_EXIF) {
+        info->exif = 1;
+        cclt_tiff t;
+        unsigned int ifd = cclt_tiff_open(&marker, &t);
+        unsigned int entry = ifd ? cclt_tiff_find(&t, ifd, 0x0112) : 0;
+        unsigned int orientation;
+        if (entry && cclt_tiff_value(&t, entry, &orientation)) {
+            info->orientation = orientation;
+        }
+        //Thumbnails of a kept EXIF are left alone unless the policy says otherwise
+        if ((marker_policy & CCLT_KEEP(CCLT_MARKER_EXIF)) &&
+                (marker_policy & (CCLT_THUMBNAIL_DROP | CCLT_THUMBNAIL_OPTIMIZE))) {
+            info->thumbnail += cclt_exif_thumbnail_length(&marker);
+        }
+    }
+    //JFIF and Adobe are written by the engine whatever the policy
+    if (marker_class != CCLT_MARKER_JFIF && marker_class != CCLT_MARKER_ADOBE &&
+            !(marker_policy & CCLT_KEEP(marker_class))) {
+        info->droppable += length + 4;
+    }
+}
+
+int cclt_inspect_buffer(const unsigned char* input,
+                        unsigned long input_size,
+                        unsigned int marker_policy,
+                        cclt_inspection* info) {
+    memset(info, 0, sizeof(cclt_inspection));
+    info->orientation = 1;
+    if (input_size < 4 || input[0] != 0xFF || input[1] != 0xD8) {
+        return CCLT_ERROR;
+    }
+
+    unsigned long position = 2;
+    while (position + 2 <= input_size) {
+        if (input[position] != 0xFF) {
+            //Entropy coded data, up to the next marker that isn't stuffing or a restart
+            const unsigned char* next = (const unsigned char*) memchr(input + position, 0xFF, input_size - position);
+            if (next == NULL) {
+                break;
+            }
+            position = next - input;
+            unsigned char code = position + 1 < input_size ? input[position + 1] : 0;
+            if (code == 0x00 || (code >= 0xD0 && code <= 0xD7) || code == 0xFF) {
+                position++;
+            }
+            continue;
+        }
+
+        int code = input[position + 1];
+        if (code == 0xFF) {
+            //Fill byte
+            position++;
+            continue;
+        }
+        if (code == 0xD9) {
+            info->complete = 1;
+            break;
+        }
+        if (code == 0x00 || code == 0x01 || (code >= 0xD0 && code <= 0xD7)) {
+            position += 2;
+            continue;
+        }
+
+        if (position + 4 > input_size) {
+            break;
+        }
+        unsigned long length = (input[position + 2] << 8) | input[position + 3];
+        if (length < 2) {
+            break;
+        }
+        //Only what's inside the buffer is looked at
+        const unsigned char* data = input + position + 4;
+        unsigned long available = position + 2 + length <= input_size ? length - 2 : input_size - position - 4;
+
+        if (code >= 0xC0 && code <= 0xCF && code != 0xC4 && code != 0xC8 && code != 0xCC) {
+            info->sof = code;
+            info->progressive = code == 0xC2 || code == 0xC6 || code == 0xCA || code == 0xCE;
+            info->arithmetic = code >= 0xC9;
+            if (available >= 6) {
+                info->height = (data[1] << 8) | data[2];
+                info->width = (data[3] << 8) | data[4];
+                info->components = data[5];
+            }
+        } else if (code == 0xC4) {
+            cclt_inspect_dht(data, available, info);
+        } else if (code == 0xDD && available >= 2) {
+            info->restart_interval = (data[0] << 8) | data[1];
+        } else if (code == 0xDA) {
+            info->scans++;
+        } else if ((code >= 0xE0 && code <= 0xEF) || code == 0xFE) {
+            cclt_inspect_app(code, data, available, marker_policy, info);
+        }
+        position += 2 + length;
+    }
+
+    //jpeg_simple_progression: 10 scans for YCbCr, 6 for grayscale
+    info->simple_script = info->progressive &&
+            info->scans == (info->components == 3 ? 10 : info->components == 1 ? 6 : -1);
+    return CCLT_OK;
+}
+
+int cclt_gain_expected(const cclt_inspection* info, int progressive_flag, int orientation_flag, int effort, int arithmetic) {
+    //Something is dropped, shrunk or turned upright, or the restart markers go
+    if (info->droppable > 0 || info->thumbnail > 0 || info->restart_interval > 0 ||
+            (orientation_flag != CCLT_ORIENTATION_KEEP && info->orientation > 1)) {
+        return 1;
+    }
+    //Changing the entropy coding always rewrites the file, whatever the size
+    if (info->arithmetic != (arithmetic && cclt_arithmetic_supported())) {
+        return 1;
+    }
+    //Arithmetic coding adapts by itself, only the scans can change
+    if (info->arithmetic) {
+        return !info->progressive && progressive_flag;
+    }
+    //Default tables, or none at all like Motion JPEG frames
+    if (info->standard_tables > 0 || info->huffman_tables == 0) {
+        return 1;
+    }
+    //A searched script usually beats the simple one
+    if (info->progressive && info->simple_script && progressive_flag && effort > CCLT_EFFORT_FAST) {
+        return 1;
+    }
+    //Baseline to progressive usually wins; the other way round never does
+    return !info->progressive && progressive_flag;
+}
+
+const char* cclt_coding_name(const cclt_inspection* info) {
+    if (info->sof == 0) {
+        return "unknown";
+    }
+    if (info->arithmetic) {
+        return info->progressive ? "progressive arithmetic" : "arithmetic";
+    }
+    if (info->progressive) {
+        return "progressive";
+    }
+    return info->sof == 0xC0 ? "baseline" : "extended";
+}
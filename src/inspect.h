@@ -0,0 +1,74 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef CCLT_INSPECT
+#define CCLT_INSPECT
+
+#include <stdio.h>
+#include <jpeglib.h>
+
+//Bytes read from the head of a file for a quick prediction
+#define CCLT_INSPECT_PREFIX (64 * 1024)
+
+//What the markers of a JPEG tell without decoding anything
+typedef struct {
+    int sof; //SOFn code, 0 if none seen
+    int progressive;
+    int arithmetic;
+    int components;
+    int width; //From the SOF, 0 if none seen
+    int height;
+    int scans;
+    int simple_script; //Scan count of jpeg_simple_progression, like jpegtran -progressive writes
+    int huffman_tables; //DHT tables defined
+    int standard_tables; //Of those, the ones identical to the Annex K examples
+    int restart_interval;
+    int orientation; //EXIF Orientation, 1 if none
+    int exif;
+    unsigned long droppable; //APPn and COM bytes the marker policy drops
+    unsigned long thumbnail; //EXIF thumbnail bytes CCLT_THUMBNAIL_DROP or CCLT_THUMBNAIL_OPTIMIZE act on
+    int complete; //EOI reached, otherwise the tables of later scans are unknown
+} cclt_inspection;
+
+/*
+ * Walks the markers of input, hopping over the entropy coded data, and
+ * fills info. A prefix of the file is fine, complete tells. Returns
+ * CCLT_ERROR if input doesn't start like a JPEG.
+ */
+int cclt_inspect_buffer(const unsigned char* input,
+                        unsigned long input_size,
+                        unsigned int marker_policy,
+                        cclt_inspection* info);
+
+/*
+ * Whether optimizing with these options is expected to shrink the file.
+ * Optimized Huffman tables, a matching progressive mode and nothing to
+ * drop, shrink or turn mean the output would come out bigger. effort is the
+ * CCLT_EFFORT_* of the scan search, arithmetic the entropy coding asked.
+ */
+int cclt_gain_expected(const cclt_inspection* info, int progressive_flag, int orientation_flag, int effort, int arithmetic);
+
+//"baseline", "progressive", "arithmetic", ... for reports
+const char* cclt_coding_name(const cclt_inspection* info);
+
+#endif
@@ -24,183 +24,587 @@
 #include <setjmp.h>
 #include <stdio.h>
 #include <jpeglib.h>
+#include <jerror.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 
 #include <QDebug>
+#include <QElapsedTimer>
 
 #include "lossless.h"
-#include "caesiumph.h"
+#include "ctrace.h"
+#include "transform.h"
+#include "markers.h"
+#include "scans.h"
+
+/*
+ * Errors longjmp back to the call that met them, instead of exiting: one
+ * bad file fails alone. Nothing with a destructor may be alive in between,
+ * so the trace spans here are taken by hand.
+ */
+typedef struct {
+    struct jpeg_error_mgr pub;
+    jmp_buf setjmp_buffer;
+    int corrupt; //Some image data was lost or made up
+} cclt_error_mgr;
+
+//Last error or warning met by the calling thread
+static thread_local char cclt_message[JMSG_LENGTH_MAX];
+
+static void cclt_error_exit(j_common_ptr cinfo) {
+    cclt_error_mgr* err = (cclt_error_mgr*) cinfo->err;
+    (*cinfo->err->format_message)(cinfo, cclt_message);
+    longjmp(err->setjmp_buffer, 1);
+}
+
+static void cclt_emit_message(j_common_ptr cinfo, int msg_level) {
+    cclt_error_mgr* err = (cclt_error_mgr*) cinfo->err;
+
+    //Trace messages
+    if (msg_level >= 0) {
+        return;
+    }
+
+    //Warnings about the entropy coded data, as opposed to odd markers
+    int corrupt = 0;
+    switch (cinfo->err->msg_code) {
+    case JWRN_HIT_MARKER:
+    case JWRN_HUFF_BAD_CODE:
+    case JWRN_JPEG_EOF:
+    case JWRN_MUST_RESYNC:
+    case JWRN_NOT_SEQUENTIAL:
+    case JWRN_BOGUS_PROGRESSION:
+    case JWRN_TOO_MUCH_DATA:
+#if JPEG_LIB_VERSION >= 70
+    case JWRN_ARITH_BAD_CODE:
+#endif
+        corrupt = 1;
+        break;
+    default:
+        break;
+    }
+
+    //The first warning is kept, unless a later one tells the data is damaged
+    if (cinfo->err->num_warnings == 0 || (corrupt && !err->corrupt)) {
+        (*cinfo->err->format_message)(cinfo, cclt_message);
+    }
+    err->corrupt |= corrupt;
+    cinfo->err->num_warnings++;
+}
+
+static void cclt_error_init(cclt_error_mgr* err) {
+    jpeg_std_error(&err->pub);
+    err->pub.error_exit = cclt_error_exit;
+    err->pub.emit_message = cclt_emit_message;
+    err->corrupt = 0;
+    cclt_message[0] = '\0';
+}
 
-struct jpeg_decompress_struct cclt_get_markers(char* input) {
-    FILE* fp;
-    struct jpeg_decompress_struct einfo;
-    struct jpeg_error_mgr eerr;
-    einfo.err = jpeg_std_error(&eerr);
+const char* cclt_last_error() {
+    return cclt_message;
+}
+
+//Optimized thumbnails go through a nested optimization, its messages are not the ones of the file
+static cclt_marker_payload* cclt_prepare_payloads(j_decompress_ptr srcinfo, unsigned int marker_policy) {
+    char message[JMSG_LENGTH_MAX];
+    memcpy(message, cclt_message, sizeof(message));
+    cclt_marker_payload* payloads = cclt_prepare_markers(srcinfo, marker_policy);
+    memcpy(cclt_message, message, sizeof(message));
+    return payloads;
+}
 
-    jpeg_create_decompress(&einfo);
+static qint64 cclt_trace_begin() {
+    return CTrace::instance()->isEnabled() ? CTrace::instance()->now() : -1;
+}
+
+static void cclt_trace_end(const char* name, qint64 start) {
+    if (start >= 0 && CTrace::instance()->isEnabled()) {
+        CTrace::instance()->addSpan(name, "stage", start, CTrace::instance()->now() - start, QVariantMap());
+    }
+}
 
-    //Open the input file
-    fp = fopen(input, "r");
+/*
+ * Destination writing into a caller buffer of fixed capacity.
+ * Once the capacity is exceeded the output is discarded into a
+ * scratch area: the result can't be smaller than the input anymore,
+ * so there's no point in growing the buffer.
+ */
+typedef struct {
+    struct jpeg_destination_mgr pub;
+    unsigned long capacity;
+    int overflow;
+    jmp_buf* abort; //Jumped to on overflow instead, when nobody wants a losing output
+    JOCTET scratch[4096];
+} cclt_buffer_dest;
+
+static void cclt_buffer_init(j_compress_ptr cinfo) {
+    //Buffer is set up by cclt_optimize_buffer
+}
 
-    //Check for errors
-    if (fp == NULL) {
-        qCritical() << "Failed to open exif file" << input;
+static boolean cclt_buffer_empty(j_compress_ptr cinfo) {
+    cclt_buffer_dest* dest = (cclt_buffer_dest*) cinfo->dest;
+    if (dest->abort != NULL) {
+        longjmp(*dest->abort, 1);
     }
+    dest->overflow = 1;
+    dest->pub.next_output_byte = dest->scratch;
+    dest->pub.free_in_buffer = sizeof(dest->scratch);
+    return TRUE;
+}
+
+static void cclt_buffer_term(j_compress_ptr cinfo) {
+    //Nothing to flush, the data is already in place
+}
 
-    //Create the IO istance for the input file
-    jpeg_stdio_src(&einfo, fp);
+static void cclt_buffer_dest_init(j_compress_ptr cinfo, cclt_buffer_dest* dest, JOCTET* buffer, unsigned long capacity) {
+    dest->pub.init_destination = cclt_buffer_init;
+    dest->pub.empty_output_buffer = cclt_buffer_empty;
+    dest->pub.term_destination = cclt_buffer_term;
+    dest->pub.next_output_byte = buffer;
+    dest->pub.free_in_buffer = capacity;
+    dest->capacity = capacity;
+    dest->overflow = 0;
+    dest->abort = NULL;
+    cinfo->dest = &dest->pub;
+}
 
-    //Save EXIF info
-    for (int m = 0; m < 16; m++) {
-        jpeg_save_markers(&einfo, JPEG_APP0 + m, 0xFFFF);
+//Sets up the transform for the EXIF orientation, before the coefficients are read
+static int cclt_request_orientation(j_decompress_ptr srcinfo, cclt_transform* transform, int orientation_flag) {
+    if (orientation_flag == CCLT_ORIENTATION_KEEP) {
+        return 0;
+    }
+    int orientation = cclt_exif_orientation(srcinfo);
+    if (orientation < 2) {
+        return 0;
+    }
+    if (!cclt_transform_request(srcinfo, transform, orientation, orientation_flag == CCLT_ORIENTATION_TRIM)) {
+        qInfo() << "Orientation" << orientation << "left as it is, edge blocks can't be transformed losslessly";
+        return 0;
     }
+    return 1;
+}
 
-    jpeg_read_header(&einfo, TRUE);
+//Parameters of dstinfo, returns the coefficients to write
+static jvirt_barray_ptr* cclt_encode_setup(j_decompress_ptr srcinfo,
+                                           j_compress_ptr dstinfo,
+                                           jvirt_barray_ptr* coef_arrays,
+                                           cclt_transform* transform) {
+    //Copy parameters
+    jpeg_copy_critical_parameters(srcinfo, dstinfo);
 
-    fclose(fp);
+    //Turn the image upright, geometry and tables of dstinfo follow
+    if (transform != NULL) {
+        qint64 start = cclt_trace_begin();
+        coef_arrays = cclt_transform_execute(srcinfo, dstinfo, coef_arrays, transform);
+        cclt_trace_end("transform", start);
+    }
+    return coef_arrays;
+}
 
-    return einfo;
+//Scans of the plain modes, when there's no search
+static const cclt_scan_candidate cclt_plain_scans[2] = {
+    {"baseline", 0, 0},
+    {"simple", 1, 1}
+};
+
+//What cclt_transform_execute did to the first encoder, without turning the coefficients again
+static void cclt_copy_geometry(j_compress_ptr from, j_compress_ptr to) {
+    to->image_width = from->image_width;
+    to->image_height = from->image_height;
+    for (int ci = 0; ci < to->num_components; ci++) {
+        to->comp_info[ci].h_samp_factor = from->comp_info[ci].h_samp_factor;
+        to->comp_info[ci].v_samp_factor = from->comp_info[ci].v_samp_factor;
+    }
+    for (int qi = 0; qi < NUM_QUANT_TBLS; qi++) {
+        if (from->quant_tbl_ptrs[qi] != NULL && to->quant_tbl_ptrs[qi] != NULL) {
+            memcpy(to->quant_tbl_ptrs[qi]->quantval, from->quant_tbl_ptrs[qi]->quantval,
+                   sizeof(to->quant_tbl_ptrs[qi]->quantval));
+        }
+    }
 }
 
-void jcopy_markers_execute (j_decompress_ptr srcinfo, j_compress_ptr dstinfo) {
-  jpeg_saved_marker_ptr marker;
+static void cclt_encode_scans(j_decompress_ptr srcinfo,
+                              j_compress_ptr dstinfo,
+                              jvirt_barray_ptr* coef_arrays,
+                              const cclt_scan_candidate* scans,
+                              unsigned int marker_policy,
+                              const cclt_marker_payload* payloads,
+                              cclt_marker_stats* marker_stats) {
+    //CRITICAL - This is the optimization step
+    dstinfo->optimize_coding = TRUE;
+
+    //Baseline, or one of the progressive scripts
+    cclt_scan_apply(dstinfo, scans);
 
-  for (marker = srcinfo->marker_list; marker != NULL; marker = marker->next) {
-    if (dstinfo->write_JFIF_header &&
-        marker->marker == JPEG_APP0 &&
-        marker->data_length >= 5 &&
-        GETJOCTET(marker->data[0]) == 0x4A &&
-        GETJOCTET(marker->data[1]) == 0x46 &&
-        GETJOCTET(marker->data[2]) == 0x49 &&
-        GETJOCTET(marker->data[3]) == 0x46 &&
-        GETJOCTET(marker->data[4]) == 0)
-      continue;
-    if (dstinfo->write_Adobe_marker &&
-        marker->marker == JPEG_APP0+14 &&
-        marker->data_length >= 5 &&
-        GETJOCTET(marker->data[0]) == 0x41 &&
-        GETJOCTET(marker->data[1]) == 0x64 &&
-        GETJOCTET(marker->data[2]) == 0x6F &&
-        GETJOCTET(marker->data[3]) == 0x62 &&
-        GETJOCTET(marker->data[4]) == 0x65)
-      continue;
-    jpeg_write_marker(dstinfo, marker->marker,
-                      marker->data, marker->data_length);
-  }
+    //Encoding span, markers copy is nested into it
+    qint64 start = cclt_trace_begin();
+
+    //Actually write the coefficents
+    jpeg_write_coefficients(dstinfo, coef_arrays);
+
+    //Write the markers the policy keeps
+    qint64 markers_start = cclt_trace_begin();
+    cclt_copy_markers(srcinfo, dstinfo, marker_policy, payloads, marker_stats);
+    cclt_trace_end("marker copy", markers_start);
+
+    jpeg_finish_compress(dstinfo);
+    cclt_trace_end("encode", start);
+}
+
+/*
+ * Scan script search. The first candidate is encoded into the output
+ * as usual, the others follow in the calling thread, each with its own
+ * compressor and error handling, on the same read only coefficients.
+ * Files are what runs in parallel, on the threads the compression pool
+ * was given. A candidate gets no more room than the best output so far
+ * and is abandoned as soon as it goes past it.
+ */
+typedef struct {
+    j_decompress_ptr srcinfo;
+    j_compress_ptr reference; //Encoder the transform set up, NULL if the image was not turned
+    jvirt_barray_ptr* coef_arrays;
+    unsigned int marker_policy;
+    const cclt_marker_payload* payloads;
+    const QElapsedTimer* clock;
+    int budget_ms;
+    unsigned long best_size;
+    JOCTET* best_buffer; //NULL while the first candidate is the best
+    const cclt_scan_candidate* best;
+} cclt_search;
+
+static void cclt_candidate_exit(j_common_ptr cinfo) {
+    //The message of the file is left alone, a losing script is no news
+    longjmp(((cclt_error_mgr*) cinfo->err)->setjmp_buffer, 1);
 }
 
-extern int cclt_optimize(char* input_file, char* output_file, int exif_flag, int progressive_flag, char* exif_src) {
-    //File pointer for both input and output
-    FILE* fp;
+static int cclt_encode_candidate(cclt_search* search, const cclt_scan_candidate* candidate,
+                                 JOCTET* buffer, unsigned long capacity, unsigned long* size) {
+    struct jpeg_compress_struct cinfo;
+    cclt_error_mgr jerr;
+    cclt_buffer_dest dest;
+
+    memset(&cinfo, 0, sizeof(cinfo));
+    jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = cclt_candidate_exit;
+    if (setjmp(jerr.setjmp_buffer)) {
+        jpeg_destroy_compress(&cinfo);
+        return 0;
+    }
+
+    cinfo.err = &jerr.pub;
+    jpeg_create_compress(&cinfo);
+    cclt_buffer_dest_init(&cinfo, &dest, buffer, capacity);
+    dest.abort = &jerr.setjmp_buffer;
 
+    jpeg_copy_critical_parameters(search->srcinfo, &cinfo);
+    if (search->reference != NULL) {
+        cclt_copy_geometry(search->reference, &cinfo);
+    }
+    cclt_encode_scans(search->srcinfo, &cinfo, search->coef_arrays, candidate, search->marker_policy,
+                      search->payloads, NULL);
+
+    *size = capacity - dest.pub.free_in_buffer;
+    jpeg_destroy_compress(&cinfo);
+    return 1;
+}
+
+static void cclt_search_run(cclt_search* search, const cclt_scan_candidate* candidate) {
+    //Out of time, what was found so far will do
+    if (search->budget_ms > 0 && search->clock->elapsed() > search->budget_ms) {
+        return;
+    }
+
+    unsigned long capacity = search->best_size;
+    JOCTET* buffer = (JOCTET*) malloc(capacity);
+    unsigned long size;
+    qint64 start = cclt_trace_begin();
+    if (buffer == NULL || !cclt_encode_candidate(search, candidate, buffer, capacity, &size)) {
+        free(buffer);
+        cclt_trace_end("scan candidate", start);
+        return;
+    }
+    if (start >= 0 && CTrace::instance()->isEnabled()) {
+        QVariantMap args;
+        args.insert("script", candidate->name);
+        args.insert("size", (qint64) size);
+        CTrace::instance()->addSpan("scan candidate", "stage", start, CTrace::instance()->now() - start, args);
+    }
+
+    if (size < search->best_size) {
+        free(search->best_buffer);
+        search->best_buffer = buffer;
+        search->best_size = size;
+        search->best = candidate;
+        buffer = NULL;
+    }
+    free(buffer);
+}
+
+//Runs candidates 1 to count - 1, returns the best of all and its size
+static const cclt_scan_candidate* cclt_encode_search(cclt_search* search,
+                                                     const cclt_scan_candidate* candidates,
+                                                     int count,
+                                                     JOCTET* output) {
+    search->best_buffer = NULL;
+    search->best = candidates;
+
+    //No pool of its own: threads, affinity and background mode are the ones of the file
+    for (int i = 1; i < count; i++) {
+        cclt_search_run(search, candidates + i);
+    }
+
+    if (search->best_buffer != NULL) {
+        memcpy(output, search->best_buffer, search->best_size);
+        free(search->best_buffer);
+    }
+    return search->best;
+}
+
+extern int cclt_optimize_buffer(unsigned char* input,
+                                unsigned long input_size,
+                                unsigned char* output,
+                                unsigned long* output_size,
+                                unsigned int marker_policy,
+                                int progressive_flag,
+                                int orientation_flag,
+                                const cclt_scan_options* scan_options,
+                                cclt_marker_stats* marker_stats,
+                                int* progressive_used) {
     //Those will hold the input/output structs
     struct jpeg_decompress_struct srcinfo;
     struct jpeg_compress_struct dstinfo;
 
     //Error handling
-    struct jpeg_error_mgr jsrcerr, jdsterr;
-
-    //Input/Output array coefficents
-    jvirt_barray_ptr* src_coef_arrays;
-    jvirt_barray_ptr* dst_coef_arrays;
+    cclt_error_mgr jerr;
+
+    //Output into the caller buffer
+    cclt_buffer_dest dest;
+
+    //The time budget of the scan search counts from here
+    QElapsedTimer clock;
+    clock.start();
+
+    //Input array coefficents
+    jvirt_barray_ptr* coef_arrays;
+
+    //Lossless rotation/mirroring, if any
+    cclt_transform transform;
+    int transformed = 0;
+
+    //Zeroed structs can be destroyed even if their creation failed
+    memset(&srcinfo, 0, sizeof(srcinfo));
+    memset(&dstinfo, 0, sizeof(dstinfo));
+    cclt_error_init(&jerr);
+    if (setjmp(jerr.setjmp_buffer)) {
+        jpeg_destroy_compress(&dstinfo);
+        jpeg_destroy_decompress(&srcinfo);
+        return CCLT_ERROR;
+    }
 
     //Set errors and create the compress/decompress istances
-    srcinfo.err = jpeg_std_error(&jsrcerr);
+    srcinfo.err = &jerr.pub;
     jpeg_create_decompress(&srcinfo);
-    dstinfo.err = jpeg_std_error(&jdsterr);
+    dstinfo.err = &jerr.pub;
     jpeg_create_compress(&dstinfo);
 
-    //Open the input file
-    fp = fopen(input_file, "rb");
+    jpeg_mem_src(&srcinfo, input, input_size);
 
-    qInfo() << "Compressing" << input_file;
+    //Save the markers, whole APP1s are needed for the Orientation tag
+    cclt_save_markers(&srcinfo, marker_policy, orientation_flag != CCLT_ORIENTATION_KEEP);
 
-    //Check for errors
-    if (fp == NULL) {
-        qCritical() << "Failed to open file" << input_file;
-        return -1;
+    qint64 start = cclt_trace_begin();
+    (void) jpeg_read_header(&srcinfo, TRUE);
+    transformed = cclt_request_orientation(&srcinfo, &transform, orientation_flag);
+    coef_arrays = jpeg_read_coefficients(&srcinfo);
+    cclt_trace_end("decode coefficients", start);
+
+    //Damaged input would come out as it decodes, not as it was meant to be
+    if (jerr.corrupt) {
+        jpeg_destroy_compress(&dstinfo);
+        jpeg_destroy_decompress(&srcinfo);
+        return CCLT_CORRUPT;
     }
 
-    //Create the IO istance for the input file
-    jpeg_stdio_src(&srcinfo, fp);
-
-    qInfo() << "Save EXIF info";
-
-    //Save EXIF info
-    if (exif_flag == 2) {
-        for (int m = 0; m < 16; m++) {
-            jpeg_save_markers(&srcinfo, JPEG_APP0 + m, 0xFFFF);
+    //Thumbnails are done once, not once per candidate
+    cclt_marker_payload* payloads = cclt_prepare_payloads(&srcinfo, marker_policy);
+
+    //Scripts to try, the first one goes straight into the output
+    cclt_scan_candidate* candidates = (cclt_scan_candidate*) (*srcinfo.mem->alloc_large)
+            ((j_common_ptr) &srcinfo, JPOOL_IMAGE, CCLT_MAX_CANDIDATES * sizeof(cclt_scan_candidate));
+    int count = cclt_scan_candidates(progressive_flag, srcinfo.num_components, scan_options,
+                                     candidates, CCLT_MAX_CANDIDATES);
+    if (count == 0) {
+        candidates[0] = cclt_plain_scans[progressive_flag != CCLT_SCANS_BASELINE];
+        candidates[0].arithmetic = scan_options != NULL && scan_options->arithmetic && cclt_arithmetic_supported();
+        count = 1;
+    }
+    //Browsers can't show arithmetic coding, moving away from it is worth any size
+    int recoded = srcinfo.arith_code && !candidates[0].arithmetic;
+
+    cclt_buffer_dest_init(&dstinfo, &dest, output, *output_size);
+    coef_arrays = cclt_encode_setup(&srcinfo, &dstinfo, coef_arrays, transformed ? &transform : NULL);
+    cclt_encode_scans(&srcinfo, &dstinfo, coef_arrays, candidates, marker_policy, payloads, marker_stats);
+    unsigned long size = dest.capacity - dest.pub.free_in_buffer;
+    const cclt_scan_candidate* best = candidates;
+
+    /*
+     * Small images tend to be smaller as baseline, large ones as progressive,
+     * and no single progressive script wins everywhere. Markers are the same
+     * in every candidate, they are counted once.
+     */
+    if (count > 1) {
+        cclt_search search;
+        search.srcinfo = &srcinfo;
+        search.reference = transformed ? &dstinfo : NULL;
+        search.coef_arrays = coef_arrays;
+        search.marker_policy = marker_policy;
+        search.payloads = payloads;
+        search.clock = &clock;
+        search.budget_ms = scan_options != NULL ? scan_options->budget_ms : 0;
+        search.best_size = dest.overflow ? *output_size : size;
+        best = cclt_encode_search(&search, candidates, count, output);
+        if (best != candidates) {
+            size = search.best_size;
+            dest.overflow = 0;
         }
     }
+    //The candidates go with the image pool
+    int progressive = best->progressive;
 
-    //Read the input headers
-    (void) jpeg_read_header(&srcinfo, TRUE);
-
-    //Read input coefficents
-    src_coef_arrays = jpeg_read_coefficients(&srcinfo);
-
-    //Copy parameters
-    jpeg_copy_critical_parameters(&srcinfo, &dstinfo);
-
-    //Set coefficents array to be the same
-    dst_coef_arrays = src_coef_arrays;
+    //Free
+    jpeg_destroy_compress(&dstinfo);
+    (void) jpeg_finish_decompress(&srcinfo);
+    jpeg_destroy_decompress(&srcinfo);
 
-    //We don't need the input file anymore
-    fclose(fp);
+    if (dest.overflow) {
+        return CCLT_BIGGER;
+    }
+    *output_size = size;
+    if (progressive_used != NULL) {
+        *progressive_used = progressive;
+    }
+    if (transformed) {
+        return CCLT_TRANSFORMED;
+    }
+    return recoded ? CCLT_RECODED : CCLT_OK;
+}
 
-    qInfo() << "Input file read succesfully";
+//Same size, sampling and quantizers, or the coefficients can't match
+static int cclt_same_geometry(j_decompress_ptr outinfo,
+                              JDIMENSION width,
+                              JDIMENSION height,
+                              jpeg_component_info* comp_info,
+                              JQUANT_TBL** quant_tables) {
+    if (outinfo->image_width != width || outinfo->image_height != height) {
+        return 0;
+    }
+    for (int ci = 0; ci < outinfo->num_components; ci++) {
+        jpeg_component_info* compptr = outinfo->comp_info + ci;
+        JQUANT_TBL* qtbl = quant_tables[ci];
+        if (compptr->h_samp_factor != comp_info[ci].h_samp_factor ||
+                compptr->v_samp_factor != comp_info[ci].v_samp_factor ||
+                compptr->quant_table == NULL || qtbl == NULL ||
+                memcmp(compptr->quant_table->quantval, qtbl->quantval, sizeof(qtbl->quantval)) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
 
-    //Open the output one instead
-    fp = fopen(output_file, "wb");
-    //Check for errors
-    if (fp == NULL) {
-        qCritical() << "Failed to open output file" << output_file;
-        return -1;
+extern int cclt_verify_buffer(unsigned char* input,
+                              unsigned long input_size,
+                              unsigned char* output,
+                              unsigned long output_size,
+                              int orientation_flag) {
+    struct jpeg_decompress_struct srcinfo, outinfo;
+    struct jpeg_compress_struct dstinfo;
+    cclt_error_mgr jerr;
+    jvirt_barray_ptr* src_arrays;
+    jvirt_barray_ptr* out_arrays;
+    cclt_transform transform;
+    int transformed, result = CCLT_OK;
+
+    //Created before the setjmp, it outlives any longjmp
+    CTraceScope trace("verify");
+
+    memset(&srcinfo, 0, sizeof(srcinfo));
+    memset(&outinfo, 0, sizeof(outinfo));
+    memset(&dstinfo, 0, sizeof(dstinfo));
+    cclt_error_init(&jerr);
+    if (setjmp(jerr.setjmp_buffer)) {
+        jpeg_destroy_compress(&dstinfo);
+        jpeg_destroy_decompress(&outinfo);
+        jpeg_destroy_decompress(&srcinfo);
+        return CCLT_ERROR;
     }
 
-    //CRITICAL - This is the optimization step
-    dstinfo.optimize_coding = TRUE;
+    srcinfo.err = &jerr.pub;
+    jpeg_create_decompress(&srcinfo);
+    outinfo.err = &jerr.pub;
+    jpeg_create_decompress(&outinfo);
+    dstinfo.err = &jerr.pub;
+    jpeg_create_compress(&dstinfo);
 
-    //Progressive
-    if (progressive_flag) {        
-        jpeg_simple_progression(&dstinfo);
+    //Input goes through the same transform the optimization did
+    jpeg_mem_src(&srcinfo, input, input_size);
+    cclt_save_markers(&srcinfo, CCLT_KEEP_NONE, orientation_flag != CCLT_ORIENTATION_KEEP);
+    (void) jpeg_read_header(&srcinfo, TRUE);
+    transformed = cclt_request_orientation(&srcinfo, &transform, orientation_flag);
+    src_arrays = jpeg_read_coefficients(&srcinfo);
+
+    jpeg_mem_src(&outinfo, output, output_size);
+    (void) jpeg_read_header(&outinfo, TRUE);
+    out_arrays = jpeg_read_coefficients(&outinfo);
+
+    //Reference geometry and tables, as the encoder got them
+    JQUANT_TBL* quant_tables[MAX_COMPONENTS];
+    jpeg_component_info* comp_info;
+    JDIMENSION width, height;
+    if (transformed) {
+        jpeg_copy_critical_parameters(&srcinfo, &dstinfo);
+        src_arrays = cclt_transform_execute(&srcinfo, &dstinfo, src_arrays, &transform);
+        comp_info = dstinfo.comp_info;
+        width = dstinfo.image_width;
+        height = dstinfo.image_height;
+        for (int ci = 0; ci < dstinfo.num_components; ci++) {
+            quant_tables[ci] = dstinfo.quant_tbl_ptrs[comp_info[ci].quant_tbl_no];
+        }
     } else {
-        //Outputs a baseline image
-        dstinfo.scan_info = NULL;
+        comp_info = srcinfo.comp_info;
+        width = srcinfo.image_width;
+        height = srcinfo.image_height;
+        for (int ci = 0; ci < srcinfo.num_components; ci++) {
+            quant_tables[ci] = comp_info[ci].quant_table;
+        }
     }
 
-    //Set the output file parameters
-    jpeg_stdio_dest(&dstinfo, fp);
+    //A truncated or damaged output decodes with warnings
+    if (jerr.corrupt || outinfo.num_components != srcinfo.num_components ||
+            !cclt_same_geometry(&outinfo, width, height, comp_info, quant_tables)) {
+        result = CCLT_ERROR;
+    }
 
-    //Actually write the coefficents
-    jpeg_write_coefficients(&dstinfo, dst_coef_arrays);
-
-    qInfo() << "Output file wrote succesfully";
-
-    //Write EXIF
-    if (exif_flag == 2) {
-        if (strcmp(input_file, exif_src) == 0) {
-            jcopy_markers_execute(&srcinfo, &dstinfo);
-        } else {
-            //For standard compression EXIF data
-            struct jpeg_decompress_struct einfo = cclt_get_markers(exif_src);
-            jcopy_markers_execute(&einfo, &dstinfo);
-            jpeg_destroy_decompress(&einfo);
+    //Block by block, padding blocks past the image edges are up to the encoder
+    for (int ci = 0; ci < outinfo.num_components && result == CCLT_OK; ci++) {
+        jpeg_component_info* compptr = outinfo.comp_info + ci;
+        for (JDIMENSION row = 0; row < compptr->height_in_blocks && result == CCLT_OK; row++) {
+            JBLOCKARRAY expected = (*srcinfo.mem->access_virt_barray)
+                    ((j_common_ptr) &srcinfo, src_arrays[ci], row, 1, FALSE);
+            JBLOCKARRAY actual = (*outinfo.mem->access_virt_barray)
+                    ((j_common_ptr) &outinfo, out_arrays[ci], row, 1, FALSE);
+            if (memcmp(expected[0], actual[0], compptr->width_in_blocks * sizeof(JBLOCK)) != 0) {
+                qCritical() << "Coefficients differ in component" << ci << "block row" << row;
+                result = CCLT_ERROR;
+            }
         }
     }
 
-    qInfo() << "EXIF copied, if any";
-
-    //Finish and free
-    jpeg_finish_compress(&dstinfo);
     jpeg_destroy_compress(&dstinfo);
+    (void) jpeg_finish_decompress(&outinfo);
+    jpeg_destroy_decompress(&outinfo);
     (void) jpeg_finish_decompress(&srcinfo);
     jpeg_destroy_decompress(&srcinfo);
 
-    //Close the output file
-    fclose(fp);
-
-    return 0;
+    return result;
 }
@@ -24,11 +24,73 @@
 #ifndef CCLT_LOSSLESS
 #define CCLT_LOSSLESS
 
-extern int cclt_optimize(char* input_file,
-                         char* output_file,
-                         int exif_flag,
-                         int progressive_flag,
-                         char* exif_src);
-struct jpeg_decompress_struct cclt_get_markers(char* input);
+#include "markers.h"
+#include "scans.h"
+
+//Return codes
+#define CCLT_OK 0
+#define CCLT_ERROR -1
+#define CCLT_BIGGER 1 //Output would not fit the given buffer
+#define CCLT_TRANSFORMED 2 //Turned upright, the output must replace the input whatever its size
+#define CCLT_CORRUPT -2 //Damaged image data in the input, nothing is written
+#define CCLT_RECODED 3 //Arithmetic coding turned into Huffman, the output must replace the input whatever its size
+
+//Results to write even if they are bigger
+#define CCLT_MUST_REPLACE(result) ((result) == CCLT_TRANSFORMED || (result) == CCLT_RECODED)
+
+/*
+ * Room past the input size for those. Huffman usually takes about a fifth
+ * more than arithmetic coding; half is kept since small or noisy images go
+ * past that, and running out would fail the file, which must be written.
+ * The 4 KB cover the tables of tiny ones.
+ */
+#define CCLT_REPLACE_SLACK(size) ((size) / 2 + 4096)
+
+//Scan modes, the progressive_flag of the calls below
+#define CCLT_SCANS_BASELINE 0
+#define CCLT_SCANS_PROGRESSIVE 1
+#define CCLT_SCANS_AUTO 2 //Both from the same coefficients, the smaller is kept
+
+/*
+ * Failures never exit: calls return CCLT_ERROR or CCLT_CORRUPT and this
+ * tells why. Warnings on files that went through are here as well.
+ * Per thread, valid until the next call.
+ */
+const char* cclt_last_error();
+
+/*
+ * Optimizes a JPEG in memory. output_size holds the capacity of output
+ * and receives the bytes written. Passing the input size as capacity
+ * makes the call return CCLT_BIGGER as soon as there's no gain.
+ * orientation_flag is one of CCLT_ORIENTATION_*, see transform.h.
+ * marker_policy is a CCLT_KEEP() mask of the APPn/COM classes to copy,
+ * marker_stats, if not NULL, is added the bytes kept and dropped.
+ * progressive_flag is one of CCLT_SCANS_*; progressive_used, if not NULL,
+ * receives 1 when the output is progressive, which tells what AUTO chose.
+ * scan_options, if not NULL, sets how hard progressive outputs search
+ * for a smaller scan script and the entropy coding, see scans.h.
+ * Arithmetic coded inputs come out as Huffman unless arithmetic output
+ * is asked, and return CCLT_RECODED then.
+ */
+extern int cclt_optimize_buffer(unsigned char* input,
+                                unsigned long input_size,
+                                unsigned char* output,
+                                unsigned long* output_size,
+                                unsigned int marker_policy,
+                                int progressive_flag,
+                                int orientation_flag,
+                                const cclt_scan_options* scan_options,
+                                cclt_marker_stats* marker_stats,
+                                int* progressive_used);
+/*
+ * Checks output holds the very coefficients the optimization of input
+ * gives, orientation_flag being the one passed to it. Returns CCLT_OK or
+ * CCLT_ERROR on any difference. Much cheaper than decoding the pixels.
+ */
+extern int cclt_verify_buffer(unsigned char* input,
+                              unsigned long input_size,
+                              unsigned char* output,
+                              unsigned long output_size,
+                              int orientation_flag);
 
 #endif
@@ -24,6 +24,13 @@
 #include "caesiumph.h"
 #include "utils.h"
 #include "preferencedialog.h"
+#include "cworker.h"
+#include "cjobserver.h"
+#include "cremoteworker.h"
+#include "chttpserver.h"
+#include "cpipe.h"
+#include "carchive.h"
+#include "caudit.h"
 #include <QApplication>
 #include <QStyleFactory>
 #include <QFile>
@@ -31,21 +38,29 @@
 #include <QTranslator>
 #include <QSettings>
 #include <QStandardPaths>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <stdio.h>
+#include <string.h>
 
 void logHandler(QtMsgType type, const QMessageLogContext &context, const QString &msg) {
-    //TODO Close the file?
+    //Opened once and shared by every thread, messages come from the workers too
+    static QMutex mutex;
+    static QFile file(logPath);
+    QMutexLocker locker(&mutex);
+
     QByteArray localMsg = msg.toUtf8();
+    QByteArray time = QTime::currentTime().toString("hh:mm:ss.zzz").toLocal8Bit();
 
     QString logMessage;
 
-    QFile *file = new QFile(logPath);
-
-    if (file->open(QFile::Append | QIODevice::Text)) {
-        QTextStream out(file);
+    if (file.isOpen() || file.open(QFile::Append | QIODevice::Text)) {
+        QTextStream out(&file);
         switch (type) {
         case QtDebugMsg:
             logMessage.sprintf("[%s] [DEBUG] %s \n(%s:%u, %s)\n",
-                               QStringToChar(QTime::currentTime().toString("hh:mm:ss.zzz")),
+                               time.constData(),
                                localMsg.constData(),
                                context.file,
                                context.line,
@@ -54,19 +69,19 @@ void logHandler(QtMsgType type, const QMessageLogContext &context, const QString
             break;
         case QtInfoMsg:
             logMessage.sprintf("[%s] [INFO] %s\n",
-                               QStringToChar(QTime::currentTime().toString("hh:mm:ss.zzz")),
+                               time.constData(),
                                localMsg.constData());
             out << logMessage;
             break;
         case QtWarningMsg:
             logMessage.sprintf("[%s] [WARNING] %s\n",
-                               QStringToChar(QTime::currentTime().toString("hh:mm:ss.zzz")),
+                               time.constData(),
                                localMsg.constData());
             out << logMessage;
             break;
         case QtCriticalMsg:
             logMessage.sprintf("[%s] [CRITICAL] %s \n(%s:%u, %s)\n",
-                               QStringToChar(QTime::currentTime().toString("hh:mm:ss.zzz")),
+                               time.constData(),
                                localMsg.constData(),
                                context.file,
                                context.line,
@@ -75,29 +90,59 @@ void logHandler(QtMsgType type, const QMessageLogContext &context, const QString
             break;
         case QtFatalMsg:
             logMessage.sprintf("[%s] [FATAL] %s \n(%s:%u, %s)\n",
-                               QStringToChar(QTime::currentTime().toString("hh:mm:ss.zzz")),
+                               time.constData(),
                                localMsg.constData(),
                                context.file,
                                context.line,
                                context.function);
             out << logMessage;
+            out.flush();
+            file.flush();
             abort();
-
-        out.flush();
         }
+        //Still readable if the process dies
+        out.flush();
+        file.flush();
     } else {
-        qCritical() << "Cannot log to file.";
+        fprintf(stderr, "Cannot log to file.\n");
     }
 }
 
 int main(int argc, char *argv[]) {
-    qInstallMessageHandler(logHandler);
-    QApplication a(argc, argv);
-
+    //Settings are found by these, headless modes included
     QCoreApplication::setApplicationName("CaesiumPH");
     QCoreApplication::setOrganizationName("SaeraSoft");
     QCoreApplication::setOrganizationDomain("saerasoft.com");
 
+    //Headless modes have no window and log to stderr, which the GUI forwards for workers
+    if (argc > 1 && strcmp(argv[1], WORKER_ARGUMENT) == 0) {
+        QCoreApplication a(argc, argv);
+        return runWorker();
+    }
+    if (argc > 1 && strcmp(argv[1], REMOTE_ARGUMENT) == 0) {
+        QCoreApplication a(argc, argv);
+        return runRemoteWorker(a.arguments());
+    }
+    if (argc > 1 && strcmp(argv[1], HTTP_ARGUMENT) == 0) {
+        QCoreApplication a(argc, argv);
+        return runHttpServer(a.arguments());
+    }
+    if (argc > 1 && strcmp(argv[1], ARCHIVE_ARGUMENT) == 0) {
+        QCoreApplication a(argc, argv);
+        return runArchive(a.arguments());
+    }
+    if (argc > 1 && strcmp(argv[1], AUDIT_ARGUMENT) == 0) {
+        QCoreApplication a(argc, argv);
+        return runAudit(a.arguments());
+    }
+    if (argc > 1 && strcmp(argv[1], PIPE_ARGUMENT) == 0) {
+        QCoreApplication a(argc, argv);
+        return runPipe(a.arguments());
+    }
+
+    qInstallMessageHandler(logHandler);
+    QApplication a(argc, argv);
+
     QSettings settings;
 
     qInfo() << "----------------- CaesiumPH session started at "
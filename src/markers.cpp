@@ -0,0 +1,307 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <jpeglib.h>
+
+#include "markers.h"
+#include "lossless.h"
+#include "transform.h"
+#include "tiff.h"
+
+//Longest signature we look at is the extended XMP one
+#define CCLT_MARKER_SIGNATURE 40
+
+//EXIF tags locating the IFDs and the thumbnail
+#define EXIF_TAG_SUB_IFDS 0x014A
+#define EXIF_TAG_EXIF_IFD 0x8769
+#define EXIF_TAG_GPS_IFD 0x8825
+#define EXIF_TAG_INTEROP_IFD 0xA005
+#define EXIF_TAG_THUMBNAIL_OFFSET 0x0201
+#define EXIF_TAG_THUMBNAIL_LENGTH 0x0202
+
+//Classes each APPn can hold, drives how much of it is saved
+static const unsigned int cclt_app_classes[16] = {
+    CCLT_KEEP(CCLT_MARKER_JFIF) | CCLT_KEEP(CCLT_MARKER_JFXX) | CCLT_KEEP(CCLT_MARKER_OTHER),
+    CCLT_KEEP(CCLT_MARKER_EXIF) | CCLT_KEEP(CCLT_MARKER_XMP) | CCLT_KEEP(CCLT_MARKER_OTHER),
+    CCLT_KEEP(CCLT_MARKER_ICC) | CCLT_KEEP(CCLT_MARKER_MPF) | CCLT_KEEP(CCLT_MARKER_OTHER),
+    CCLT_KEEP(CCLT_MARKER_OTHER), CCLT_KEEP(CCLT_MARKER_OTHER),
+    CCLT_KEEP(CCLT_MARKER_OTHER), CCLT_KEEP(CCLT_MARKER_OTHER),
+    CCLT_KEEP(CCLT_MARKER_OTHER), CCLT_KEEP(CCLT_MARKER_OTHER),
+    CCLT_KEEP(CCLT_MARKER_OTHER), CCLT_KEEP(CCLT_MARKER_OTHER),
+    CCLT_KEEP(CCLT_MARKER_OTHER), CCLT_KEEP(CCLT_MARKER_OTHER),
+    CCLT_KEEP(CCLT_MARKER_IPTC) | CCLT_KEEP(CCLT_MARKER_OTHER),
+    CCLT_KEEP(CCLT_MARKER_ADOBE) | CCLT_KEEP(CCLT_MARKER_OTHER),
+    CCLT_KEEP(CCLT_MARKER_OTHER)
+};
+
+/*
+ * JFIF is rewritten by the encoder and Adobe tells the decoder the
+ * color transform in use, neither is up to the policy
+ */
+#define CCLT_KEEP_REQUIRED (CCLT_KEEP(CCLT_MARKER_JFIF) | CCLT_KEEP(CCLT_MARKER_ADOBE))
+
+static int cclt_has_signature(jpeg_saved_marker_ptr marker, const char* signature, unsigned int length) {
+    return marker->data_length >= length && memcmp(marker->data, signature, length) == 0;
+}
+
+int cclt_marker_class(jpeg_saved_marker_ptr marker) {
+    switch (marker->marker) {
+    case JPEG_APP0:
+        if (cclt_has_signature(marker, "JFIF\0", 5)) {
+            return CCLT_MARKER_JFIF;
+        }
+        if (cclt_has_signature(marker, "JFXX\0", 5)) {
+            return CCLT_MARKER_JFXX;
+        }
+        break;
+    case JPEG_APP0 + 1:
+        if (cclt_has_signature(marker, "Exif\0", 5)) {
+            return CCLT_MARKER_EXIF;
+        }
+        if (cclt_has_signature(marker, "http://ns.adobe.com/xap/1.0/\0", 29) ||
+                cclt_has_signature(marker, "http://ns.adobe.com/xmp/extension/\0", 35)) {
+            return CCLT_MARKER_XMP;
+        }
+        break;
+    case JPEG_APP0 + 2:
+        if (cclt_has_signature(marker, "ICC_PROFILE\0", 12)) {
+            return CCLT_MARKER_ICC;
+        }
+        if (cclt_has_signature(marker, "MPF\0", 4)) {
+            return CCLT_MARKER_MPF;
+        }
+        break;
+    case JPEG_APP0 + 13:
+        if (cclt_has_signature(marker, "Photoshop 3.0\0", 14)) {
+            return CCLT_MARKER_IPTC;
+        }
+        break;
+    case JPEG_APP0 + 14:
+        if (cclt_has_signature(marker, "Adobe", 5)) {
+            return CCLT_MARKER_ADOBE;
+        }
+        break;
+    case JPEG_COM:
+        return CCLT_MARKER_COM;
+    default:
+        break;
+    }
+    return CCLT_MARKER_OTHER;
+}
+
+const char* cclt_marker_class_name(int marker_class) {
+    static const char* names[CCLT_MARKER_CLASSES] = {
+        "JFIF", "JFXX", "EXIF", "XMP", "ICC", "MPF", "IPTC", "Adobe", "COM", "APPn"
+    };
+    return marker_class >= 0 && marker_class < CCLT_MARKER_CLASSES ? names[marker_class] : "?";
+}
+
+//End of a sub IFD pointed by tag, 0 if broken, or the current end if missing
+static unsigned int cclt_sub_ifd_end(cclt_tiff* t, unsigned int ifd, unsigned int tag, unsigned int end) {
+    unsigned int sub;
+    if (!cclt_tiff_value(t, cclt_tiff_find(t, ifd, tag), &sub)) {
+        return end;
+    }
+    unsigned int sub_end = cclt_tiff_ifd_end(t, sub);
+    if (sub_end == 0) {
+        return 0;
+    }
+    return sub_end > end ? sub_end : end;
+}
+
+//IFD1 thumbnail of an EXIF, offsets into its TIFF
+typedef struct {
+    unsigned int link; //Of IFD0, points to IFD1
+    unsigned int ifd1;
+    unsigned int offset;
+    unsigned int length;
+    unsigned int length_entry;
+    unsigned int end; //Of everything but the thumbnail
+} cclt_thumbnail;
+
+/*
+ * Finds the IFD1 thumbnail of an EXIF marker. It has to follow everything
+ * else in the TIFF, so that it can be cut off or resized without moving
+ * any other offset; returns 0 otherwise.
+ */
+static int cclt_find_thumbnail(jpeg_saved_marker_ptr marker, cclt_tiff* t, cclt_thumbnail* thumb) {
+    unsigned int ifd0 = cclt_tiff_open(marker, t);
+    if (ifd0 == 0 || (thumb->link = cclt_tiff_link(t, ifd0)) == 0 ||
+            (thumb->ifd1 = cclt_tiff_get32(t, thumb->link)) == 0 || cclt_tiff_link(t, thumb->ifd1) == 0 ||
+            cclt_tiff_find(t, ifd0, EXIF_TAG_SUB_IFDS) != 0) {
+        return 0;
+    }
+    unsigned int offset_entry = cclt_tiff_find(t, thumb->ifd1, EXIF_TAG_THUMBNAIL_OFFSET);
+    thumb->length_entry = cclt_tiff_find(t, thumb->ifd1, EXIF_TAG_THUMBNAIL_LENGTH);
+    if (!cclt_tiff_value(t, offset_entry, &thumb->offset) || !cclt_tiff_value(t, thumb->length_entry, &thumb->length) ||
+            thumb->length < 4 || thumb->offset > t->length || thumb->length > t->length - thumb->offset) {
+        return 0;
+    }
+
+    unsigned int end = cclt_tiff_ifd_end(t, ifd0);
+    unsigned int exif_ifd;
+    if (end != 0) {
+        end = cclt_sub_ifd_end(t, ifd0, EXIF_TAG_EXIF_IFD, end);
+        end = cclt_sub_ifd_end(t, ifd0, EXIF_TAG_GPS_IFD, end);
+    }
+    if (end != 0 && cclt_tiff_value(t, cclt_tiff_find(t, ifd0, EXIF_TAG_EXIF_IFD), &exif_ifd)) {
+        end = cclt_sub_ifd_end(t, exif_ifd, EXIF_TAG_INTEROP_IFD, end);
+    }
+    thumb->end = end;
+    return end != 0 && thumb->offset >= end;
+}
+
+unsigned int cclt_exif_thumbnail_length(jpeg_saved_marker_ptr marker) {
+    cclt_tiff t;
+    cclt_thumbnail thumb;
+    return cclt_find_thumbnail(marker, &t, &thumb) ? thumb.length : 0;
+}
+
+//Drops or shrinks the IFD1 thumbnail of an EXIF marker, returns the new payload length and points data to it
+static unsigned int cclt_exif_thumbnail(j_decompress_ptr srcinfo,
+                                        jpeg_saved_marker_ptr marker,
+                                        unsigned int policy,
+                                        JOCTET** data) {
+    cclt_tiff t;
+    cclt_thumbnail thumb;
+
+    *data = marker->data;
+    if (!cclt_find_thumbnail(marker, &t, &thumb)) {
+        return marker->data_length;
+    }
+
+    if (policy & CCLT_THUMBNAIL_DROP) {
+        //Unlink IFD1 in a copy, the saved marker stays as it was read
+        *data = (JOCTET*) (*srcinfo->mem->alloc_large)((j_common_ptr) srcinfo, JPOOL_IMAGE, 6 + thumb.end);
+        memcpy(*data, marker->data, 6 + thumb.end);
+        t.tiff = *data + 6;
+        cclt_tiff_put32(&t, thumb.link, 0);
+        return 6 + thumb.end;
+    }
+
+    //Optimizing keeps IFD1, so it can't be past the thumbnail either
+    unsigned int ifd1_end = cclt_tiff_ifd_end(&t, thumb.ifd1);
+    if (ifd1_end == 0 || thumb.offset < ifd1_end ||
+            GETJOCTET(t.tiff[thumb.offset]) != 0xFF || GETJOCTET(t.tiff[thumb.offset + 1]) != 0xD8) {
+        return marker->data_length;
+    }
+
+    //Thumbnails have to stay baseline
+    JOCTET* thumbnail = (JOCTET*) (*srcinfo->mem->alloc_large)((j_common_ptr) srcinfo, JPOOL_IMAGE, thumb.length);
+    unsigned long thumbnail_size = thumb.length;
+    if (cclt_optimize_buffer(t.tiff + thumb.offset, thumb.length, thumbnail, &thumbnail_size,
+                             CCLT_KEEP_NONE, CCLT_SCANS_BASELINE, CCLT_ORIENTATION_KEEP, NULL, NULL, NULL) != CCLT_OK) {
+        //Anything past the declared length goes anyway
+        return 6 + thumb.offset + thumb.length;
+    }
+
+    *data = (JOCTET*) (*srcinfo->mem->alloc_large)((j_common_ptr) srcinfo, JPOOL_IMAGE, 6 + thumb.offset + thumbnail_size);
+    memcpy(*data, marker->data, 6 + thumb.offset);
+    memcpy(*data + 6 + thumb.offset, thumbnail, thumbnail_size);
+    t.tiff = *data + 6;
+    t.length = thumb.offset + thumbnail_size;
+    cclt_tiff_set_value(&t, thumb.length_entry, thumbnail_size);
+    return 6 + thumb.offset + thumbnail_size;
+}
+
+void cclt_save_markers(j_decompress_ptr srcinfo, unsigned int policy, int full_app1) {
+    policy |= CCLT_KEEP_REQUIRED;
+    for (int m = 0; m < 16; m++) {
+        int full = (policy & cclt_app_classes[m]) != 0 || (m == 1 && full_app1);
+        jpeg_save_markers(srcinfo, JPEG_APP0 + m, full ? 0xFFFF : CCLT_MARKER_SIGNATURE);
+    }
+    jpeg_save_markers(srcinfo, JPEG_COM, (policy & CCLT_KEEP(CCLT_MARKER_COM)) ? 0xFFFF : CCLT_MARKER_SIGNATURE);
+}
+
+cclt_marker_payload* cclt_prepare_markers(j_decompress_ptr srcinfo, unsigned int policy) {
+    jpeg_saved_marker_ptr marker;
+    cclt_marker_payload* payloads = NULL;
+
+    if (!(policy & (CCLT_THUMBNAIL_DROP | CCLT_THUMBNAIL_OPTIMIZE))) {
+        return NULL;
+    }
+    policy |= CCLT_KEEP_REQUIRED;
+    for (marker = srcinfo->marker_list; marker != NULL; marker = marker->next) {
+        if (cclt_marker_class(marker) != CCLT_MARKER_EXIF || !(policy & CCLT_KEEP(CCLT_MARKER_EXIF)) ||
+                marker->data_length != marker->original_length) {
+            continue;
+        }
+        JOCTET* data;
+        unsigned int length = cclt_exif_thumbnail(srcinfo, marker, policy, &data);
+        if (data == marker->data && length == marker->data_length) {
+            continue;
+        }
+        cclt_marker_payload* payload = (cclt_marker_payload*) (*srcinfo->mem->alloc_small)
+                ((j_common_ptr) srcinfo, JPOOL_IMAGE, sizeof(cclt_marker_payload));
+        payload->marker = marker;
+        payload->data = data;
+        payload->length = length;
+        payload->next = payloads;
+        payloads = payload;
+    }
+    return payloads;
+}
+
+void cclt_copy_markers(j_decompress_ptr srcinfo,
+                       j_compress_ptr dstinfo,
+                       unsigned int policy,
+                       const cclt_marker_payload* payloads,
+                       cclt_marker_stats* stats) {
+    jpeg_saved_marker_ptr marker;
+
+    policy |= CCLT_KEEP_REQUIRED;
+    for (marker = srcinfo->marker_list; marker != NULL; marker = marker->next) {
+        int marker_class = cclt_marker_class(marker);
+        unsigned long bytes = marker->original_length + 4;
+
+        //The encoder already wrote its own
+        if ((marker_class == CCLT_MARKER_JFIF && dstinfo->write_JFIF_header) ||
+                (marker_class == CCLT_MARKER_ADOBE && dstinfo->write_Adobe_marker)) {
+            if (stats != NULL) {
+                stats->kept[marker_class] += bytes;
+            }
+            continue;
+        }
+
+        //Truncated markers were meant to be dropped
+        if ((policy & CCLT_KEEP(marker_class)) && marker->data_length == marker->original_length) {
+            JOCTET* data = marker->data;
+            unsigned int length = marker->data_length;
+            for (const cclt_marker_payload* payload = payloads; payload != NULL; payload = payload->next) {
+                if (payload->marker == marker) {
+                    data = payload->data;
+                    length = payload->length;
+                }
+            }
+            jpeg_write_marker(dstinfo, marker->marker, data, length);
+            if (stats != NULL) {
+                stats->kept[marker_class] += length + 4;
+                stats->dropped[marker_class] += marker->data_length - length;
+            }
+        } else if (stats != NULL) {
+            stats->dropped[marker_class] += bytes;
+        }
+    }
+}
@@ -0,0 +1,97 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef CCLT_MARKERS
+#define CCLT_MARKERS
+
+#include <stdio.h>
+#include <jpeglib.h>
+
+//Marker classes, told apart by marker code and signature
+#define CCLT_MARKER_JFIF 0
+#define CCLT_MARKER_JFXX 1 //JFIF extension, thumbnails
+#define CCLT_MARKER_EXIF 2
+#define CCLT_MARKER_XMP 3
+#define CCLT_MARKER_ICC 4
+#define CCLT_MARKER_MPF 5 //Multi-picture, like the depth map of phones
+#define CCLT_MARKER_IPTC 6 //Photoshop APP13
+#define CCLT_MARKER_ADOBE 7
+#define CCLT_MARKER_COM 8
+#define CCLT_MARKER_OTHER 9 //Vendor APPn
+#define CCLT_MARKER_CLASSES 10
+
+//Policy bits, a marker is copied if the bit of its class is set
+#define CCLT_KEEP(c) (1U << (c))
+#define CCLT_KEEP_NONE 0U
+#define CCLT_KEEP_ALL ((1U << CCLT_MARKER_CLASSES) - 1)
+
+//What happens to the IFD1 thumbnail of a kept EXIF, it's left alone by default
+#define CCLT_THUMBNAIL_DROP (1U << 16)
+#define CCLT_THUMBNAIL_OPTIMIZE (1U << 17) //Lossless, trailing bytes after its EOI go too
+
+//Bytes per class, each marker counts with its 4 bytes of header. Thumbnail savings are EXIF bytes dropped.
+typedef struct {
+    unsigned long kept[CCLT_MARKER_CLASSES];
+    unsigned long dropped[CCLT_MARKER_CLASSES];
+} cclt_marker_stats;
+
+int cclt_marker_class(jpeg_saved_marker_ptr marker);
+const char* cclt_marker_class_name(int marker_class);
+
+/*
+ * Sets up marker saving before jpeg_read_header. Markers the policy
+ * drops are saved only up to their signature, enough to classify and
+ * count them. full_app1 forces whole APP1s, to read the EXIF orientation.
+ */
+void cclt_save_markers(j_decompress_ptr srcinfo, unsigned int policy, int full_app1);
+
+/*
+ * Payload a kept marker is written with instead of the saved one, like
+ * an EXIF without its thumbnail or with a smaller one
+ */
+typedef struct cclt_marker_payload {
+    jpeg_saved_marker_ptr marker;
+    JOCTET* data;
+    unsigned int length;
+    struct cclt_marker_payload* next;
+} cclt_marker_payload;
+
+//Bytes of the IFD1 thumbnail of an EXIF marker that CCLT_THUMBNAIL_* can act on, 0 if none
+unsigned int cclt_exif_thumbnail_length(jpeg_saved_marker_ptr marker);
+
+/*
+ * Drops or optimizes the EXIF thumbnails the policy asks for, once per
+ * file after jpeg_read_header: every encoder of the file then writes the
+ * same payloads. NULL if no marker changes. Memory goes with the image
+ * pool of srcinfo.
+ */
+cclt_marker_payload* cclt_prepare_markers(j_decompress_ptr srcinfo, unsigned int policy);
+
+//Writes the saved markers the policy keeps, right after jpeg_write_coefficients
+void cclt_copy_markers(j_decompress_ptr srcinfo,
+                       j_compress_ptr dstinfo,
+                       unsigned int policy,
+                       const cclt_marker_payload* payloads,
+                       cclt_marker_stats* stats);
+
+#endif
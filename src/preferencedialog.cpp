@@ -25,8 +25,12 @@
 #include "ui_preferencedialog.h"
 #include "caesiumph.h"
 #include "utils.h"
+#include "ciouring.h"
+#include "lossless.h"
+#include "transform.h"
 
 #include <QCloseEvent>
+#include <QFile>
 #include <QSettings>
 #include <QMessageBox>
 #include <QFileDialog>
@@ -49,6 +53,11 @@ PreferenceDialog::PreferenceDialog(QWidget *parent) :
     //If we want a custom folder, show the browse button
     ui->browseButton->setVisible(ui->outputFileMethodComboBox->currentIndex() == 2);
 
+    //Batched reads are Linux only
+    ui->ioUringCheckBox->setVisible(CIOUring::isSupported());
+    //Some libjpeg builds leave arithmetic coding out
+    ui->arithmeticCheckBox->setVisible(cclt_arithmetic_supported());
+
     //Override the item delegate for styling QComboBox on OSX
     QStyledItemDelegate* itemDelegate = new QStyledItemDelegate();
     ui->languageComboBox->setItemDelegate(itemDelegate);
@@ -85,6 +94,38 @@ void PreferenceDialog::writePreferences() {
     settings.setValue(KEY_PREF_COMPRESSION_EXIF_DATE, ui->keepDateCheckBox->isChecked());
     settings.setValue(KEY_PREF_COMPRESSION_EXIF_COMMENT, ui->keepCommentsCheckBox->isChecked());
     settings.setValue(KEY_PREF_COMPRESSION_PROGRESSIVE, ui->progressiveCheckBox->isChecked());
+    settings.setValue(KEY_PREF_COMPRESSION_PROGRESSIVE_AUTO, ui->progressiveAutoCheckBox->isChecked());
+    settings.setValue(KEY_PREF_COMPRESSION_ORIENTATION, ui->orientationCheckBox->isChecked());
+    settings.setValue(KEY_PREF_COMPRESSION_ORIENTATION_TRIM, ui->orientationTrimCheckBox->isChecked());
+    settings.setValue(KEY_PREF_COMPRESSION_KEEP_ICC, ui->keepIccCheckBox->isChecked());
+    settings.setValue(KEY_PREF_COMPRESSION_KEEP_XMP, ui->keepXmpCheckBox->isChecked());
+    settings.setValue(KEY_PREF_COMPRESSION_KEEP_IPTC, ui->keepIptcCheckBox->isChecked());
+    settings.setValue(KEY_PREF_COMPRESSION_KEEP_MPF, ui->keepMpfCheckBox->isChecked());
+    settings.setValue(KEY_PREF_COMPRESSION_KEEP_COM, ui->keepComCheckBox->isChecked());
+    settings.setValue(KEY_PREF_COMPRESSION_KEEP_OTHER, ui->keepOtherCheckBox->isChecked());
+    settings.setValue(KEY_PREF_COMPRESSION_EXIF_THUMBNAIL, ui->exifThumbnailComboBox->currentIndex());
+    settings.setValue(KEY_PREF_COMPRESSION_ALREADY_OPTIMIZED, ui->alreadyOptimizedComboBox->currentIndex());
+    settings.setValue(KEY_PREF_COMPRESSION_EFFORT, ui->effortComboBox->currentIndex());
+    settings.setValue(KEY_PREF_COMPRESSION_ARITHMETIC, ui->arithmeticCheckBox->isChecked());
+    settings.endGroup();
+
+    //Advanced
+    settings.beginGroup(KEY_PREF_GROUP_ADVANCED);
+    settings.setValue(KEY_PREF_ADVANCED_TRACE, ui->traceCheckBox->isChecked());
+    settings.setValue(KEY_PREF_ADVANCED_FSYNC, ui->fsyncCheckBox->isChecked());
+    settings.setValue(KEY_PREF_ADVANCED_HARDLINK, ui->hardlinkCheckBox->isChecked());
+    settings.setValue(KEY_PREF_ADVANCED_IO_LIMIT, ui->ioLimitSpinBox->value());
+    settings.setValue(KEY_PREF_ADVANCED_IO_URING, ui->ioUringCheckBox->isChecked());
+    settings.setValue(KEY_PREF_ADVANCED_THREADS, ui->threadsSpinBox->value());
+    settings.setValue(KEY_PREF_ADVANCED_AFFINITY, ui->affinityLineEdit->text());
+    settings.setValue(KEY_PREF_ADVANCED_BACKGROUND, ui->backgroundCheckBox->isChecked());
+    settings.setValue(KEY_PREF_ADVANCED_VERIFY, ui->verifyCheckBox->isChecked());
+    settings.setValue(KEY_PREF_ADVANCED_PROCESSES, ui->processesCheckBox->isChecked());
+    settings.setValue(KEY_PREF_ADVANCED_REMOTE_PORT, ui->remotePortSpinBox->value());
+    settings.setValue(KEY_PREF_ADVANCED_REMOTE_TOKEN, ui->remoteTokenLineEdit->text());
+    settings.setValue(KEY_PREF_ADVANCED_SCAN_BUDGET, ui->scanBudgetSpinBox->value());
+    settings.setValue(KEY_PREF_ADVANCED_SCAN_SCRIPTS, ui->scanScriptsLineEdit->text());
+    settings.setValue(KEY_PREF_ADVANCED_REMOTE_SHARED, ui->remoteSharedCheckBox->isChecked());
     settings.endGroup();
 }
 
@@ -106,6 +147,41 @@ void PreferenceDialog::readPreferences() {
     ui->keepDateCheckBox->setChecked(settings.value(KEY_PREF_COMPRESSION_EXIF_DATE).value<bool>());
     ui->keepCommentsCheckBox->setChecked(settings.value(KEY_PREF_COMPRESSION_EXIF_COMMENT).value<bool>());
     ui->progressiveCheckBox->setChecked(settings.value(KEY_PREF_COMPRESSION_PROGRESSIVE).value<bool>());
+    ui->progressiveAutoCheckBox->setChecked(settings.value(KEY_PREF_COMPRESSION_PROGRESSIVE_AUTO).value<bool>());
+    ui->orientationCheckBox->setChecked(settings.value(KEY_PREF_COMPRESSION_ORIENTATION).value<bool>());
+    ui->orientationTrimCheckBox->setChecked(settings.value(KEY_PREF_COMPRESSION_ORIENTATION_TRIM).value<bool>());
+    //Color profiles are kept unless told otherwise
+    ui->keepIccCheckBox->setChecked(settings.value(KEY_PREF_COMPRESSION_KEEP_ICC, true).value<bool>());
+    ui->keepXmpCheckBox->setChecked(settings.value(KEY_PREF_COMPRESSION_KEEP_XMP).value<bool>());
+    ui->keepIptcCheckBox->setChecked(settings.value(KEY_PREF_COMPRESSION_KEEP_IPTC).value<bool>());
+    ui->keepMpfCheckBox->setChecked(settings.value(KEY_PREF_COMPRESSION_KEEP_MPF).value<bool>());
+    ui->keepComCheckBox->setChecked(settings.value(KEY_PREF_COMPRESSION_KEEP_COM).value<bool>());
+    ui->keepOtherCheckBox->setChecked(settings.value(KEY_PREF_COMPRESSION_KEEP_OTHER).value<bool>());
+    ui->exifThumbnailComboBox->setCurrentIndex(settings.value(KEY_PREF_COMPRESSION_EXIF_THUMBNAIL).value<int>());
+    ui->alreadyOptimizedComboBox->setCurrentIndex(settings.value(KEY_PREF_COMPRESSION_ALREADY_OPTIMIZED).value<int>());
+    ui->effortComboBox->setCurrentIndex(settings.value(KEY_PREF_COMPRESSION_EFFORT).value<int>());
+    ui->arithmeticCheckBox->setChecked(settings.value(KEY_PREF_COMPRESSION_ARITHMETIC).value<bool>());
+    ui->orientationTrimCheckBox->setEnabled(ui->orientationCheckBox->isChecked());
+    ui->progressiveCheckBox->setEnabled(!ui->progressiveAutoCheckBox->isChecked());
+    settings.endGroup();
+
+    //Advanced
+    settings.beginGroup(KEY_PREF_GROUP_ADVANCED);
+    ui->traceCheckBox->setChecked(settings.value(KEY_PREF_ADVANCED_TRACE).value<bool>());
+    ui->fsyncCheckBox->setChecked(settings.value(KEY_PREF_ADVANCED_FSYNC).value<bool>());
+    ui->hardlinkCheckBox->setChecked(settings.value(KEY_PREF_ADVANCED_HARDLINK).value<bool>());
+    ui->ioLimitSpinBox->setValue(settings.value(KEY_PREF_ADVANCED_IO_LIMIT).value<int>());
+    ui->ioUringCheckBox->setChecked(settings.value(KEY_PREF_ADVANCED_IO_URING).value<bool>());
+    ui->threadsSpinBox->setValue(settings.value(KEY_PREF_ADVANCED_THREADS).value<int>());
+    ui->affinityLineEdit->setText(settings.value(KEY_PREF_ADVANCED_AFFINITY).value<QString>());
+    ui->backgroundCheckBox->setChecked(settings.value(KEY_PREF_ADVANCED_BACKGROUND).value<bool>());
+    ui->verifyCheckBox->setChecked(settings.value(KEY_PREF_ADVANCED_VERIFY).value<bool>());
+    ui->processesCheckBox->setChecked(settings.value(KEY_PREF_ADVANCED_PROCESSES).value<bool>());
+    ui->remotePortSpinBox->setValue(settings.value(KEY_PREF_ADVANCED_REMOTE_PORT).value<int>());
+    ui->remoteTokenLineEdit->setText(settings.value(KEY_PREF_ADVANCED_REMOTE_TOKEN).value<QString>());
+    ui->scanBudgetSpinBox->setValue(settings.value(KEY_PREF_ADVANCED_SCAN_BUDGET).value<int>());
+    ui->scanScriptsLineEdit->setText(settings.value(KEY_PREF_ADVANCED_SCAN_SCRIPTS).value<QString>());
+    ui->remoteSharedCheckBox->setChecked(settings.value(KEY_PREF_ADVANCED_REMOTE_SHARED).value<bool>());
     settings.endGroup();
 }
 
@@ -148,6 +224,16 @@ void PreferenceDialog::on_keepCommentsCheckBox_toggled(bool checked) {
     ui->exifCheckBox->setCheckState(getExifsCheckBoxGroupState());
 }
 
+void PreferenceDialog::on_orientationCheckBox_toggled(bool checked) {
+    //Cropping only matters when turning images
+    ui->orientationTrimCheckBox->setEnabled(checked);
+}
+
+void PreferenceDialog::on_progressiveAutoCheckBox_toggled(bool checked) {
+    //Each file gets whichever is smaller
+    ui->progressiveCheckBox->setEnabled(!checked);
+}
+
 enum Qt::CheckState PreferenceDialog::getExifsCheckBoxGroupState() {
     if (ui->keepDateCheckBox->isChecked() &&
             ui->keepCommentsCheckBox->isChecked() &&
@@ -180,3 +266,106 @@ void PreferenceDialog::on_languageComboBox_currentIndexChanged(int index) {
 void PreferenceDialog::on_menuListWidget_currentRowChanged(int currentRow) {
     ui->stackedWidget->setCurrentIndex(currentRow);
 }
+
+void readParams() {
+    //Read important parameters from settings
+    QSettings settings;
+
+    settings.beginGroup(KEY_PREF_GROUP_COMPRESSION);
+    params.exif = settings.value(KEY_PREF_COMPRESSION_EXIF).value<int>();
+    if (settings.value(KEY_PREF_COMPRESSION_PROGRESSIVE_AUTO).value<bool>()) {
+        params.progressive = CCLT_SCANS_AUTO;
+    } else if (settings.value(KEY_PREF_COMPRESSION_PROGRESSIVE).value<bool>()) {
+        params.progressive = CCLT_SCANS_PROGRESSIVE;
+    } else {
+        params.progressive = CCLT_SCANS_BASELINE;
+    }
+    if (!settings.value(KEY_PREF_COMPRESSION_ORIENTATION).value<bool>()) {
+        params.orientation = CCLT_ORIENTATION_KEEP;
+    } else if (settings.value(KEY_PREF_COMPRESSION_ORIENTATION_TRIM).value<bool>()) {
+        params.orientation = CCLT_ORIENTATION_TRIM;
+    } else {
+        params.orientation = CCLT_ORIENTATION_PERFECT;
+    }
+    //Metadata to copy, JFIF and Adobe markers are always kept by the engine
+    params.markers = CCLT_KEEP_NONE;
+    if (params.exif == 2) {
+        params.markers |= CCLT_KEEP(CCLT_MARKER_EXIF);
+        //Keep, optimize or drop the thumbnail
+        switch (settings.value(KEY_PREF_COMPRESSION_EXIF_THUMBNAIL).value<int>()) {
+        case 1:
+            params.markers |= CCLT_THUMBNAIL_OPTIMIZE;
+            break;
+        case 2:
+            params.markers |= CCLT_THUMBNAIL_DROP;
+            break;
+        default:
+            break;
+        }
+    }
+    if (settings.value(KEY_PREF_COMPRESSION_KEEP_ICC, true).value<bool>()) {
+        params.markers |= CCLT_KEEP(CCLT_MARKER_ICC);
+    }
+    if (settings.value(KEY_PREF_COMPRESSION_KEEP_XMP).value<bool>()) {
+        params.markers |= CCLT_KEEP(CCLT_MARKER_XMP);
+    }
+    if (settings.value(KEY_PREF_COMPRESSION_KEEP_IPTC).value<bool>()) {
+        params.markers |= CCLT_KEEP(CCLT_MARKER_IPTC);
+    }
+    if (settings.value(KEY_PREF_COMPRESSION_KEEP_MPF).value<bool>()) {
+        params.markers |= CCLT_KEEP(CCLT_MARKER_MPF);
+    }
+    if (settings.value(KEY_PREF_COMPRESSION_KEEP_COM).value<bool>()) {
+        params.markers |= CCLT_KEEP(CCLT_MARKER_COM);
+    }
+    if (settings.value(KEY_PREF_COMPRESSION_KEEP_OTHER).value<bool>()) {
+        params.markers |= CCLT_KEEP(CCLT_MARKER_JFXX) | CCLT_KEEP(CCLT_MARKER_OTHER);
+    }
+    params.alreadyOptimized = settings.value(KEY_PREF_COMPRESSION_ALREADY_OPTIMIZED).value<int>();
+    params.effort = settings.value(KEY_PREF_COMPRESSION_EFFORT).value<int>();
+    params.arithmetic = settings.value(KEY_PREF_COMPRESSION_ARITHMETIC).value<bool>() && cclt_arithmetic_supported();
+    params.importantExifs.clear();
+    if (settings.value(KEY_PREF_COMPRESSION_EXIF_COPYRIGHT).value<bool>()) {
+        params.importantExifs.append(EXIF_COPYRIGHT);
+    }
+    if (settings.value(KEY_PREF_COMPRESSION_EXIF_DATE).value<bool>()) {
+        params.importantExifs.append(EXIF_DATE);
+    }
+    if (settings.value(KEY_PREF_COMPRESSION_EXIF_COMMENT).value<bool>()) {
+        params.importantExifs.append(EXIF_COMMENTS);
+    }
+    settings.endGroup();
+
+    settings.beginGroup(KEY_PREF_GROUP_GENERAL);
+    params.overwrite = settings.value(KEY_PREF_GENERAL_OVERWRITE).value<bool>();
+    params.outMethodIndex = settings.value(KEY_PREF_GENERAL_OUTPUT_METHOD).value<int>();
+    params.outMethodString = settings.value(KEY_PREF_GENERAL_OUTPUT_STRING).value<QString>();
+    settings.endGroup();
+
+    settings.beginGroup(KEY_PREF_GROUP_ADVANCED);
+    params.trace = settings.value(KEY_PREF_ADVANCED_TRACE).value<bool>();
+    params.fsync = settings.value(KEY_PREF_ADVANCED_FSYNC).value<bool>();
+    params.hardlink = settings.value(KEY_PREF_ADVANCED_HARDLINK).value<bool>();
+    params.ioLimit = settings.value(KEY_PREF_ADVANCED_IO_LIMIT).value<int>();
+    params.ioUring = settings.value(KEY_PREF_ADVANCED_IO_URING).value<bool>();
+    params.threads = settings.value(KEY_PREF_ADVANCED_THREADS).value<int>();
+    params.affinity = settings.value(KEY_PREF_ADVANCED_AFFINITY).value<QString>();
+    params.background = settings.value(KEY_PREF_ADVANCED_BACKGROUND).value<bool>();
+    params.verify = settings.value(KEY_PREF_ADVANCED_VERIFY).value<bool>();
+    params.processes = settings.value(KEY_PREF_ADVANCED_PROCESSES).value<bool>();
+    params.remotePort = settings.value(KEY_PREF_ADVANCED_REMOTE_PORT).value<int>();
+    params.remoteToken = settings.value(KEY_PREF_ADVANCED_REMOTE_TOKEN).value<QString>();
+    params.remoteShared = settings.value(KEY_PREF_ADVANCED_REMOTE_SHARED).value<bool>();
+    params.scanBudget = settings.value(KEY_PREF_ADVANCED_SCAN_BUDGET).value<int>();
+    //Scripts are read once per batch, jobs carry their text
+    params.scanScripts.clear();
+    foreach (QString path, settings.value(KEY_PREF_ADVANCED_SCAN_SCRIPTS).value<QString>().split(';', QString::SkipEmptyParts)) {
+        QFile script(path.trimmed());
+        if (script.open(QIODevice::ReadOnly)) {
+            params.scanScripts.append(script.readAll());
+        } else {
+            qWarning() << "Failed to read scan script" << path;
+        }
+    }
+    settings.endGroup();
+}
@@ -31,6 +31,7 @@
 #define KEY_PREF_GROUP_GENERAL QString("PreferenceGeneral/")
 #define KEY_PREF_GROUP_COMPRESSION QString("PreferenceCompression/")
 #define KEY_PREF_GROUP_PRIVACY QString("PreferencePrivacy/")
+#define KEY_PREF_GROUP_ADVANCED QString("PreferenceAdvanced/")
 #define KEY_PREF_GROUP_GEOMETRY QString("WindowGeometry/")
 
 //General group keys
@@ -48,6 +49,36 @@
 #define KEY_PREF_COMPRESSION_EXIF_DATE QString("exifDate")
 #define KEY_PREF_COMPRESSION_EXIF_COMMENT QString("exifComment")
 #define KEY_PREF_COMPRESSION_PROGRESSIVE QString("progressive")
+#define KEY_PREF_COMPRESSION_PROGRESSIVE_AUTO QString("progressiveAuto")
+#define KEY_PREF_COMPRESSION_ORIENTATION QString("orientation")
+#define KEY_PREF_COMPRESSION_ORIENTATION_TRIM QString("orientationTrim")
+#define KEY_PREF_COMPRESSION_KEEP_ICC QString("keepIcc")
+#define KEY_PREF_COMPRESSION_KEEP_XMP QString("keepXmp")
+#define KEY_PREF_COMPRESSION_KEEP_IPTC QString("keepIptc")
+#define KEY_PREF_COMPRESSION_KEEP_MPF QString("keepMpf")
+#define KEY_PREF_COMPRESSION_KEEP_COM QString("keepCom")
+#define KEY_PREF_COMPRESSION_KEEP_OTHER QString("keepOther")
+#define KEY_PREF_COMPRESSION_EXIF_THUMBNAIL QString("exifThumbnail")
+#define KEY_PREF_COMPRESSION_ALREADY_OPTIMIZED QString("alreadyOptimized")
+#define KEY_PREF_COMPRESSION_EFFORT QString("effort")
+#define KEY_PREF_COMPRESSION_ARITHMETIC QString("arithmetic")
+
+//Advanced group keys
+#define KEY_PREF_ADVANCED_TRACE QString("trace")
+#define KEY_PREF_ADVANCED_FSYNC QString("fsync")
+#define KEY_PREF_ADVANCED_HARDLINK QString("hardlink")
+#define KEY_PREF_ADVANCED_IO_LIMIT QString("ioLimit")
+#define KEY_PREF_ADVANCED_IO_URING QString("ioUring")
+#define KEY_PREF_ADVANCED_THREADS QString("threads")
+#define KEY_PREF_ADVANCED_AFFINITY QString("affinity")
+#define KEY_PREF_ADVANCED_BACKGROUND QString("background")
+#define KEY_PREF_ADVANCED_VERIFY QString("verify")
+#define KEY_PREF_ADVANCED_PROCESSES QString("processes")
+#define KEY_PREF_ADVANCED_REMOTE_PORT QString("remotePort")
+#define KEY_PREF_ADVANCED_REMOTE_TOKEN QString("remoteToken")
+#define KEY_PREF_ADVANCED_REMOTE_SHARED QString("remoteShared")
+#define KEY_PREF_ADVANCED_SCAN_BUDGET QString("scanBudget")
+#define KEY_PREF_ADVANCED_SCAN_SCRIPTS QString("scanScripts")
 
 //Geometry group keys
 #define KEY_PREF_GEOMETRY_SIZE QString("size")
@@ -57,6 +88,9 @@
 #define KEY_PREF_GEOMETRY_SORT_ORDER QString("sortOrder")
 #define KEY_PREF_GEOMETRY_SORT_COLUMN QString("sortColumn")
 
+//Fills params from the saved preferences, for the window and the headless modes
+void readParams();
+
 namespace Ui {
 class PreferenceDialog;
 }
@@ -80,6 +114,8 @@ private slots:
     void on_keepCopyrightCheckBox_toggled(bool checked);
     void on_keepDateCheckBox_toggled(bool checked);
     void on_keepCommentsCheckBox_toggled(bool checked);
+    void on_orientationCheckBox_toggled(bool checked);
+    void on_progressiveAutoCheckBox_toggled(bool checked);
     void on_languageComboBox_currentIndexChanged(int index);
 
     void on_menuListWidget_currentRowChanged(int currentRow);
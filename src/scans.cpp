@@ -0,0 +1,298 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <jpeglib.h>
+
+#include "scans.h"
+#include "lossless.h"
+
+static void cclt_scan_add(cclt_scan_candidate* candidate, int comps, const int* index, int ss, int se, int ah, int al) {
+    jpeg_scan_info* scan = candidate->scans + candidate->num_scans++;
+    scan->comps_in_scan = comps;
+    for (int i = 0; i < comps; i++) {
+        scan->component_index[i] = index[i];
+    }
+    scan->Ss = ss;
+    scan->Se = se;
+    scan->Ah = ah;
+    scan->Al = al;
+}
+
+/*
+ * A family of progressive scripts:
+ * dc_interleaved  one DC scan for all the components, or one each
+ * dc_al           DC bits sent later in a refinement scan
+ * split           luma AC in two bands, 1..split and the rest; 0 for one band
+ * ac_al           AC bits sent later, one refinement scan per bit
+ */
+static void cclt_scan_build(cclt_scan_candidate* candidate, const char* name, int num_components,
+                            int dc_interleaved, int dc_al, int split, int ac_al) {
+    int all[MAX_COMPS_IN_SCAN] = {0, 1, 2, 3};
+    candidate->name = name;
+    candidate->progressive = 1;
+
+    //Interleaved scans take up to four components
+    dc_interleaved = dc_interleaved && num_components <= MAX_COMPS_IN_SCAN;
+
+    if (dc_interleaved) {
+        cclt_scan_add(candidate, num_components, all, 0, 0, 0, dc_al);
+    } else {
+        for (int ci = 0; ci < num_components; ci++) {
+            cclt_scan_add(candidate, 1, &ci, 0, 0, 0, dc_al);
+        }
+    }
+
+    //First pass of every AC band, high bits only if successive approximation is on
+    for (int ci = 0; ci < num_components; ci++) {
+        if (ci == 0 && split > 0) {
+            cclt_scan_add(candidate, 1, &ci, 1, split, 0, ac_al);
+            cclt_scan_add(candidate, 1, &ci, split + 1, 63, 0, ac_al);
+        } else {
+            cclt_scan_add(candidate, 1, &ci, 1, 63, 0, ac_al);
+        }
+    }
+
+    //Refinements, the DC ones are interleaved whenever allowed
+    for (int al = dc_al; al > 0; al--) {
+        if (dc_interleaved) {
+            cclt_scan_add(candidate, num_components, all, 0, 0, al, al - 1);
+        } else {
+            for (int ci = 0; ci < num_components; ci++) {
+                cclt_scan_add(candidate, 1, &ci, 0, 0, al, al - 1);
+            }
+        }
+    }
+    for (int al = ac_al; al > 0; al--) {
+        for (int ci = 0; ci < num_components; ci++) {
+            cclt_scan_add(candidate, 1, &ci, 1, 63, al, al - 1);
+        }
+    }
+}
+
+//Generated candidates, in the order they are tried
+static const struct {
+    const char* name;
+    int effort;
+    int dc_interleaved, dc_al, split, ac_al;
+} cclt_scan_family[] = {
+    {"spectral", CCLT_EFFORT_DEFAULT, 1, 0, 0, 0},
+    {"spectral split 5", CCLT_EFFORT_DEFAULT, 1, 0, 5, 0},
+    {"approximation 1", CCLT_EFFORT_DEFAULT, 1, 1, 0, 1},
+    {"spectral split 2", CCLT_EFFORT_MAX, 1, 0, 2, 0},
+    {"spectral split 9", CCLT_EFFORT_MAX, 1, 0, 9, 0},
+    {"split 2 approximation 1", CCLT_EFFORT_MAX, 1, 1, 2, 1},
+    {"split 5 approximation 1", CCLT_EFFORT_MAX, 1, 1, 5, 1},
+    {"split 9 approximation 1", CCLT_EFFORT_MAX, 1, 1, 9, 1},
+    {"approximation 2", CCLT_EFFORT_MAX, 1, 1, 0, 2},
+    {"split 5 approximation 2", CCLT_EFFORT_MAX, 1, 1, 5, 2},
+    {"separate DC", CCLT_EFFORT_MAX, 0, 0, 0, 0},
+    {"separate DC split 5 approximation 1", CCLT_EFFORT_MAX, 0, 1, 5, 1}
+};
+
+static int cclt_scan_list(int progressive_flag,
+                          int num_components,
+                          const cclt_scan_options* options,
+                          cclt_scan_candidate* candidates,
+                          int max) {
+    int count = 0;
+    int effort = options != NULL ? options->effort : CCLT_EFFORT_FAST;
+
+    if (max < 3 || num_components < 1 || num_components > MAX_COMPS_IN_SCAN) {
+        return 0;
+    }
+    memset(candidates, 0, max * sizeof(cclt_scan_candidate));
+
+    if (progressive_flag == CCLT_SCANS_BASELINE) {
+        candidates[0].name = "baseline";
+        return 1;
+    }
+
+    candidates[count].name = "simple";
+    candidates[count].progressive = 1;
+    candidates[count++].simple = 1;
+
+    if (progressive_flag == CCLT_SCANS_AUTO) {
+        candidates[count++].name = "baseline";
+    }
+
+    if (effort == CCLT_EFFORT_FAST) {
+        return count;
+    }
+
+    for (unsigned int i = 0; i < sizeof(cclt_scan_family) / sizeof(cclt_scan_family[0]) && count < max; i++) {
+        //Separate DC scans are the same as an interleaved one on grayscale
+        if (cclt_scan_family[i].effort > effort ||
+                (num_components == 1 && !cclt_scan_family[i].dc_interleaved)) {
+            continue;
+        }
+        cclt_scan_build(candidates + count++, cclt_scan_family[i].name, num_components,
+                        cclt_scan_family[i].dc_interleaved, cclt_scan_family[i].dc_al,
+                        cclt_scan_family[i].split, cclt_scan_family[i].ac_al);
+    }
+
+    for (int i = 0; effort == CCLT_EFFORT_MAX && i < options->script_count && count < max; i++) {
+        cclt_scan_candidate* candidate = candidates + count;
+        candidate->name = "user script";
+        candidate->progressive = 1;
+        candidate->num_scans = cclt_parse_scan_script(options->scripts[i], candidate->scans, CCLT_MAX_SCANS);
+        if (candidate->num_scans > 0) {
+            count++;
+        }
+    }
+    return count;
+}
+
+int cclt_scan_candidates(int progressive_flag,
+                         int num_components,
+                         const cclt_scan_options* options,
+                         cclt_scan_candidate* candidates,
+                         int max) {
+    int count = cclt_scan_list(progressive_flag, num_components, options, candidates, max);
+    for (int i = 0; i < count; i++) {
+        candidates[i].arithmetic = options != NULL && options->arithmetic && cclt_arithmetic_supported();
+    }
+    return count;
+}
+
+//Skips blanks and # comments
+static const char* cclt_script_skip(const char* p) {
+    for (;;) {
+        while (isspace((unsigned char) *p)) {
+            p++;
+        }
+        if (*p != '#') {
+            return p;
+        }
+        while (*p != '\0' && *p != '\n') {
+            p++;
+        }
+    }
+}
+
+static int cclt_script_int(const char** p, int* value) {
+    const char* start = cclt_script_skip(*p);
+    char* end;
+    long v = strtol(start, &end, 10);
+    if (end == start || v < 0 || v > 63) {
+        return 0;
+    }
+    *value = (int) v;
+    *p = cclt_script_skip(end);
+    return 1;
+}
+
+//Expects the separator c, blanks and comments around it are fine
+static int cclt_script_expect(const char** p, char c) {
+    const char* q = cclt_script_skip(*p);
+    if (*q != c) {
+        return 0;
+    }
+    *p = cclt_script_skip(q + 1);
+    return 1;
+}
+
+int cclt_parse_scan_script(const char* text, jpeg_scan_info* scans, int max) {
+    const char* p = cclt_script_skip(text);
+    int count = 0;
+
+    while (*p != '\0') {
+        jpeg_scan_info* scan = scans + count;
+        int value;
+        if (count == max) {
+            return 0;
+        }
+
+        //Component indexes, separated by blanks or commas
+        scan->comps_in_scan = 0;
+        while (cclt_script_int(&p, &value)) {
+            if (scan->comps_in_scan == MAX_COMPS_IN_SCAN) {
+                return 0;
+            }
+            scan->component_index[scan->comps_in_scan++] = value;
+            if (*p == ',') {
+                p++;
+            }
+        }
+        if (scan->comps_in_scan == 0) {
+            return 0;
+        }
+
+        //The whole spectrum at full precision if no parameters follow
+        scan->Ss = 0;
+        scan->Se = 63;
+        scan->Ah = 0;
+        scan->Al = 0;
+        if (cclt_script_expect(&p, ':')) {
+            if (!cclt_script_int(&p, &scan->Ss) || !cclt_script_expect(&p, '-') ||
+                    !cclt_script_int(&p, &scan->Se) || !cclt_script_expect(&p, ',') ||
+                    !cclt_script_int(&p, &scan->Ah) || !cclt_script_expect(&p, ',') ||
+                    !cclt_script_int(&p, &scan->Al)) {
+                return 0;
+            }
+        }
+        count++;
+
+        //The last scan may leave out its semicolon
+        if (!cclt_script_expect(&p, ';') && *p != '\0') {
+            return 0;
+        }
+    }
+    return count;
+}
+
+void cclt_scan_apply(j_compress_ptr cinfo, const cclt_scan_candidate* candidate) {
+#ifdef CCLT_MOZJPEG
+    //mozjpeg searches the scans itself from the simple progression, and would take any other script as its template
+    if (jpeg_c_bool_param_supported(cinfo, JBOOLEAN_OPTIMIZE_SCANS)) {
+        jpeg_c_set_bool_param(cinfo, JBOOLEAN_OPTIMIZE_SCANS, candidate->simple ? TRUE : FALSE);
+    }
+#endif
+#ifdef C_ARITH_CODING_SUPPORTED
+    //Arithmetic coding adapts to the image as it goes, there are no tables to optimize
+    cinfo->arith_code = candidate->arithmetic ? TRUE : FALSE;
+    if (candidate->arithmetic) {
+        cinfo->optimize_coding = FALSE;
+    }
+#endif
+    if (!candidate->progressive) {
+        cinfo->scan_info = NULL;
+        cinfo->num_scans = 0;
+    } else if (candidate->simple) {
+        jpeg_simple_progression(cinfo);
+    } else {
+        cinfo->scan_info = candidate->scans;
+        cinfo->num_scans = candidate->num_scans;
+    }
+}
+
+int cclt_arithmetic_supported() {
+#ifdef C_ARITH_CODING_SUPPORTED
+    return 1;
+#else
+    return 0;
+#endif
+}
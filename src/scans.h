@@ -0,0 +1,87 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef CCLT_SCANS
+#define CCLT_SCANS
+
+#include <stdio.h>
+#include <jpeglib.h>
+
+//How hard progressive outputs look for a smaller scan script
+#define CCLT_EFFORT_FAST 0 //jpeg_simple_progression only
+#define CCLT_EFFORT_DEFAULT 1 //A few scripts that often beat it
+#define CCLT_EFFORT_MAX 2 //Every candidate and the user scripts, as long as the time budget allows
+
+//Room for the scans of the generated candidates and of user scripts
+#define CCLT_MAX_SCANS 64
+#define CCLT_MAX_CANDIDATES 32
+
+typedef struct {
+    int effort; //CCLT_EFFORT_*
+    int budget_ms; //Per file, candidates not started by then are skipped; 0 for no limit
+    const char* const* scripts; //Text of jpegtran -scans files, tried at CCLT_EFFORT_MAX
+    int script_count;
+    int arithmetic; //Arithmetic coded output, see cclt_arithmetic_supported()
+} cclt_scan_options;
+
+typedef struct {
+    const char* name; //For traces
+    int progressive;
+    int simple; //jpeg_simple_progression, the optimize_scans search of mozjpeg on CCLT_MOZJPEG builds
+    int arithmetic;
+    int num_scans;
+    jpeg_scan_info scans[CCLT_MAX_SCANS];
+} cclt_scan_candidate;
+
+/*
+ * Candidates for progressive_flag (CCLT_SCANS_*) on an image of
+ * num_components, the first one being what CCLT_EFFORT_FAST would
+ * write. Returns how many were filled, at most max.
+ */
+int cclt_scan_candidates(int progressive_flag,
+                         int num_components,
+                         const cclt_scan_options* options,
+                         cclt_scan_candidate* candidates,
+                         int max);
+
+/*
+ * Parses a scan script in the jpegtran -scans syntax:
+ *
+ *   0,1,2: 0-0, 0, 1;  # components: Ss-Se, Ah, Al
+ *   0: 1-63, 0, 0;
+ *
+ * Returns the scan count, 0 if malformed. Whether the scans make a valid
+ * progression is left to libjpeg.
+ */
+int cclt_parse_scan_script(const char* text, jpeg_scan_info* scans, int max);
+
+//Sets the scans and the entropy coding of cinfo, after jpeg_copy_critical_parameters
+void cclt_scan_apply(j_compress_ptr cinfo, const cclt_scan_candidate* candidate);
+
+/*
+ * Whether the library encodes arithmetic coding. Readers need a libjpeg
+ * built with it too: browsers don't decode it.
+ */
+int cclt_arithmetic_supported();
+
+#endif
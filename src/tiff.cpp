@@ -0,0 +1,168 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <jpeglib.h>
+
+#include "tiff.h"
+
+unsigned int cclt_tiff_get16(cclt_tiff* t, unsigned int offset) {
+    if (t->motorola) {
+        return (GETJOCTET(t->tiff[offset]) << 8) | GETJOCTET(t->tiff[offset + 1]);
+    }
+    return GETJOCTET(t->tiff[offset]) | (GETJOCTET(t->tiff[offset + 1]) << 8);
+}
+
+unsigned int cclt_tiff_get32(cclt_tiff* t, unsigned int offset) {
+    if (t->motorola) {
+        return (cclt_tiff_get16(t, offset) << 16) | cclt_tiff_get16(t, offset + 2);
+    }
+    return cclt_tiff_get16(t, offset) | (cclt_tiff_get16(t, offset + 2) << 16);
+}
+
+void cclt_tiff_put16(cclt_tiff* t, unsigned int offset, unsigned int value) {
+    if (t->motorola) {
+        t->tiff[offset] = (JOCTET) ((value >> 8) & 0xFF);
+        t->tiff[offset + 1] = (JOCTET) (value & 0xFF);
+    } else {
+        t->tiff[offset] = (JOCTET) (value & 0xFF);
+        t->tiff[offset + 1] = (JOCTET) ((value >> 8) & 0xFF);
+    }
+}
+
+void cclt_tiff_put32(cclt_tiff* t, unsigned int offset, unsigned int value) {
+    if (t->motorola) {
+        cclt_tiff_put16(t, offset, value >> 16);
+        cclt_tiff_put16(t, offset + 2, value & 0xFFFF);
+    } else {
+        cclt_tiff_put16(t, offset, value & 0xFFFF);
+        cclt_tiff_put16(t, offset + 2, value >> 16);
+    }
+}
+
+unsigned int cclt_tiff_open(jpeg_saved_marker_ptr marker, cclt_tiff* t) {
+    if (marker->marker != JPEG_APP0 + 1 || marker->data_length < 6 + 8 ||
+            memcmp(marker->data, "Exif\0\0", 6) != 0) {
+        return 0;
+    }
+    t->tiff = marker->data + 6;
+    t->length = marker->data_length - 6;
+    if (t->tiff[0] == 'M' && t->tiff[1] == 'M') {
+        t->motorola = 1;
+    } else if (t->tiff[0] == 'I' && t->tiff[1] == 'I') {
+        t->motorola = 0;
+    } else {
+        return 0;
+    }
+    //Offsets come from the file, adding to them could wrap
+    unsigned int ifd = cclt_tiff_get32(t, 4);
+    return ifd <= t->length && t->length - ifd >= 2 ? ifd : 0;
+}
+
+//End of the entry table of the IFD at ifd, 0 if it doesn't fit in the buffer
+static unsigned long long cclt_tiff_table_end(cclt_tiff* t, unsigned int ifd) {
+    if (ifd == 0 || ifd > t->length || t->length - ifd < 2) {
+        return 0;
+    }
+    unsigned long long end = (unsigned long long) ifd + 2 + cclt_tiff_get16(t, ifd) * 12ULL;
+    return end <= t->length ? end : 0;
+}
+
+unsigned int cclt_tiff_find(cclt_tiff* t, unsigned int ifd, unsigned int tag) {
+    if (cclt_tiff_table_end(t, ifd) == 0) {
+        return 0;
+    }
+    unsigned int count = cclt_tiff_get16(t, ifd);
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned long long entry = (unsigned long long) ifd + 2 + i * 12ULL;
+        if (entry + 12 > t->length) {
+            return 0;
+        }
+        if (cclt_tiff_get16(t, (unsigned int) entry) == tag) {
+            return (unsigned int) entry;
+        }
+    }
+    return 0;
+}
+
+int cclt_tiff_value(cclt_tiff* t, unsigned int entry, unsigned int* value) {
+    if (entry == 0 || cclt_tiff_get32(t, entry + 4) != 1) {
+        return 0;
+    }
+    unsigned int type = cclt_tiff_get16(t, entry + 2);
+    if (type == TIFF_SHORT) {
+        *value = cclt_tiff_get16(t, entry + 8);
+    } else if (type == TIFF_LONG) {
+        *value = cclt_tiff_get32(t, entry + 8);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+void cclt_tiff_set_value(cclt_tiff* t, unsigned int entry, unsigned int value) {
+    unsigned int current;
+    if (!cclt_tiff_value(t, entry, &current)) {
+        return;
+    }
+    if (cclt_tiff_get16(t, entry + 2) == TIFF_SHORT) {
+        cclt_tiff_put16(t, entry + 8, value);
+    } else {
+        cclt_tiff_put32(t, entry + 8, value);
+    }
+}
+
+unsigned int cclt_tiff_link(cclt_tiff* t, unsigned int ifd) {
+    unsigned long long link = cclt_tiff_table_end(t, ifd);
+    return link != 0 && link + 4 <= t->length ? (unsigned int) link : 0;
+}
+
+unsigned int cclt_tiff_ifd_end(cclt_tiff* t, unsigned int ifd) {
+    //Bytes per value, indexed by type
+    static const unsigned int sizes[13] = {0, 1, 1, 2, 4, 8, 1, 1, 2, 4, 8, 4, 8};
+
+    unsigned int link = cclt_tiff_link(t, ifd);
+    if (link == 0) {
+        return 0;
+    }
+    unsigned long long end = (unsigned long long) link + 4;
+    for (unsigned int entry = ifd + 2; entry < link; entry += 12) {
+        unsigned int type = cclt_tiff_get16(t, entry + 2);
+        if (type == 0 || type > 12) {
+            return 0;
+        }
+        unsigned long long size = (unsigned long long) sizes[type] * cclt_tiff_get32(t, entry + 4);
+        if (size <= 4) {
+            continue;
+        }
+        unsigned long long data_end = cclt_tiff_get32(t, entry + 8) + size;
+        if (data_end > t->length) {
+            return 0;
+        }
+        if (data_end > end) {
+            end = data_end;
+        }
+    }
+    return (unsigned int) end;
+}
@@ -0,0 +1,68 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef CCLT_TIFF
+#define CCLT_TIFF
+
+#include <stdio.h>
+#include <jpeglib.h>
+
+//TIFF types
+#define TIFF_SHORT 3
+#define TIFF_LONG 4
+
+/*
+ * Minimal TIFF reader over the APP1 payload, just enough to walk the
+ * IFDs and patch a few single value tags in place
+ */
+typedef struct {
+    JOCTET* tiff;
+    unsigned int length;
+    int motorola;
+} cclt_tiff;
+
+unsigned int cclt_tiff_get16(cclt_tiff* t, unsigned int offset);
+unsigned int cclt_tiff_get32(cclt_tiff* t, unsigned int offset);
+void cclt_tiff_put16(cclt_tiff* t, unsigned int offset, unsigned int value);
+void cclt_tiff_put32(cclt_tiff* t, unsigned int offset, unsigned int value);
+
+//Sets up t over an "Exif\0\0" APP1 marker, returns the IFD0 offset or 0
+unsigned int cclt_tiff_open(jpeg_saved_marker_ptr marker, cclt_tiff* t);
+
+//Offset of the entry for tag in the IFD at ifd, 0 if missing
+unsigned int cclt_tiff_find(cclt_tiff* t, unsigned int ifd, unsigned int tag);
+
+//Offset of the word linking the IFD at ifd to the next one, 0 if out of bounds
+unsigned int cclt_tiff_link(cclt_tiff* t, unsigned int ifd);
+
+//Single SHORT or LONG value of the entry, they are stored inline
+int cclt_tiff_value(cclt_tiff* t, unsigned int entry, unsigned int* value);
+void cclt_tiff_set_value(cclt_tiff* t, unsigned int entry, unsigned int value);
+
+/*
+ * End of the IFD at ifd and of the values it stores out of line, the
+ * IFDs it points to are not followed. 0 if anything is out of bounds.
+ */
+unsigned int cclt_tiff_ifd_end(cclt_tiff* t, unsigned int ifd);
+
+#endif
@@ -0,0 +1,249 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <jpeglib.h>
+
+#include "transform.h"
+#include "tiff.h"
+
+//EXIF tags touched by the transform
+#define EXIF_TAG_ORIENTATION 0x0112
+#define EXIF_TAG_EXIF_IFD 0x8769
+#define EXIF_TAG_PIXEL_X 0xA002
+#define EXIF_TAG_PIXEL_Y 0xA003
+
+static long cclt_div_round_up(long a, long b) {
+    return (a + b - 1L) / b;
+}
+
+static long cclt_round_up(long a, long b) {
+    return cclt_div_round_up(a, b) * b;
+}
+
+int cclt_exif_orientation(j_decompress_ptr srcinfo) {
+    jpeg_saved_marker_ptr marker;
+    cclt_tiff t;
+
+    for (marker = srcinfo->marker_list; marker != NULL; marker = marker->next) {
+        unsigned int ifd = cclt_tiff_open(marker, &t);
+        unsigned int orientation;
+        if (ifd != 0 && cclt_tiff_value(&t, cclt_tiff_find(&t, ifd, EXIF_TAG_ORIENTATION), &orientation)) {
+            return orientation >= 1 && orientation <= 8 ? (int) orientation : 0;
+        }
+    }
+    return 0;
+}
+
+//Image is upright now: Orientation goes back to normal and the size follows the pixels
+static void cclt_exif_reset(j_decompress_ptr srcinfo, JDIMENSION width, JDIMENSION height) {
+    jpeg_saved_marker_ptr marker;
+    cclt_tiff t;
+
+    for (marker = srcinfo->marker_list; marker != NULL; marker = marker->next) {
+        unsigned int ifd = cclt_tiff_open(marker, &t);
+        if (ifd == 0) {
+            continue;
+        }
+        cclt_tiff_set_value(&t, cclt_tiff_find(&t, ifd, EXIF_TAG_ORIENTATION), 1);
+
+        unsigned int exif_ifd;
+        if (cclt_tiff_value(&t, cclt_tiff_find(&t, ifd, EXIF_TAG_EXIF_IFD), &exif_ifd) &&
+                exif_ifd <= t.length && t.length - exif_ifd >= 2) {
+            cclt_tiff_set_value(&t, cclt_tiff_find(&t, exif_ifd, EXIF_TAG_PIXEL_X), width);
+            cclt_tiff_set_value(&t, cclt_tiff_find(&t, exif_ifd, EXIF_TAG_PIXEL_Y), height);
+        }
+    }
+}
+
+int cclt_transform_request(j_decompress_ptr srcinfo, cclt_transform* transform, int orientation, int trim) {
+    //Transpose, mirror along the width, mirror along the height; indexed by orientation
+    static const int steps[9][3] = {
+        {0, 0, 0}, {0, 0, 0},
+        {0, 1, 0}, //2 Mirror horizontal
+        {0, 1, 1}, //3 Rotate 180
+        {0, 0, 1}, //4 Mirror vertical
+        {1, 0, 0}, //5 Transpose
+        {1, 0, 1}, //6 Rotate 90 CW
+        {1, 1, 1}, //7 Transverse
+        {1, 1, 0}  //8 Rotate 270 CW
+    };
+
+    if (orientation < 2 || orientation > 8) {
+        return 0;
+    }
+    transform->transpose = steps[orientation][0];
+    transform->flip_x = steps[orientation][1];
+    transform->flip_y = steps[orientation][2];
+    transform->width = srcinfo->image_width;
+    transform->height = srcinfo->image_height;
+
+    /*
+     * Mirroring needs whole iMCUs: partial blocks at the right or bottom
+     * edge would end up on the opposite side, where the decoder doesn't
+     * expect padding. Either skip the whole transform or cut them off.
+     */
+    int max_h = 1, max_v = 1;
+    for (int ci = 0; ci < srcinfo->num_components; ci++) {
+        jpeg_component_info* compptr = srcinfo->comp_info + ci;
+        max_h = compptr->h_samp_factor > max_h ? compptr->h_samp_factor : max_h;
+        max_v = compptr->v_samp_factor > max_v ? compptr->v_samp_factor : max_v;
+    }
+    JDIMENSION imcu_width = max_h * DCTSIZE;
+    JDIMENSION imcu_height = max_v * DCTSIZE;
+
+    if ((transform->flip_x && transform->width % imcu_width != 0) ||
+            (transform->flip_y && transform->height % imcu_height != 0)) {
+        if (!trim) {
+            return 0;
+        }
+        if (transform->flip_x) {
+            transform->width -= transform->width % imcu_width;
+        }
+        if (transform->flip_y) {
+            transform->height -= transform->height % imcu_height;
+        }
+        if (transform->width == 0 || transform->height == 0) {
+            return 0;
+        }
+    }
+
+    //Destination arrays in the transformed geometry
+    int dst_max_h = transform->transpose ? max_v : max_h;
+    int dst_max_v = transform->transpose ? max_h : max_v;
+    JDIMENSION dst_width = transform->transpose ? transform->height : transform->width;
+    JDIMENSION dst_height = transform->transpose ? transform->width : transform->height;
+
+    transform->dst_arrays = (jvirt_barray_ptr*) (*srcinfo->mem->alloc_small)
+            ((j_common_ptr) srcinfo, JPOOL_IMAGE, sizeof(jvirt_barray_ptr) * srcinfo->num_components);
+    for (int ci = 0; ci < srcinfo->num_components; ci++) {
+        jpeg_component_info* compptr = srcinfo->comp_info + ci;
+        int h = transform->transpose ? compptr->v_samp_factor : compptr->h_samp_factor;
+        int v = transform->transpose ? compptr->h_samp_factor : compptr->v_samp_factor;
+        long width_in_blocks = cclt_div_round_up((long) dst_width * h, (long) dst_max_h * DCTSIZE);
+        long height_in_blocks = cclt_div_round_up((long) dst_height * v, (long) dst_max_v * DCTSIZE);
+        transform->dst_arrays[ci] = (*srcinfo->mem->request_virt_barray)
+                ((j_common_ptr) srcinfo, JPOOL_IMAGE, FALSE,
+                 (JDIMENSION) cclt_round_up(width_in_blocks, h),
+                 (JDIMENSION) cclt_round_up(height_in_blocks, v),
+                 (JDIMENSION) v);
+    }
+    return 1;
+}
+
+jvirt_barray_ptr* cclt_transform_execute(j_decompress_ptr srcinfo,
+                                         j_compress_ptr dstinfo,
+                                         jvirt_barray_ptr* src_arrays,
+                                         cclt_transform* transform) {
+    int max_h = 1, max_v = 1;
+    for (int ci = 0; ci < srcinfo->num_components; ci++) {
+        jpeg_component_info* compptr = srcinfo->comp_info + ci;
+        max_h = compptr->h_samp_factor > max_h ? compptr->h_samp_factor : max_h;
+        max_v = compptr->v_samp_factor > max_v ? compptr->v_samp_factor : max_v;
+    }
+
+    //Output geometry
+    dstinfo->image_width = transform->transpose ? transform->height : transform->width;
+    dstinfo->image_height = transform->transpose ? transform->width : transform->height;
+    if (transform->transpose) {
+        for (int ci = 0; ci < dstinfo->num_components; ci++) {
+            jpeg_component_info* compptr = dstinfo->comp_info + ci;
+            int h = compptr->h_samp_factor;
+            compptr->h_samp_factor = compptr->v_samp_factor;
+            compptr->v_samp_factor = h;
+        }
+        //Frequencies swap axes, so do their quantizers
+        for (int qi = 0; qi < NUM_QUANT_TBLS; qi++) {
+            JQUANT_TBL* qtbl = dstinfo->quant_tbl_ptrs[qi];
+            if (qtbl == NULL) {
+                continue;
+            }
+            for (int v = 0; v < DCTSIZE; v++) {
+                for (int u = v + 1; u < DCTSIZE; u++) {
+                    UINT16 q = qtbl->quantval[v * DCTSIZE + u];
+                    qtbl->quantval[v * DCTSIZE + u] = qtbl->quantval[u * DCTSIZE + v];
+                    qtbl->quantval[u * DCTSIZE + v] = q;
+                }
+            }
+        }
+    }
+
+    for (int ci = 0; ci < srcinfo->num_components; ci++) {
+        jpeg_component_info* compptr = srcinfo->comp_info + ci;
+        int src_v = compptr->v_samp_factor;
+        int dst_h = transform->transpose ? compptr->v_samp_factor : compptr->h_samp_factor;
+        int dst_v = transform->transpose ? compptr->h_samp_factor : compptr->v_samp_factor;
+        int dst_max_h = transform->transpose ? max_v : max_h;
+        int dst_max_v = transform->transpose ? max_h : max_v;
+
+        //Blocks covering the kept source area, the mirror pivots on them
+        JDIMENSION src_width = (JDIMENSION) cclt_div_round_up((long) transform->width * compptr->h_samp_factor,
+                                                              (long) max_h * DCTSIZE);
+        JDIMENSION src_height = (JDIMENSION) cclt_div_round_up((long) transform->height * compptr->v_samp_factor,
+                                                               (long) max_v * DCTSIZE);
+        JDIMENSION dst_width = (JDIMENSION) cclt_div_round_up((long) dstinfo->image_width * dst_h,
+                                                              (long) dst_max_h * DCTSIZE);
+        JDIMENSION dst_height = (JDIMENSION) cclt_div_round_up((long) dstinfo->image_height * dst_v,
+                                                               (long) dst_max_v * DCTSIZE);
+
+        for (JDIMENSION dst_row = 0; dst_row < dst_height; dst_row += dst_v) {
+            JBLOCKARRAY dst_buffer = (*srcinfo->mem->access_virt_barray)
+                    ((j_common_ptr) srcinfo, transform->dst_arrays[ci], dst_row, (JDIMENSION) dst_v, TRUE);
+            for (int offset_y = 0; offset_y < dst_v && dst_row + offset_y < dst_height; offset_y++) {
+                JDIMENSION dst_y = dst_row + offset_y;
+                for (JDIMENSION dst_x = 0; dst_x < dst_width; dst_x++) {
+                    JDIMENSION src_x = transform->transpose ? dst_y : dst_x;
+                    JDIMENSION src_y = transform->transpose ? dst_x : dst_y;
+                    if (transform->flip_x) {
+                        src_x = src_width - 1 - src_x;
+                    }
+                    if (transform->flip_y) {
+                        src_y = src_height - 1 - src_y;
+                    }
+
+                    JBLOCKARRAY src_buffer = (*srcinfo->mem->access_virt_barray)
+                            ((j_common_ptr) srcinfo, src_arrays[ci], src_y - src_y % src_v, (JDIMENSION) src_v, FALSE);
+                    JCOEFPTR src = src_buffer[src_y % src_v][src_x];
+                    JCOEFPTR dst = dst_buffer[offset_y][dst_x];
+
+                    //Mirroring negates the odd frequencies along that axis
+                    for (int v = 0; v < DCTSIZE; v++) {
+                        for (int u = 0; u < DCTSIZE; u++) {
+                            int su = transform->transpose ? v : u;
+                            int sv = transform->transpose ? u : v;
+                            JCOEF coef = src[sv * DCTSIZE + su];
+                            if ((transform->flip_x && (su & 1)) != (transform->flip_y && (sv & 1))) {
+                                coef = -coef;
+                            }
+                            dst[v * DCTSIZE + u] = coef;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    cclt_exif_reset(srcinfo, dstinfo->image_width, dstinfo->image_height);
+    return transform->dst_arrays;
+}
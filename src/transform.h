@@ -0,0 +1,70 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef CCLT_TRANSFORM
+#define CCLT_TRANSFORM
+
+#include <stdio.h>
+#include <jpeglib.h>
+
+//Orientation flags
+#define CCLT_ORIENTATION_KEEP 0 //Leave the image as stored
+#define CCLT_ORIENTATION_PERFECT 1 //Turn it upright, unless edge blocks can't follow
+#define CCLT_ORIENTATION_TRIM 2 //Turn it upright, dropping edge blocks that can't follow
+
+/*
+ * Lossless transform implied by the EXIF Orientation tag, applied on
+ * the DCT coefficients: blocks are moved, transposed and have the
+ * sign of their odd frequencies flipped, nothing is requantized.
+ */
+typedef struct {
+    int transpose;
+    int flip_x; //Mirrored along the source width
+    int flip_y; //Mirrored along the source height
+    JDIMENSION width; //Source size kept, smaller than the image when trimming
+    JDIMENSION height;
+    jvirt_barray_ptr* dst_arrays;
+} cclt_transform;
+
+//Orientation (1-8) from the saved APP1 markers, 0 if there's none
+int cclt_exif_orientation(j_decompress_ptr srcinfo);
+
+/*
+ * Call after jpeg_read_header and before jpeg_read_coefficients, the
+ * destination arrays have to be requested before the source ones are
+ * realized. Returns 0 if there's nothing to do, or the edges don't
+ * allow a perfect transform and trimming was not requested.
+ */
+int cclt_transform_request(j_decompress_ptr srcinfo, cclt_transform* transform, int orientation, int trim);
+
+/*
+ * Call after jpeg_copy_critical_parameters: fixes size, sampling and
+ * quantization of dstinfo, moves the coefficients and resets the
+ * Orientation tag. Returns the arrays to pass to jpeg_write_coefficients.
+ */
+jvirt_barray_ptr* cclt_transform_execute(j_decompress_ptr srcinfo,
+                                         j_compress_ptr dstinfo,
+                                         jvirt_barray_ptr* src_arrays,
+                                         cclt_transform* transform);
+
+#endif
@@ -25,12 +25,40 @@
 #include "math.h"
 #include <stdlib.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef __linux__
+#include <linux/fs.h>
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define HAVE_COPY_FILE_RANGE
+#endif
+#endif
+
+#if defined(__APPLE__) && defined(__has_include)
+#if __has_include(<sys/clonefile.h>)
+#include <sys/clonefile.h>
+#define HAVE_CLONEFILE
+#endif
+#endif
+
 #include <QIODevice>
+#include <QFile>
+#include <QFileInfo>
+#include <QCoreApplication>
 #include <QDate>
 #include <QTreeWidgetItem>
 #include <QDirIterator>
 #include <QLibraryInfo>
 #include <QStandardPaths>
+#include <QAtomicInt>
 #include <QDebug>
 
 QString clfFilter = "CaesiumPH List File (*.cphlf)";
@@ -51,7 +79,6 @@ QStringList osAndExtension = QStringList() <<
         #else
             "linux" << ".tar.gz";
         #endif
-QTemporaryDir tempDir;
 QElapsedTimer timer;
 QString lastCPHListPath = "";
 QList<QLocale> locales;
@@ -94,13 +121,6 @@ QString getRatio(qint64 original, qint64 compressed) {
     return QString::number(((float) ((original - compressed) * 100) / (float) original), 'f', 1) + "%";
 }
 
-char* QStringToChar(QString s) {
-    char* c_str = (char*) malloc((s.length() + 1) * sizeof(char));
-    QByteArray bArray = s.toLocal8Bit();
-    strcpy(c_str, bArray.data());
-    return c_str;
-}
-
 QSize getScaledSizeWithRatio(QSize size, int square) {
     int w = size.width();
     int h = size.height();
@@ -122,29 +142,23 @@ double ratioToDouble(QString ratio) {
     return ratio.toDouble();
 }
 
-bool isJPEG(char* path) {
-    FILE* fp;
-    unsigned char* type_buffer = (unsigned char*) malloc(2);
-
-    fp = fopen(path, "r");
-
-    if (fp == NULL) {
+bool isJPEG(QString path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
         qWarning() << "Cannot open" <<  path << "for type detection. Skipping";
         return false;
     }
 
-    if (fread(type_buffer, 1, 2, fp) < 2) {
+    char type[2];
+    if (file.read(type, 2) < 2) {
         qWarning() << "Cannot read" <<  path << "type. Skipping";
         return false;
     }
 
-    fclose(fp);
-
-    if (((int) type_buffer[0] == 0xFF) && ((int) type_buffer[1] == 0xD8)) {
-        free(type_buffer);
+    if ((uchar) type[0] == 0xFF && (uchar) type[1] == 0xD8) {
         return true;
     } else {
-        fprintf(stderr, "Unsupported file type. Skipping.\n");
+        qWarning() << path << "is not a JPEG. Skipping";
         return false;
     }
 }
@@ -200,3 +214,176 @@ void loadLocales() {
     }
     qInfo() << "Found locales" << locales;
 }
+
+QString getTemporaryPath(QString path) {
+    //Counter keeps concurrent jobs writing the same output name apart
+    static QAtomicInt counter;
+    QFileInfo info(path);
+    return info.path() + "/." + info.fileName() + "." +
+            QString::number(QCoreApplication::applicationPid()) + "-" +
+            QString::number(counter.fetchAndAddRelaxed(1)) + ".tmp";
+}
+
+bool replaceFile(QString source, QString destination) {
+    //Atomically swap the destination with source, which must be on the same volume
+#ifdef _WIN32
+    return MoveFileExW((LPCWSTR) source.utf16(),
+                       (LPCWSTR) destination.utf16(),
+                       MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(QFile::encodeName(source).constData(),
+                  QFile::encodeName(destination).constData()) == 0;
+#endif
+}
+
+bool syncFile(QString path) {
+#ifdef _WIN32
+    HANDLE handle = CreateFileW((LPCWSTR) path.utf16(), GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    bool result = FlushFileBuffers(handle) != 0;
+    CloseHandle(handle);
+    return result;
+#else
+    int fd = open(QFile::encodeName(path).constData(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool result = fsync(fd) == 0;
+    close(fd);
+    return result;
+#endif
+}
+
+bool writeFile(QString path, const QByteArray& data, bool sync, std::function<bool(QString)> verify) {
+    /*
+     * Write next to the final file and rename over it when done:
+     * the rename never crosses a filesystem and the target is
+     * always either the old or the new complete file
+     */
+    QString tempPath = getTemporaryPath(path);
+    QFile out(tempPath);
+    if (!out.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    bool written = out.write(data) == data.size();
+    out.close();
+
+    //Keep the original permissions on the replacement
+    if (QFile::exists(path)) {
+        QFile::setPermissions(tempPath, QFile::permissions(path));
+    }
+    //Make sure the data is on disk before the rename makes it visible
+    if (written && sync && !syncFile(tempPath)) {
+        qWarning() << "Failed to sync" << tempPath;
+    }
+    //A rejected file never replaces the old one
+    if (!written || (verify && !verify(tempPath)) || !replaceFile(tempPath, path)) {
+        QFile::remove(tempPath);
+        return false;
+    }
+    //Persist the directory entry too, not supported on Windows
+    if (sync) {
+        syncFile(QFileInfo(path).path());
+    }
+    return true;
+}
+
+#ifdef HAVE_COPY_FILE_RANGE
+static bool copyFileRange(const char* source, const char* destination) {
+    //In-kernel copy, no round trip through user space buffers
+    int in = open(source, O_RDONLY);
+    if (in < 0) {
+        return false;
+    }
+    struct stat info;
+    int out = fstat(in, &info) == 0 ? open(destination, O_WRONLY | O_CREAT | O_EXCL, 0666) : -1;
+    if (out < 0) {
+        close(in);
+        return false;
+    }
+    off_t left = info.st_size;
+    while (left > 0) {
+        ssize_t copied = copy_file_range(in, NULL, out, NULL, left, 0);
+        if (copied <= 0) {
+            break;
+        }
+        left -= copied;
+    }
+    close(out);
+    close(in);
+    if (left > 0) {
+        unlink(destination);
+        return false;
+    }
+    return true;
+}
+#endif
+
+bool cloneFile(QString source, QString destination, bool allowHardLink) {
+    QByteArray in = QFile::encodeName(source);
+    QByteArray out = QFile::encodeName(destination);
+
+#ifndef _WIN32
+    //A previous run already linked the output to this very file, nothing to do
+    struct stat sourceInfo, destinationInfo;
+    if (stat(in.constData(), &sourceInfo) == 0 && stat(out.constData(), &destinationInfo) == 0 &&
+            sourceInfo.st_dev == destinationInfo.st_dev && sourceInfo.st_ino == destinationInfo.st_ino) {
+        return true;
+    }
+#endif
+
+    //Check if the file already exists and remove it
+    if (QFile::exists(destination) && !QFile::remove(destination)) {
+        return false;
+    }
+
+    //Share the data blocks with the source where the filesystem allows it
+#if defined(__linux__) && defined(FICLONE)
+    int inFd = open(in.constData(), O_RDONLY);
+    if (inFd >= 0) {
+        int outFd = open(out.constData(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if (outFd >= 0) {
+            bool cloned = ioctl(outFd, FICLONE, inFd) == 0;
+            close(outFd);
+            close(inFd);
+            if (cloned) {
+                QFile::setPermissions(destination, QFile::permissions(source));
+                return true;
+            }
+            QFile::remove(destination);
+        } else {
+            close(inFd);
+        }
+    }
+#elif defined(HAVE_CLONEFILE)
+    if (clonefile(in.constData(), out.constData(), 0) == 0) {
+        return true;
+    }
+#endif
+
+    //Same file under two names, only when the user asked for it
+    if (allowHardLink) {
+#ifdef _WIN32
+        if (CreateHardLinkW((LPCWSTR) destination.utf16(), (LPCWSTR) source.utf16(), NULL)) {
+            return true;
+        }
+#else
+        if (link(in.constData(), out.constData()) == 0) {
+            return true;
+        }
+#endif
+    }
+
+#ifdef HAVE_COPY_FILE_RANGE
+    if (copyFileRange(in.constData(), out.constData())) {
+        QFile::setPermissions(destination, QFile::permissions(source));
+        return true;
+    }
+#endif
+
+    //Plain copy on everything else
+    return QFile::copy(source, destination);
+}
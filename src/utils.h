@@ -27,10 +27,11 @@
 #include <QList>
 #include <QStringList>
 #include <QSize>
-#include <QTemporaryDir>
 #include <QElapsedTimer>
 #include <QTreeWidgetItem>
 
+#include <functional>
+
 #define MAX_COLUMNS 5
 
 enum cexifs {
@@ -39,6 +40,13 @@ enum cexifs {
     EXIF_COMMENTS
 };
 
+//What happens to files predicted to gain nothing, see inspect.h
+enum optimized_policy {
+    OPTIMIZED_COMPRESS = 0,
+    OPTIMIZED_LAST = 1,
+    OPTIMIZED_SKIP = 2
+};
+
 enum list_columns {
     COLUMN_NAME = 0,
     COLUMN_ORIGINAL_SIZE = 1,
@@ -47,13 +55,48 @@ enum list_columns {
     COLUMN_PATH = 4
 };
 
+//Raw values stored in the list items next to the formatted text
+enum list_roles {
+    ROLE_SIZE = Qt::UserRole, //Bytes, on the size columns
+    ROLE_STATUS = Qt::UserRole + 1, //item_status, on the name column
+    ROLE_PRIORITY = Qt::UserRole + 2, //Compressed before the others in the next batch, on the name column
+    ROLE_BATCH_ID = Qt::UserRole + 3 //Of the last batch the item was in, on the name column
+};
+
+enum item_status {
+    STATUS_PENDING = 0,
+    STATUS_COMPRESSED = 1,
+    STATUS_UNCHANGED = 2, //Output was bigger, original kept
+    STATUS_FAILED = 3
+};
+
 typedef struct var {
     int exif;
     QList<cexifs> importantExifs;
-    int progressive;
+    int progressive; //CCLT_SCANS_*
+    int orientation;
+    unsigned int markers; //CCLT_KEEP() mask of the metadata to copy
+    int alreadyOptimized; //optimized_policy
+    int effort; //CCLT_EFFORT_*, scan script search of progressive outputs
+    bool arithmetic; //Arithmetic coded outputs, Huffman otherwise
     bool overwrite;
     int outMethodIndex;
     QString outMethodString;
+    bool trace;
+    bool fsync;
+    bool hardlink;
+    int ioLimit;
+    bool ioUring;
+    int threads;
+    QString affinity;
+    bool background;
+    bool verify;
+    bool processes;
+    int remotePort;
+    QString remoteToken;
+    bool remoteShared;
+    int scanBudget; //Milliseconds per file for the scan search, 0 for no limit
+    QList<QByteArray> scanScripts; //Contents of the jpegtran -scans files to try
 } cparams;
 
 extern QString clfFilter;
@@ -66,7 +109,6 @@ extern long originalsSize, compressedSize; //Before and after bytes count
 extern int compressedFiles; //Compressed files count
 extern cparams params; //Important parameters
 extern QStringList osAndExtension;
-extern QTemporaryDir tempDir;
 extern QElapsedTimer timer;
 extern QString lastCPHListPath; //Path of the last list saved
 extern QList<QLocale> locales;
@@ -75,13 +117,19 @@ extern QString logPath; //Log file path
 QString toHumanSize(long);
 double humanToDouble(QString);
 QString getRatio(qint64, qint64);
-char* QStringToChar(QString s);
 QSize getScaledSizeWithRatio(QSize size, int square); //Image preview resize
 double ratioToDouble(QString ratio);
-bool isJPEG(char* path);
+bool isJPEG(QString path);
 QString msToFormattedString(qint64);
 bool haveSameRootFolder(QList<QTreeWidgetItem *> items);
 QString toCapitalCase(const QString);
 void loadLocales();
+QString getTemporaryPath(QString path); //Unique sibling of path, for atomic writes
+bool replaceFile(QString source, QString destination);
+bool syncFile(QString path);
+//verify, if set, gets the complete temporary file and can still reject it
+bool writeFile(QString path, const QByteArray& data, bool sync,
+               std::function<bool(QString)> verify = std::function<bool(QString)>());
+bool cloneFile(QString source, QString destination, bool allowHardLink = false);
 
 #endif // UTILS_H
@@ -0,0 +1,180 @@
+/**
+ *
+ * This file is part of CaesiumPH.
+ *
+ * CaesiumPH - A Caesium version featuring lossless JPEG optimization/compression
+ * for photographers and webmasters.
+ *
+ * Copyright (C) 2016 - Matteo Paonessa
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.
+ * If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+/*
+ * Memory regression test of the workers: many generated JPEGs go through
+ * runJob on a thread pool, like a batch, and the resident memory of the
+ * process must not keep growing with the number of files.
+ *
+ *   workermemory [FILES]
+ *
+ * Returns 0 when the growth past the warm-up stays under the bound.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <jpeglib.h>
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#include <QCoreApplication>
+#include <QtConcurrent>
+#include <QFile>
+#include <QDebug>
+
+#include "cworker.h"
+#include "transform.h"
+#include "utils.h"
+
+//Files run before the reference is taken, every thread has its scratch buffer by then
+#define WARMUP_FILES 2000
+//Files between two measures
+#define ROUND_FILES 5000
+//Allowed growth past the warm-up, whatever the number of files
+#define MAX_GROWTH (32 * 1024 * 1024)
+
+//Resident bytes of the process, -1 where it can't be told
+static qint64 residentBytes() {
+#ifdef __linux__
+    QFile statm("/proc/self/statm");
+    if (!statm.open(QIODevice::ReadOnly)) {
+        return -1;
+    }
+    QList<QByteArray> fields = statm.readAll().split(' ');
+    return fields.value(1).toLongLong() * sysconf(_SC_PAGESIZE);
+#else
+    return -1;
+#endif
+}
+
+//A different image for every seed: size, sampling, scans and a comment change with it
+static QByteArray makeJPEG(int seed) {
+    int width = 16 + (seed * 37) % 480;
+    int height = 16 + (seed * 53) % 360;
+    QByteArray pixels(width * height * 3, Qt::Uninitialized);
+    unsigned int noise = seed * 2654435761U;
+    for (int i = 0; i < pixels.size(); i++) {
+        noise = noise * 1103515245U + 12345U;
+        int x = (i / 3) % width;
+        int y = (i / 3) / width;
+        pixels[i] = (char) ((x * (i % 3 + 1) + y * 2 + (noise >> 28)) & 0xFF);
+    }
+
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    unsigned char* buffer = NULL;
+    unsigned long size = 0;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &buffer, &size);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 60 + seed % 40, TRUE);
+    if (seed % 2) {
+        cinfo.comp_info[0].h_samp_factor = cinfo.comp_info[0].v_samp_factor = 1;
+    }
+    if (seed % 3 == 0) {
+        jpeg_simple_progression(&cinfo);
+    }
+    jpeg_start_compress(&cinfo, TRUE);
+    QByteArray comment = "File " + QByteArray::number(seed);
+    jpeg_write_marker(&cinfo, JPEG_COM, (const JOCTET*) comment.constData(), comment.size());
+    while (cinfo.next_scanline < cinfo.image_height) {
+        JSAMPROW row = (JSAMPROW) pixels.data() + cinfo.next_scanline * width * 3;
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    QByteArray jpeg((const char*) buffer, size);
+    free(buffer);
+    return jpeg;
+}
+
+static void runFile(const int& seed) {
+    cjobresult result = runJob(makeJob(makeJPEG(seed)));
+    if (result.result < 0) {
+        qWarning() << "File" << seed << "failed:" << result.message;
+    }
+}
+
+//The workers log every file, only problems are worth printing here
+static void quietHandler(QtMsgType type, const QMessageLogContext&, const QString& msg) {
+    if (type != QtDebugMsg && type != QtInfoMsg) {
+        fprintf(stderr, "%s\n", msg.toLocal8Bit().constData());
+    }
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication a(argc, argv);
+    qInstallMessageHandler(quietHandler);
+
+    int files = argc > 1 ? qMax(WARMUP_FILES, atoi(argv[1])) : 100000;
+
+    //What a batch with the usual preferences asks of the workers
+    params.markers = CCLT_KEEP_ALL;
+    params.progressive = CCLT_SCANS_AUTO;
+    params.orientation = CCLT_ORIENTATION_PERFECT;
+    params.exif = 1;
+    params.importantExifs = QList<cexifs>() << EXIF_COPYRIGHT << EXIF_DATE;
+    params.verify = true;
+    params.effort = CCLT_EFFORT_DEFAULT;
+    params.scanBudget = 0;
+    params.arithmetic = false;
+
+    QVector<int> seeds;
+    for (int i = 0; i < files; i++) {
+        seeds.append(i);
+    }
+
+    QtConcurrent::blockingMap(seeds.begin(), seeds.begin() + WARMUP_FILES, runFile);
+    qint64 reference = residentBytes();
+    if (reference < 0) {
+        printf("Resident memory can't be read on this platform, nothing checked\n");
+        return 0;
+    }
+    printf("%d files, %s resident\n", WARMUP_FILES, toHumanSize(reference).toUtf8().constData());
+
+    qint64 peak = reference;
+    for (int done = WARMUP_FILES; done < files; ) {
+        int round = qMin(ROUND_FILES, files - done);
+        QtConcurrent::blockingMap(seeds.begin() + done, seeds.begin() + done + round, runFile);
+        done += round;
+        qint64 resident = residentBytes();
+        peak = qMax(peak, resident);
+        printf("%d files, %s resident\n", done, toHumanSize(resident).toUtf8().constData());
+    }
+
+    qint64 growth = peak - reference;
+    if (growth > MAX_GROWTH) {
+        printf("FAIL: grew by %s past the warm-up, the bound is %s\n",
+               toHumanSize(growth).toUtf8().constData(), toHumanSize(MAX_GROWTH).toUtf8().constData());
+        return 1;
+    }
+    printf("PASS: grew by %s past the warm-up\n", toHumanSize(growth).toUtf8().constData());
+    return 0;
+}
@@ -0,0 +1,61 @@
+#-------------------------------------------------
+#
+# Memory regression test of the compression workers:
+# qmake && make && ./workermemory [FILES]
+#
+#-------------------------------------------------
+
+QT       += core gui concurrent
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+TARGET = workermemory
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+macx {
+    QMAKE_CXXFLAGS_CXX11 = -std=gnu++1y
+    CONFIG *= c++11
+    QMAKE_CXXFLAGS += -stdlib=libc++
+    LIBS += -L/usr/local/lib -lexiv2.14 -L/opt/mozjpeg/lib -ljpeg.62 -stdlib=libc++
+    INCLUDEPATH += /opt/mozjpeg/include /usr/local/include
+    DEFINES += CCLT_MOZJPEG
+}
+
+win32 {
+    LIBS += -LC:\\mozjpeg\\lib -ljpeg -LC:\\exiv2\\src\\.libs -lexiv2
+    INCLUDEPATH += C:\\mozjpeg\\include C:\\exiv2\\include
+    DEFINES += CCLT_MOZJPEG
+}
+
+unix {
+    LIBS += -ljpeg -lexiv2
+}
+
+CONFIG += warn_off c++11
+
+INCLUDEPATH += ../../src
+
+SOURCES += workermemory.cpp \
+    ../../src/lossless.cpp \
+    ../../src/transform.cpp \
+    ../../src/markers.cpp \
+    ../../src/scans.cpp \
+    ../../src/tiff.cpp \
+    ../../src/inspect.cpp \
+    ../../src/utils.cpp \
+    ../../src/exif.cpp \
+    ../../src/ctrace.cpp \
+    ../../src/cworker.cpp
+
+HEADERS  += ../../src/lossless.h \
+    ../../src/transform.h \
+    ../../src/markers.h \
+    ../../src/scans.h \
+    ../../src/tiff.h \
+    ../../src/inspect.h \
+    ../../src/utils.h \
+    ../../src/exif.h \
+    ../../src/ctrace.h \
+    ../../src/cworker.h